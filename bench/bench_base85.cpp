@@ -0,0 +1,146 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "base85.h"
+#include "benchutil.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+/** Base85 encoding throughput of the routine used before the SIMD
+ * kernels, of the scalar reference and of the kernel selected for
+ * this CPU.
+ */
+
+static const char encoder[85 + 1] = {
+	"0123456789"
+	"abcdefghij"
+	"klmnopqrst"
+	"uvwxyzABCD"
+	"EFGHIJKLMN"
+	"OPQRSTUVWX"
+	"YZ.-:+=^!/"
+	"*?&<>()[]{"
+	"}@%$#"
+};
+
+/** The original per-byte routine from esswriter.cpp, kept verbatim as
+ * the baseline.
+ */
+static size_t base85_encode_original(const unsigned char *data, size_t input_length, unsigned char *encoded_data)
+{
+	unsigned int remainder = input_length % 4;
+	unsigned int padding_size = 0;
+	if (remainder > 0)
+	{
+		padding_size = 4 - remainder;
+	}
+	unsigned int padded_length = input_length + padding_size;
+	unsigned int output_length = (padded_length / 4) * 5 - padding_size;
+
+	unsigned int char_nbr = 0;
+	for (unsigned int byte_nbr = 0; byte_nbr < padded_length; byte_nbr += 4)
+	{
+		unsigned int value = 0;
+		if (byte_nbr + 0 < input_length)
+		{
+			value += (data[byte_nbr + 0] << 3 * 8);
+		}
+		if (byte_nbr + 1 < input_length)
+		{
+			value += (data[byte_nbr + 1] << 2 * 8);
+		}
+		if (byte_nbr + 2 < input_length)
+		{
+			value += (data[byte_nbr + 2] << 1 * 8);
+		}
+		if (byte_nbr + 3 < input_length)
+		{
+			value += data[byte_nbr + 3];
+		}
+		if (char_nbr < output_length)
+		{
+			encoded_data[char_nbr] = encoder[value / (85 * 85 * 85 * 85) % 85];
+			++ char_nbr;
+		}
+		if (char_nbr < output_length)
+		{
+			encoded_data[char_nbr] = encoder[value / (85 * 85 * 85) % 85];
+			++ char_nbr;
+		}
+		if (char_nbr < output_length)
+		{
+			encoded_data[char_nbr] = encoder[value / (85 * 85) % 85];
+			++ char_nbr;
+		}
+		if (char_nbr < output_length)
+		{
+			encoded_data[char_nbr] = encoder[value / 85 % 85];
+			++ char_nbr;
+		}
+		if (char_nbr < output_length)
+		{
+			encoded_data[char_nbr] = encoder[value % 85];
+			++ char_nbr;
+		}
+	}
+
+	encoded_data[char_nbr] = '\0';
+
+	return char_nbr + 1;
+}
+
+typedef size_t (*encode_func)(const unsigned char *data, size_t input_length, unsigned char *encoded_data);
+
+static double measure(encode_func encode, const std::vector<unsigned char> &data, std::vector<unsigned char> &out, int repeats)
+{
+	/* warm up caches and the kernel selection */
+	encode(&data[0], data.size(), &out[0]);
+
+	BenchTimer timer;
+	for (int i = 0; i < repeats; ++i)
+	{
+		encode(&data[0], data.size(), &out[0]);
+	}
+	return bench_mb_per_second(data.size() * (size_t)repeats, timer.Seconds());
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t size_mb = argc > 1 ? (size_t)atoi(argv[1]) : 64;
+	const int repeats = argc > 2 ? atoi(argv[2]) : 5;
+
+	/* the encoders do not branch on the data, random bytes are as
+	   representative as real index arrays */
+	std::vector<unsigned char> data(size_mb << 20);
+	srand(85);
+	for (size_t i = 0; i < data.size(); ++i)
+	{
+		data[i] = (unsigned char)rand();
+	}
+	std::vector<unsigned char> out(base85_calc_encode_bound(data.size()));
+
+	const double original = measure(base85_encode_original, data, out, repeats);
+	const double scalar = measure(base85_encode_scalar, data, out, repeats);
+	const double selected = measure(base85_encode, data, out, repeats);
+
+	printf("base85 encode, %u MB x %d\n", (unsigned int)size_mb, repeats);
+	printf("  original   %10.1f MB/s\n", original);
+	printf("  scalar     %10.1f MB/s  %5.2fx\n", scalar, scalar / original);
+	printf("  %-10s %10.1f MB/s  %5.2fx\n", base85_kernel_name(), selected, selected / original);
+	return 0;
+}
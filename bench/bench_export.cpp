@@ -0,0 +1,143 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include <string.h>
+#include "ElaraHomeAPI.h"
+#include "benchscene.h"
+#include "benchutil.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+/** Export time of a generated scene versus the number of pipeline
+ * threads. The output of every run is compared with the serial one,
+ * the pipeline must not change a single byte.
+ *
+ * Usage: bench_export [meshes] [rings] [threads...]
+ * Defaults to 2000 meshes of 2 * 64 * 64 triangles on 1, 2, 4 and all
+ * cores (0).
+ */
+
+static unsigned long long hash_file(const char *filename, unsigned long long &size)
+{
+	unsigned long long hash = 14695981039346656037ull;
+	size = 0;
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL)
+	{
+		return 0;
+	}
+	unsigned char buffer[65536];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			hash = (hash ^ buffer[i]) * 1099511628211ull;
+		}
+		size += count;
+	}
+	fclose(file);
+	return hash;
+}
+
+static double export_scene(const char *filename, unsigned int numThreads, const BenchMesh &shape, unsigned int numMeshes)
+{
+	EH_Mesh mesh;
+	mesh.num_verts = shape.GetNumVerts();
+	mesh.num_faces = shape.GetNumTriangles();
+	mesh.verts = (EH_Vec *)&shape.verts[0];
+	mesh.normals = (EH_Vec *)&shape.normals[0];
+	mesh.uvs = (EH_Vec2 *)&shape.uvs[0];
+	mesh.face_indices = (uint_t *)&shape.indices[0];
+
+	EH_Context *ctx = EH_create();
+	EH_ExportOptions2 options;
+	options.num_threads = numThreads;
+	/* every mesh is encoded, even though they share the shape */
+	options.mesh_dedup = EH_DEDUP_NONE;
+
+	BenchTimer timer;
+	EH_begin_export2(ctx, filename, &options);
+	char name[64];
+	for (unsigned int i = 0; i < numMeshes; ++i)
+	{
+		snprintf(name, sizeof(name), "mesh_%u", i);
+		EH_add_mesh(ctx, name, &mesh);
+
+		EH_MeshInstance inst;
+		inst.mesh_name = name;
+		inst.mesh_to_world[0] = inst.mesh_to_world[5] = inst.mesh_to_world[10] = inst.mesh_to_world[15] = 1.0f;
+		inst.mesh_to_world[12] = (float)(i % 50) * 3.0f;
+		inst.mesh_to_world[13] = (float)(i / 50) * 3.0f;
+		snprintf(name, sizeof(name), "inst_%u", i);
+		EH_add_mesh_instance(ctx, name, &inst);
+	}
+	const bool ok = EH_end_export(ctx);
+	const double seconds = timer.Seconds();
+	EH_delete(ctx);
+	return ok ? seconds : -1.0;
+}
+
+int main(int argc, char *argv[])
+{
+	const unsigned int numMeshes = argc > 1 ? (unsigned int)atoi(argv[1]) : 2000;
+	const unsigned int rings = argc > 2 ? (unsigned int)atoi(argv[2]) : 64;
+	std::vector<unsigned int> threads;
+	for (int i = 3; i < argc; ++i)
+	{
+		threads.push_back((unsigned int)atoi(argv[i]));
+	}
+	if (threads.empty())
+	{
+		const unsigned int defaults[] = { 1, 2, 4, 0 };
+		threads.assign(defaults, defaults + 4);
+	}
+
+	BenchMesh shape;
+	bench_make_torus(shape, rings, rings, 1.0f, 0.25f);
+	printf("Export of %u meshes with %u triangles each\n", numMeshes, shape.GetNumTriangles());
+
+	double serialSeconds = 0.0;
+	unsigned long long serialHash = 0;
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		const char *filename = "bench_export.ess";
+		const double seconds = export_scene(filename, threads[i], shape, numMeshes);
+		unsigned long long size = 0;
+		const unsigned long long hash = hash_file(filename, size);
+		remove(filename);
+		if (seconds < 0.0)
+		{
+			printf("  %2u threads  export failed\n", threads[i]);
+			continue;
+		}
+		if (threads[i] == 1)
+		{
+			serialSeconds = seconds;
+			serialHash = hash;
+		}
+		printf("  %2u threads  %8.2f s  %8.1f MB/s", threads[i], seconds, bench_mb_per_second((size_t)size, seconds));
+		if (serialSeconds > 0.0)
+		{
+			printf("  %5.2fx%s", serialSeconds / seconds, hash == serialHash ? "" : "  OUTPUT DIFFERS");
+		}
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,158 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "esssink.h"
+#include "benchutil.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <fstream>
+#include <ostream>
+
+/** Throughput and write system calls of ESS-like text lines written
+ * through std::ofstream ending every line with std::endl, as the
+ * exporter did before the sinks, through std::ofstream without the
+ * flushes, and through EssSinkBuffer with several buffer sizes and with
+ * direct I/O. System calls are counted on Linux only.
+ */
+
+static const char *g_line = "\tb85_vertex_list \"pos_list\" 0 0 \"0aB.-:+=^!/*?&<>()[]{}@%$#0aB.-:+=^!/*?&<>()[]{}@%$#\"\n";
+
+/** Write system calls of this process so far, -1 if unknown. */
+static long long write_syscalls()
+{
+	long long count = -1;
+	FILE *file = fopen("/proc/self/io", "r");
+	if (file == NULL)
+	{
+		return -1;
+	}
+	char line[128];
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		if (sscanf(line, "syscw: %lld", &count) == 1)
+		{
+			break;
+		}
+	}
+	fclose(file);
+	return count;
+}
+
+static void print_result(const char *label, size_t written, double seconds, long long before, long long after, bool ok)
+{
+	char writes[32] = "";
+	if (before >= 0 && after >= before)
+	{
+		snprintf(writes, sizeof(writes), "%lld writes", after - before);
+	}
+	printf("  %-28s %10.1f MB/s  %s%s\n", label, bench_mb_per_second(written, seconds), writes, ok ? "" : "  FAILED");
+}
+
+/** flushLines ends the lines with std::endl like the old EssWriter. */
+static size_t write_lines(std::ostream &stream, size_t bytes, bool flushLines)
+{
+	const std::string line(g_line);
+	const std::string body = line.substr(0, line.size() - 1);
+	size_t written = 0;
+	while (written < bytes)
+	{
+		if (flushLines)
+		{
+			stream << "node \"poly\" \"mesh_" << written << "\"" << std::endl;
+			for (int i = 0; i < 16; ++i)
+			{
+				stream << body << std::endl;
+			}
+			stream << "end" << std::endl;
+		}
+		else
+		{
+			stream << "node \"poly\" \"mesh_" << written << "\"\n";
+			for (int i = 0; i < 16; ++i)
+			{
+				stream << line;
+			}
+			stream << "end\n";
+		}
+		written += 16 * line.size() + 32;
+	}
+	return written;
+}
+
+static void bench_ofstream(const char *filename, size_t bytes, bool flushLines)
+{
+	const long long before = write_syscalls();
+	BenchTimer timer;
+	size_t written = 0;
+	bool ok = false;
+	{
+		std::ofstream stream(filename, std::ios::out | std::ios::binary);
+		written = write_lines(stream, bytes, flushLines);
+		stream.close();
+		ok = !stream.fail();
+	}
+	const double seconds = timer.Seconds();
+	print_result(flushLines ? "std::ofstream std::endl" : "std::ofstream", written, seconds, before, write_syscalls(), ok);
+}
+
+static void bench_sink(const char *filename, size_t bytes, size_t bufferSize, bool direct)
+{
+	EssFileSinkOptions options;
+	options.buffer_size = bufferSize;
+	options.direct_io = direct;
+
+	const long long before = write_syscalls();
+	BenchTimer timer;
+	EssFileSink sink;
+	if (!sink.Open(filename, options))
+	{
+		printf("Can't create %s\n", filename);
+		return;
+	}
+	EssSinkBuffer buffer;
+	if (!buffer.Attach(&sink, options.buffer_size))
+	{
+		printf("Can't allocate %u bytes\n", (unsigned int)options.buffer_size);
+		return;
+	}
+	std::ostream stream(&buffer);
+	const size_t written = write_lines(stream, bytes, false);
+	const bool ok = buffer.Detach() && sink.Close();
+	const double seconds = timer.Seconds();
+
+	char label[64];
+	snprintf(label, sizeof(label), "EssFileSink %u KB%s", (unsigned int)(bufferSize >> 10), direct ? " direct" : "");
+	print_result(label, written, seconds, before, write_syscalls(), ok);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filename = argc > 1 ? argv[1] : "bench_sink.ess";
+	const size_t size_mb = argc > 2 ? (size_t)atoi(argv[2]) : 256;
+	const size_t bytes = size_mb << 20;
+
+	printf("ESS text output, %u MB to %s\n", (unsigned int)size_mb, filename);
+	bench_ofstream(filename, bytes, true);
+	bench_ofstream(filename, bytes, false);
+	bench_sink(filename, bytes, 64 << 10, false);
+	bench_sink(filename, bytes, ESS_SINK_DEFAULT_BUFFER_SIZE, false);
+	bench_sink(filename, bytes, 8 << 20, false);
+	bench_sink(filename, bytes, ESS_SINK_DEFAULT_BUFFER_SIZE, true);
+	remove(filename);
+	return 0;
+}
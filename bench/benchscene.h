@@ -0,0 +1,172 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#pragma once
+
+#include <math.h>
+#include <vector>
+
+/** Generated geometry for the benchmarks, the same for every run.
+ */
+struct BenchMesh
+{
+	std::vector<float> verts;			/**< xyz per vertex */
+	std::vector<float> normals;			/**< xyz per vertex */
+	std::vector<float> uvs;				/**< uv per vertex */
+	std::vector<unsigned int> indices;	/**< 3 per triangle */
+
+	unsigned int GetNumVerts() const { return (unsigned int)(verts.size() / 3); }
+	unsigned int GetNumTriangles() const { return (unsigned int)(indices.size() / 3); }
+};
+
+/** A torus of rings x sides quads split into triangles, centered at the
+ * origin in the XY plane.
+ */
+inline void bench_make_torus(BenchMesh &mesh, unsigned int rings, unsigned int sides, float major_radius, float minor_radius)
+{
+	const float two_pi = 6.28318531f;
+	mesh.verts.clear();
+	mesh.normals.clear();
+	mesh.uvs.clear();
+	mesh.indices.clear();
+	for (unsigned int i = 0; i <= rings; ++i)
+	{
+		const float u = (float)i / (float)rings;
+		const float cu = cosf(u * two_pi), su = sinf(u * two_pi);
+		for (unsigned int j = 0; j <= sides; ++j)
+		{
+			const float v = (float)j / (float)sides;
+			const float cv = cosf(v * two_pi), sv = sinf(v * two_pi);
+			const float r = major_radius + minor_radius * cv;
+			mesh.verts.push_back(r * cu);
+			mesh.verts.push_back(r * su);
+			mesh.verts.push_back(minor_radius * sv);
+			mesh.normals.push_back(cv * cu);
+			mesh.normals.push_back(cv * su);
+			mesh.normals.push_back(sv);
+			mesh.uvs.push_back(u);
+			mesh.uvs.push_back(v);
+		}
+	}
+	for (unsigned int i = 0; i < rings; ++i)
+	{
+		for (unsigned int j = 0; j < sides; ++j)
+		{
+			const unsigned int a = i * (sides + 1) + j;
+			const unsigned int b = a + sides + 1;
+			const unsigned int tris[6] = { a, b, a + 1, a + 1, b, b + 1 };
+			mesh.indices.insert(mesh.indices.end(), tris, tris + 6);
+		}
+	}
+}
+
+/** Deterministic random numbers, the same on every platform.
+ */
+class BenchRandom
+{
+public:
+	BenchRandom(unsigned long long seed) : mState(seed * 6364136223846793005ull + 1442695040888963407ull) {}
+
+	/** Uniform in [0, n) */
+	unsigned int Next(unsigned int n)
+	{
+		mState = mState * 6364136223846793005ull + 1442695040888963407ull;
+		return (unsigned int)((mState >> 33) % n);
+	}
+
+private:
+	unsigned long long mState;
+};
+
+/** Shuffle the triangles and renumber the vertices randomly, the way
+ * triangulated CAD output often arrives. The surface stays the same.
+ */
+inline void bench_shuffle_mesh(BenchMesh &mesh, unsigned long long seed)
+{
+	BenchRandom random(seed);
+	const unsigned int numTriangles = mesh.GetNumTriangles();
+	for (unsigned int i = numTriangles; i > 1; --i)
+	{
+		const unsigned int j = random.Next(i);
+		for (int k = 0; k < 3; ++k)
+		{
+			const unsigned int tmp = mesh.indices[(i - 1) * 3 + k];
+			mesh.indices[(i - 1) * 3 + k] = mesh.indices[j * 3 + k];
+			mesh.indices[j * 3 + k] = tmp;
+		}
+	}
+
+	const unsigned int numVerts = mesh.GetNumVerts();
+	std::vector<unsigned int> order(numVerts);
+	for (unsigned int i = 0; i < numVerts; ++i)
+	{
+		order[i] = i;
+	}
+	for (unsigned int i = numVerts; i > 1; --i)
+	{
+		const unsigned int j = random.Next(i);
+		const unsigned int tmp = order[i - 1];
+		order[i - 1] = order[j];
+		order[j] = tmp;
+	}
+	/* vertex order[i] moves to slot i */
+	std::vector<unsigned int> slot(numVerts);
+	BenchMesh shuffled;
+	shuffled.verts.resize(mesh.verts.size());
+	shuffled.normals.resize(mesh.normals.size());
+	shuffled.uvs.resize(mesh.uvs.size());
+	for (unsigned int i = 0; i < numVerts; ++i)
+	{
+		const unsigned int v = order[i];
+		slot[v] = i;
+		for (int k = 0; k < 3; ++k)
+		{
+			shuffled.verts[i * 3 + k] = mesh.verts[v * 3 + k];
+			shuffled.normals[i * 3 + k] = mesh.normals[v * 3 + k];
+		}
+		shuffled.uvs[i * 2] = mesh.uvs[v * 2];
+		shuffled.uvs[i * 2 + 1] = mesh.uvs[v * 2 + 1];
+	}
+	shuffled.indices.resize(mesh.indices.size());
+	for (size_t i = 0; i < mesh.indices.size(); ++i)
+	{
+		shuffled.indices[i] = slot[mesh.indices[i]];
+	}
+	mesh.verts.swap(shuffled.verts);
+	mesh.normals.swap(shuffled.normals);
+	mesh.uvs.swap(shuffled.uvs);
+	mesh.indices.swap(shuffled.indices);
+}
+
+/** Append part translated by (dx, dy, dz).
+ */
+inline void bench_append_mesh(BenchMesh &mesh, const BenchMesh &part, float dx, float dy, float dz)
+{
+	const unsigned int base = mesh.GetNumVerts();
+	for (size_t i = 0; i < part.verts.size(); i += 3)
+	{
+		mesh.verts.push_back(part.verts[i] + dx);
+		mesh.verts.push_back(part.verts[i + 1] + dy);
+		mesh.verts.push_back(part.verts[i + 2] + dz);
+	}
+	mesh.normals.insert(mesh.normals.end(), part.normals.begin(), part.normals.end());
+	mesh.uvs.insert(mesh.uvs.end(), part.uvs.begin(), part.uvs.end());
+	for (size_t i = 0; i < part.indices.size(); ++i)
+	{
+		mesh.indices.push_back(part.indices[i] + base);
+	}
+}
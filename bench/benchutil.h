@@ -0,0 +1,45 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <chrono>
+
+/** Wall clock timer for the benchmarks, started on construction.
+ */
+class BenchTimer
+{
+public:
+	BenchTimer()
+		: mStart(std::chrono::steady_clock::now())
+	{
+	}
+
+	double Seconds() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point	mStart;
+};
+
+inline double bench_mb_per_second(size_t bytes, double seconds)
+{
+	return seconds > 0.0 ? (double)bytes / (1024.0 * 1024.0) / seconds : 0.0;
+}
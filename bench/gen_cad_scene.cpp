@@ -0,0 +1,134 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include <string.h>
+#include "ElaraHomeAPI.h"
+#include "benchscene.h"
+#include "benchutil.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+/** Writes a benchmark scene for triangle reordering: one large mesh
+ * made of parts x parts tori, with triangles and vertices shuffled like
+ * triangulated CAD output. It is exported twice, as given and with
+ * reorder_triangles, to <prefix>_shuffled.ess and <prefix>_reordered.ess.
+ * Render both with er to compare BVH build and render time.
+ *
+ * Usage: gen_cad_scene [prefix] [parts] [rings]
+ * The defaults give 16 x 16 parts of 2 * 64 * 64 triangles, about
+ * 2 million triangles.
+ */
+
+static void look_at(EH_Mat m, const float eye[3], const float target[3])
+{
+	/* Z up world, the camera looks down its -Z axis with Y up */
+	float f[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+	float l = sqrtf(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+	f[0] /= l; f[1] /= l; f[2] /= l;
+	float x[3] = { f[1], -f[0], 0.0f };
+	l = sqrtf(x[0] * x[0] + x[1] * x[1]);
+	x[0] /= l; x[1] /= l;
+	const float y[3] = { x[1] * f[2] - x[2] * f[1], x[2] * f[0] - x[0] * f[2], x[0] * f[1] - x[1] * f[0] };
+	const float rows[16] = {
+		x[0], x[1], x[2], 0.0f,
+		y[0], y[1], y[2], 0.0f,
+		-f[0], -f[1], -f[2], 0.0f,
+		eye[0], eye[1], eye[2], 1.0f };
+	memcpy(m, rows, sizeof(rows));
+}
+
+static bool export_scene(const std::string &filename, const BenchMesh &shape, float extent, bool reorder)
+{
+	EH_Context *ctx = EH_create();
+	EH_ExportOptions2 options;
+	options.reorder_triangles = reorder;
+
+	BenchTimer timer;
+	EH_begin_export2(ctx, filename.c_str(), &options);
+
+	EH_RenderOptions render;
+	render.quality = EH_MEDIUM;
+	EH_set_render_options(ctx, &render);
+
+	EH_Camera cam;
+	cam.fov = 0.8f;
+	cam.near_clip = 0.01f;
+	cam.far_clip = extent * 10.0f;
+	cam.image_width = 1280;
+	cam.image_height = 720;
+	const float eye[3] = { extent * 0.5f, -extent * 0.4f, extent * 0.6f };
+	const float target[3] = { extent * 0.5f, extent * 0.5f, 0.0f };
+	look_at(cam.view_to_world, eye, target);
+	EH_set_camera(ctx, &cam);
+
+	EH_Sun sun;
+	sun.dir[0] = 0.8f;
+	sun.dir[1] = 0.6f;
+	sun.color[0] = sun.color[1] = sun.color[2] = 1.0f;
+	sun.intensity = 3.0f;
+	EH_set_sun(ctx, &sun);
+
+	EH_Material material;
+	EH_add_material(ctx, "cad_material", &material);
+
+	EH_Mesh mesh;
+	mesh.num_verts = shape.GetNumVerts();
+	mesh.num_faces = shape.GetNumTriangles();
+	mesh.verts = (EH_Vec *)&shape.verts[0];
+	mesh.normals = (EH_Vec *)&shape.normals[0];
+	mesh.uvs = (EH_Vec2 *)&shape.uvs[0];
+	mesh.face_indices = (uint_t *)&shape.indices[0];
+	EH_add_mesh(ctx, "cad_mesh", &mesh);
+
+	EH_MeshInstance inst;
+	inst.mesh_name = "cad_mesh";
+	inst.mesh_to_world[0] = inst.mesh_to_world[5] = inst.mesh_to_world[10] = inst.mesh_to_world[15] = 1.0f;
+	inst.mtl_names[0] = "cad_material";
+	EH_add_mesh_instance(ctx, "cad_inst", &inst);
+
+	const bool ok = EH_end_export(ctx);
+	EH_delete(ctx);
+	printf("  %-32s %s in %.2f s\n", filename.c_str(), ok ? "written" : "FAILED", timer.Seconds());
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	const std::string prefix = argc > 1 ? argv[1] : "cad_scene";
+	const unsigned int parts = argc > 2 ? (unsigned int)atoi(argv[2]) : 16;
+	const unsigned int rings = argc > 3 ? (unsigned int)atoi(argv[3]) : 64;
+	const float spacing = 3.0f;
+
+	BenchMesh part;
+	bench_make_torus(part, rings, rings, 1.0f, 0.3f);
+	BenchMesh shape;
+	for (unsigned int y = 0; y < parts; ++y)
+	{
+		for (unsigned int x = 0; x < parts; ++x)
+		{
+			bench_append_mesh(shape, part, (float)x * spacing, (float)y * spacing, 0.0f);
+		}
+	}
+	bench_shuffle_mesh(shape, 12);
+	printf("CAD scene with %u triangles and %u vertices\n", shape.GetNumTriangles(), shape.GetNumVerts());
+
+	const float extent = (float)parts * spacing;
+	const bool ok = export_scene(prefix + "_shuffled.ess", shape, extent, false) &&
+		export_scene(prefix + "_reordered.ess", shape, extent, true);
+	return ok ? 0 : 1;
+}
@@ -43,6 +43,7 @@
 
 #define EH_API EH_EXTERN EH_XAPI
 
+#include <string.h>
 #include <vector>
 
 /* Data types */
@@ -155,6 +156,43 @@ EH_API void EH_delete(EH_Context *ctx);
 
 
 
+/** Compression of arrays in the binary sidecar
+ */
+enum EH_Compression
+{
+	EH_COMPRESSION_NONE = 0,
+	EH_COMPRESSION_ZLIB,
+	EH_COMPRESSION_ZSTD,		/**< Falls back to zlib when built without zstd */
+};
+
+/** Detection of meshes added more than once
+ */
+enum EH_MeshDedup
+{
+	EH_DEDUP_NONE = 0,
+	EH_DEDUP_EXACT,			/**< Identical arrays */
+	EH_DEDUP_RIGID,			/**< Also identical up to a rotation and translation */
+};
+
+/** Which mesh instances the cameras can't see are left out of the export.
+ * Only instances added after the camera are considered.
+ */
+enum EH_PruneMode
+{
+	EH_PRUNE_OFF = 0,
+	EH_PRUNE_CONSERVATIVE,	/**< Out of view and farther than prune_distance */
+	EH_PRUNE_AGGRESSIVE,	/**< Also out of view nearby, unless large enough to enclose or shadow the view */
+};
+
+/** What the exporter does with invalid geometry
+ */
+enum EH_ValidatePolicy
+{
+	EH_VALIDATE_OFF = 0,
+	EH_VALIDATE_REPORT,		/**< Report per mesh, only triangles with out of range indices are dropped */
+	EH_VALIDATE_FIX,		/**< Also drop triangles with NaN vertices, renormalize normals and clamp huge coordinates */
+};
+
 /** The exporting options for user to fill
  */
 struct EH_ExportOptions
@@ -163,16 +201,92 @@ struct EH_ExportOptions
 	bool left_handed;		/**< Is source data in left-handed space? */
 };
 
+/** The extended exporting options for EH_begin_export2. Fields are
+ * only ever appended, the DLL reads the first size bytes and keeps
+ * the defaults for fields the caller's header did not have yet.
+ */
+struct EH_ExportOptions2
+{
+	unsigned int size;		/**< sizeof(EH_ExportOptions2) of the caller, set by the constructor */
+	bool base85_encoding;	/**< Use Base85 encoding? */
+	bool left_handed;		/**< Is source data in left-handed space? */
+	bool binary_sidecar;	/**< Store mesh arrays raw in a memory-mappable .essbin file next to the ESS? */
+	EH_Compression sidecar_compression;	/**< Block compression of sidecar arrays, decoded in parallel on loading */
+	int compression_level;	/**< Codec level, 0 uses the codec default */
+	unsigned int num_threads;	/**< Threads encoding meshes, 1 encodes on the calling thread, 0 uses all cores */
+	unsigned int shard_meshes;	/**< Write every this many meshes to a shard file included by the ESS, 0 disables sharding */
+	bool incremental;		/**< Reuse unchanged shards and nodes of the last export, needs sharding and is off for the sidecar */
+	EH_MeshDedup mesh_dedup;	/**< Write duplicated meshes once, their instances reference the first one */
+	float weld_tolerance;	/**< Merge vertices closer than this times the mesh size whose normal and UV match, 0 disables welding */
+	bool reorder_triangles;	/**< Sort triangles spatially and vertices by first use, for cache locality and compression */
+	unsigned int split_triangles;	/**< Split meshes with more triangles into spatial clusters under an instgroup of the mesh name, 0 disables splitting */
+	EH_ValidatePolicy validate_policy;	/**< Check every mesh array for NaN, infinity, bad indices and normals */
+	float max_coordinate;	/**< Position coordinates of larger magnitude are absurd */
+	unsigned long long expected_bytes;	/**< Estimated input bytes of the scene for progress, 0 if unknown */
+	const char *stats_filename;	/**< Write a JSON breakdown of export time and bytes here at the end, NULL disables */
+	const char *texture_cache_dir;	/**< Convert textures to tiled, mip-mapped files in this directory and refer to those, NULL disables */
+	bool cap_texture_resolution;	/**< Downsample cached textures to what the camera resolves on the objects using them */
+	unsigned int atlas_texture_size;	/**< Pack cached 8 bit textures no larger than this into atlases, 0 disables */
+	bool material_dedup;	/**< Write materials with identical parameters once, instances reference the first one */
+	EH_PruneMode prune_mode;	/**< Leave out mesh instances the cameras can't see */
+	float prune_margin;		/**< Widen the view by this fraction when pruning */
+	float prune_distance;	/**< Instances out of view but closer to a camera are kept for their shadows */
+	float light_cluster_error;	/**< Merge similar lights while the light reaching the mesh bounds changes less than this fraction, 0 disables */
+	unsigned int light_sample_budget;	/**< Share this many samples among the lights by their estimated contribution to the view, 0 disables */
+	bool displace_per_object;	/**< Subdivide each displaced instance as far as the camera resolves it */
+	float displace_edge_length;	/**< Target edge of displaced micro-triangles in pixels */
+	unsigned long long displace_triangle_budget;	/**< Coarsen displacement until the scene has fewer estimated micro-triangles, 0 for no limit */
+
+	EH_ExportOptions2() :
+		size(sizeof(EH_ExportOptions2)),
+		base85_encoding(true),
+		left_handed(false),
+		binary_sidecar(false),
+		sidecar_compression(EH_COMPRESSION_NONE),
+		compression_level(0),
+		num_threads(1),
+		shard_meshes(0),
+		incremental(false),
+		mesh_dedup(EH_DEDUP_NONE),
+		weld_tolerance(0.0f),
+		reorder_triangles(false),
+		split_triangles(0),
+		validate_policy(EH_VALIDATE_REPORT),
+		max_coordinate(1.0e7f),
+		expected_bytes(0),
+		stats_filename(NULL),
+		texture_cache_dir(NULL),
+		cap_texture_resolution(false),
+		atlas_texture_size(0),
+		material_dedup(false),
+		prune_mode(EH_PRUNE_OFF),
+		prune_margin(0.1f),
+		prune_distance(0.0f),
+		light_cluster_error(0.0f),
+		light_sample_budget(0),
+		displace_per_object(false),
+		displace_edge_length(1.0f),
+		displace_triangle_budget(0)
+	{
+	}
+};
+
 /** Begin exporting, set options which are effective 
  * during the exporting process.
  * \param filename The ESS filename to create.
  * \param opt The export options
  */
 EH_API void EH_begin_export(EH_Context *ctx, const char *filename, const EH_ExportOptions *opt);
+/** Begin exporting with the extended options.
+ * \param filename The ESS filename to create.
+ * \param opt The export options, opt->size must be set
+ */
+EH_API void EH_begin_export2(EH_Context *ctx, const char *filename, const EH_ExportOptions2 *opt);
 /** End exporting, clean up resources only valid during 
  * the exporting process.
+ * Returns false if the output could not be written completely.
  */
-EH_API void EH_end_export(EH_Context *ctx);
+EH_API bool EH_end_export(EH_Context *ctx);
 
 
 /** The callback to log messages during exporting.
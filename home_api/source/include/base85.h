@@ -0,0 +1,80 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+
+/** Base85 encoding used by the b85_* array parameters of ESS.
+ * Every 4-byte group is read as a big-endian 32-bit value and written
+ * as 5 characters, the last partial group is written with
+ * (remainder + 1) characters.
+ */
+
+/** Number of bytes needed to encode input_length bytes, including
+ * the terminating NUL character.
+ */
+size_t base85_calc_encode_bound(size_t input_length);
+
+/** Encode input_length bytes into encoded_data, which must have room
+ * for base85_calc_encode_bound(input_length) bytes. The output is NUL
+ * terminated, the returned size includes the NUL character.
+ * The SIMD kernel is selected at runtime depending on the CPU.
+ */
+size_t base85_encode(const unsigned char *data, size_t input_length, unsigned char *encoded_data);
+
+/** Encode whole 4-byte groups only, without NUL termination.
+ * input_length must be a multiple of 4, returns (input_length / 4) * 5.
+ * This is the building block for chunked encoding.
+ */
+size_t base85_encode_groups(const unsigned char *data, size_t input_length, unsigned char *encoded_data);
+
+/** Reference scalar implementation, always available.
+ */
+size_t base85_encode_scalar(const unsigned char *data, size_t input_length, unsigned char *encoded_data);
+
+/** Number of bytes decoded from encoded_length characters.
+ */
+size_t base85_calc_decode_size(size_t encoded_length);
+
+/** Decode encoded_length characters (without NUL) into data, which must
+ * have room for base85_calc_decode_size(encoded_length) bytes.
+ * Returns the number of decoded bytes, or 0 on invalid input.
+ */
+size_t base85_decode(const unsigned char *encoded_data, size_t encoded_length, unsigned char *data);
+
+/** Name of the kernel selected for this CPU, for logging.
+ */
+const char *base85_kernel_name();
+
+/** The encoding kernels, base85_encode picks the fastest one the CPU
+ * supports.
+ */
+enum base85_kernel
+{
+	BASE85_KERNEL_SCALAR = 0,
+	BASE85_KERNEL_SSE41,
+	BASE85_KERNEL_AVX2,
+};
+
+/** Can this CPU run the kernel?
+ */
+bool base85_kernel_supported(base85_kernel kernel);
+
+/** base85_encode with the given kernel instead of the selected one, for
+ * tests and benchmarks. Returns 0 if the CPU doesn't support it.
+ */
+size_t base85_encode_kernel(base85_kernel kernel, const unsigned char *data, size_t input_length, unsigned char *encoded_data);
@@ -0,0 +1,103 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include "esslog.h"
+
+/** Places rectangles on a page bottom-left along the skyline of the
+ * rectangles placed so far.
+ */
+class EssSkylinePacker
+{
+private:
+	struct Node
+	{
+		int x, y, width;
+	};
+
+	int mWidth;
+	int mHeight;
+	std::vector<Node> mSkyline;
+
+	/** The lowest y a rectangle fits at when its left edge is on node i, -1 if it doesn't */
+	int Fit(size_t i, int width, int height) const;
+
+public:
+	EssSkylinePacker();
+	void Reset(int width, int height);
+	bool Insert(int width, int height, int& x, int& y);
+};
+
+/** Packs small images into atlas pages as they are referenced, so the
+ * place of each image is known right away, and composes the pages once
+ * all images are known. Each image gets a gutter of its wrapped border
+ * texels, so filtering of tiled UVs doesn't bleed into its neighbours.
+ */
+class EssTextureAtlas
+{
+public:
+	struct Entry
+	{
+		std::string source;
+		int x, y;					/**< Top left of the image, without the gutter */
+		int width, height;
+	};
+
+	struct Page
+	{
+		std::string filename;
+		std::vector<Entry> entries;
+	};
+
+	struct Region
+	{
+		std::string filename;
+		float u, v, w, h;			/**< Of the page, v from the top */
+	};
+
+	/** Decodes a source into width * height RGBA8 pixels, top row first */
+	typedef std::function<bool(const std::string&, int, int, std::vector<unsigned char>&)> Loader;
+
+private:
+	int mPageSize;
+	int mGutter;
+	std::string mPagePrefix;
+	std::vector<Page> mPages;
+	std::vector<EssSkylinePacker> mPackers;
+	/* source -> page and entry */
+	std::map<std::string, std::pair<size_t, size_t> > mPlaced;
+
+public:
+	EssTextureAtlas();
+	/** Pages are named pagePrefix_<n>.tx */
+	void Reset(int pageSize, int gutter, const std::string& pagePrefix);
+	/** Place an image, false if it's too large for a page. */
+	bool Add(const std::string& source, int width, int height, Region& region);
+	/** The region of an image added before */
+	bool Find(const std::string& source, Region& region) const;
+	const std::vector<Page>& GetPages() const { return mPages; }
+	int GetPageSize() const { return mPageSize; }
+	/** Compose the RGBA8 pixels of a page, top row first. Unreadable
+	 * sources are reported through the callback.
+	 */
+	bool ComposePage(const Page& page, const Loader& load, std::vector<unsigned char>& pixels, EH_LogCallback callback) const;
+};
@@ -0,0 +1,172 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include "esssink.h"
+#include "esslog.h"
+
+/** Binary array sidecar (.essbin) written next to an ESS file.
+ * Bulk arrays are stored raw, so the essbin_loader procedural in
+ * liber_shader can map the file and build poly nodes without decoding.
+ *
+ * Layout:
+ *   EssBinHeader
+ *   array data, each array starts at a multiple of ESSBIN_ALIGNMENT
+ *   EssBinEntry table, num_entries entries
+ *   string table with NUL-terminated node and parameter names
+ *   EssBinFooter
+ *
+ * Compressed arrays are split into blocks of ESSBIN_BLOCK_SIZE raw bytes
+ * which are compressed independently, so they can be encoded and decoded
+ * in parallel. Their data starts with an EssBinBlockHeader, followed by
+ * num_blocks + 1 offsets relative to the start of the data, block i is
+ * stored in [offsets[i], offsets[i + 1]).
+ *
+ * The reader in liber_shader/ei_essbin.h mirrors these structures,
+ * keep both in sync and bump ESSBIN_VERSION on any change.
+ */
+
+#define ESSBIN_MAGIC		"ESSBIN\0\0"
+#define ESSBIN_VERSION		2
+#define ESSBIN_ALIGNMENT	64
+#define ESSBIN_BLOCK_SIZE	(1024 * 1024)
+
+/** Arrays smaller than this are always stored raw. */
+#define ESSBIN_MIN_COMPRESS_SIZE	(16 * 1024)
+
+/** Item type of an array.
+ */
+enum EssBinType
+{
+	ESSBIN_TYPE_INDEX = 0,		/**< unsigned int */
+	ESSBIN_TYPE_POINT,			/**< 3 floats */
+	ESSBIN_TYPE_VECTOR,			/**< 3 floats */
+	ESSBIN_TYPE_VECTOR2,		/**< 2 floats */
+};
+
+/** How the array is attached to its node.
+ */
+enum EssBinStorage
+{
+	ESSBIN_STORAGE_PARAM = 0,	/**< Regular node parameter, e.g. pos_list */
+	ESSBIN_STORAGE_CONSTANT,	/**< Declared primitive variables */
+	ESSBIN_STORAGE_UNIFORM,
+	ESSBIN_STORAGE_VARYING,
+	ESSBIN_STORAGE_FACEVARYING,
+};
+
+/** How the array data is stored.
+ */
+enum EssBinCodec
+{
+	ESSBIN_CODEC_RAW = 0,
+	ESSBIN_CODEC_ZLIB,
+	ESSBIN_CODEC_ZSTD,			/**< Only available when built with ESS_USE_ZSTD */
+};
+
+struct EssBinHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int flags;
+};
+
+struct EssBinEntry
+{
+	unsigned long long offset;		/**< Byte offset of the stored data */
+	unsigned long long size;		/**< Stored size in bytes */
+	unsigned long long count;		/**< Number of items */
+	unsigned int node_name;			/**< Offset of the node name in the string table */
+	unsigned int param_name;		/**< Offset of the parameter name in the string table */
+	unsigned int type;				/**< EssBinType */
+	unsigned int storage;			/**< EssBinStorage */
+	unsigned int codec;				/**< EssBinCodec */
+	unsigned int reserved;
+};
+
+struct EssBinBlockHeader
+{
+	unsigned int block_size;		/**< Raw bytes per block, the last one may be shorter */
+	unsigned int num_blocks;
+};
+
+struct EssBinFooter
+{
+	unsigned long long table_offset;
+	unsigned long long strings_offset;
+	unsigned long long strings_size;
+	unsigned int num_entries;
+	unsigned int version;
+	char magic[8];
+};
+
+/** Size in bytes of one item of the given type.
+ */
+size_t essbin_item_size(unsigned int type);
+
+/** Writes the .essbin sidecar.
+ */
+class EssBinWriter
+{
+private:
+	EssFileSink mFile;
+	EssSinkBuffer mBuffer;
+	std::string mFilename;
+	std::vector<EssBinEntry> mEntries;
+	std::vector<char> mStrings;
+	unsigned long long mOffset;
+	bool mOpen;
+	unsigned int mCodec;
+	int mLevel;
+	unsigned int mNumThreads;
+	std::vector<std::vector<char> > mBlocks;
+	unsigned long long mRawBytes;
+	unsigned long long mStoredBytes;
+	EH_LogCallback mLogCallback;
+
+	unsigned int AddString(const char* str);
+	void Write(const void* data, size_t size);
+	void Align();
+	bool CompressBlocks(const char* data, size_t size);
+
+public:
+	EssBinWriter();
+	~EssBinWriter();
+	/** The file is written under a temporary name and renamed into place
+	 * by Close, so a renderer still mapping the previous export keeps
+	 * reading consistent data.
+	 */
+	bool Open(const char* filename);
+	bool IsOpen() const { return mOpen; }
+	/** Compression ratios are reported through the callback. */
+	void SetLogCallback(EH_LogCallback callback) { mLogCallback = callback; }
+	/** Compress following arrays with the codec, level 0 uses the codec default.
+	 * Blocks are compressed on numThreads threads, 0 uses all cores.
+	 * Returns false if the codec isn't available in this build.
+	 */
+	bool SetCompression(unsigned int codec, int level, unsigned int numThreads);
+	/** Append an array for a node parameter. */
+	void AddArray(const char* nodeName, const char* paramName, unsigned int type, unsigned int storage, const void* data, size_t count);
+	/** Write the entry table and footer, returns false if any write failed. */
+	bool Close();
+	unsigned long long GetSize() const { return mOffset; }
+	size_t GetNumEntries() const { return mEntries.size(); }
+	unsigned long long GetRawBytes() const { return mRawBytes; }
+	unsigned long long GetStoredBytes() const { return mStoredBytes; }
+};
@@ -0,0 +1,76 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ei.h>
+#include "ElaraHomeAPI.h"
+
+/** Bounding boxes of the meshes of an export and the cameras, shared by
+ * the estimates which place instances relative to the view or to each
+ * other: texture footprints, pruning, light clustering and displacement.
+ *
+ * Everything measured here is an estimate from boxes, not triangles.
+ */
+class EssSceneBounds
+{
+public:
+	struct Box
+	{
+		eiVector lo;
+		eiVector hi;
+	};
+
+	struct Camera
+	{
+		eiVector position;
+		float pixel_size;		/**< World size of a pixel at distance 1, 0 if unknown */
+	};
+
+private:
+	bool mEnabled;
+	std::vector<Camera> mCameras;
+	std::map<std::string, Box> mMeshes;
+
+public:
+	EssSceneBounds();
+	/** Nothing is measured unless enabled, the meshes aren't scanned. */
+	void Reset(bool enabled);
+	bool IsEnabled() const { return mEnabled; }
+	void AddCamera(const EH_Camera& cam, bool panorama, int panoramaSize, bool leftHanded);
+	void AddMesh(const std::string& name, const EH_Mesh& mesh);
+	const std::vector<Camera>& GetCameras() const { return mCameras; }
+	/** The object space bounds of the mesh, NULL if it wasn't added. */
+	const Box* FindMesh(const std::string& name) const;
+	/** The world bounds of the mesh placed by transform, false if the
+	 * mesh is unknown or the bounds aren't finite.
+	 */
+	bool GetWorldBounds(const std::string& meshName, const eiMatrix& transform, Box& bounds) const;
+	/** The smallest world size of a pixel on the box over the cameras,
+	 * FLT_MAX if no camera has a known pixel size.
+	 */
+	float GetPixelSize(const Box& bounds) const;
+
+	static eiVector TransformPoint(const eiVector& p, const eiMatrix& m);
+	/** Distance from p to the box, 0 inside. */
+	static float Distance(const eiVector& p, const Box& box);
+	/** The uniform scale of m, the cube root of its determinant. */
+	static float GetScale(const eiMatrix& m);
+};
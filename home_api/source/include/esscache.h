@@ -0,0 +1,84 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include "esslog.h"
+
+/** Remembers what the last export of a scene produced, so unchanged
+ * content can be reused instead of encoded and written again.
+ *
+ * scene.essmanifest lists the mesh shards and cached nodes by content
+ * hash, scene.esscache holds the ESS bytes of the cached nodes. Shard
+ * files are content addressed, an unchanged shard is simply included
+ * again by the master.
+ */
+class EssExportCache
+{
+public:
+	struct Node
+	{
+		std::string kind;			/**< e.g. "material", "light" */
+		std::string name;
+		unsigned long long hash;
+		std::string result;			/**< Value returned when the node was generated */
+		bool flag;					/**< Flag returned when the node was generated */
+		std::vector<char> bytes;	/**< The ESS text of the node */
+	};
+
+	struct Shard
+	{
+		unsigned long long hash;
+		unsigned long long size;
+		unsigned int num_meshes;
+		std::string filename;		/**< Relative to the master ESS */
+		bool reused;
+	};
+
+private:
+	std::string mBase;
+	std::string mDirectory;
+	std::map<std::string, Node> mPrevNodes;
+	std::map<unsigned long long, Shard> mPrevShards;
+	std::vector<Node> mNodes;
+	std::vector<Shard> mShards;
+	std::mutex mShardMutex;
+	unsigned int mReusedNodes;
+	unsigned int mGeneratedNodes;
+	unsigned long long mReusedBytes;
+	unsigned long long mGeneratedBytes;
+
+public:
+	EssExportCache();
+	/** Load the manifest of the last export of base.ess, if any. */
+	void Load(const std::string& base);
+	/** Find a node of the last export with the same content. */
+	const Node* FindNode(const std::string& kind, const std::string& name, unsigned long long hash) const;
+	void AddNode(const Node& node, bool reused);
+	/** Is the shard of the last export still on disk and intact? */
+	bool FindShard(unsigned long long hash, const std::string& filename) const;
+	/** Record a shard once its file is complete, also from the encoding threads. */
+	void AddShard(unsigned long long hash, const std::string& filename, unsigned int numMeshes, bool reused);
+	/** Write the manifest once all shards are written, and delete
+	 * shards of the last export which aren't used anymore.
+	 */
+	bool Save();
+	void PrintReport(EH_LogCallback callback) const;
+};
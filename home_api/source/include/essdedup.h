@@ -0,0 +1,131 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+#include <deque>
+#include <ei.h>
+#include "ElaraHomeAPI.h"
+#include "esslog.h"
+
+/** Detects meshes which repeat one added before, either exactly or up
+ * to a rigid transform, so they are written once and instanced.
+ *
+ * Meshes are bucketed by a hash of their topology and attributes, exact
+ * duplicates are found by a hash of their positions and normals. A
+ * rigid match is found by canonicalizing the vertices on their principal
+ * axes. Hashes only select candidates: an exact match is compared byte
+ * by byte and a rigid one verified on every vertex, against a copy of
+ * the candidate's arrays. The oldest copies are dropped beyond
+ * ESS_DEDUP_MAX_CANDIDATE_BYTES, those meshes aren't matched anymore.
+ */
+class EssMeshDedup
+{
+public:
+	/** A mesh replaced by an instance of another one */
+	struct Match
+	{
+		std::string mesh_name;		/**< The mesh written in its place */
+		bool has_transform;
+		eiMatrix transform;			/**< Maps mesh_name into the local space of the duplicate */
+	};
+
+private:
+	struct Entry
+	{
+		std::string name;
+		bool has_frame;				/**< Principal axes are well defined */
+		double center[3];
+		double axes[3][3];
+		double eigen[3];
+		unsigned long long content;	/**< Hash of positions and normals */
+		/* copies to verify matches against, empty once dropped */
+		std::vector<float> verts;
+		std::vector<float> normals;
+		std::vector<float> uvs;
+		std::vector<uint_t> face_indices;
+		std::vector<uint_t> n_indices;
+		std::vector<uint_t> uv_indices;
+		std::vector<uint_t> mtl_indices;
+	};
+
+	EH_MeshDedup mMode;
+	std::vector<Entry> mEntries;
+	std::map<unsigned long long, std::vector<size_t> > mBuckets;
+	std::map<std::string, Match> mMatches;
+	/* entries holding arrays, oldest first */
+	std::deque<size_t> mCandidates;
+	unsigned long long mCandidateBytes;
+	unsigned int mNumDropped;
+	unsigned int mNumMeshes;
+	unsigned int mNumExact;
+	unsigned int mNumRigid;
+	unsigned long long mSavedVerts;
+	unsigned long long mSavedFaces;
+
+	static size_t GetCopyBytes(const Entry& entry);
+	/** Same array sizes, UVs and indices as the copy of the entry */
+	bool MatchTopology(const Entry& entry, const EH_Mesh& mesh) const;
+	bool MatchRigid(const Entry& entry, const EH_Mesh& mesh, const double center[3], const double axes[3][3], Match& match) const;
+
+public:
+	EssMeshDedup();
+	void Reset(EH_MeshDedup mode);
+	/** Returns true when the mesh duplicates one added before, it
+	 * mustn't be written then, instances are redirected by Find.
+	 */
+	bool Add(const EH_Mesh& mesh, const std::string& name);
+	/** The match of a mesh which wasn't written, or NULL. */
+	const Match* Find(const std::string& name) const;
+	void PrintReport(EH_LogCallback callback) const;
+};
+
+/** Detects materials with the same parameters as one added before, so
+ * only the first is written and instances refer to it.
+ *
+ * The chain of shader nodes a material gets only depends on which of
+ * its inputs are textured, materials of the same topology get shader
+ * groups of the same structure. Their number is reported, it bounds
+ * the shader code the renderer has to compile.
+ */
+class EssMaterialDedup
+{
+private:
+	bool mEnabled;
+	std::map<unsigned long long, std::string> mMaterials;
+	/* skipped material -> the material written in its place */
+	std::map<std::string, std::string> mMatches;
+	/* materials instances refer to, these can't be skipped anymore */
+	std::set<std::string> mReferenced;
+	std::set<unsigned int> mTopologies;
+	unsigned int mNumMaterials;
+
+public:
+	EssMaterialDedup();
+	void Reset(bool enabled);
+	/** hash covers every parameter of the material, topology the
+	 * structure of its shader group. Returns true when the material
+	 * duplicates one added before, it mustn't be written then.
+	 */
+	bool Add(const std::string& name, unsigned long long hash, unsigned int topology);
+	/** The material to refer to in place of name. */
+	const std::string& Find(const std::string& name);
+	void PrintReport(EH_LogCallback callback) const;
+};
@@ -0,0 +1,88 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <ei.h>
+#include "ElaraHomeAPI.h"
+#include "essbounds.h"
+#include "esslog.h"
+
+/** Picks the displacement subdivision of each displaced instance from
+ * how large its triangles appear to the camera, and coarsens the
+ * instances where it shows least until the scene fits a budget of
+ * micro-triangles. Sizes on screen are estimated from the mesh bounds
+ * and the mean triangle area, so are the micro-triangle counts.
+ *
+ * Instances are only planned once a camera, their mesh and a displaced
+ * material are known, others use the global approximation.
+ */
+class EssDisplaceBudget
+{
+public:
+	struct Instance
+	{
+		std::string name;
+		std::string element;
+		std::vector<std::string> materials;
+		eiMatrix transform;
+		unsigned int level;			/**< Subdivisions, each splits a triangle into 4 */
+		double pixel_edge;			/**< Edge length of the base mesh on screen */
+		double triangles;			/**< Triangles of the base mesh */
+	};
+
+private:
+	struct Mesh
+	{
+		double area;
+		double triangles;
+	};
+
+	bool mEnabled;
+	float mEdgeLength;
+	unsigned long long mBudget;
+	std::map<std::string, Mesh> mMeshes;
+	std::set<std::string> mMaterials;
+	std::vector<Instance> mInstances;
+	double mNeededTriangles;
+	double mPlannedTriangles;
+
+public:
+	EssDisplaceBudget();
+	/** edgeLength is the target edge of micro-triangles in pixels, budget
+	 * the micro-triangles of the scene, 0 for no limit.
+	 */
+	void Reset(bool enabled, float edgeLength, unsigned long long budget);
+	bool IsEnabled() const { return mEnabled; }
+	float GetEdgeLength() const { return mEdgeLength; }
+	void AddMesh(const std::string& name, const EH_Mesh& mesh);
+	void AddDisplacedMaterial(const std::string& name) { mMaterials.insert(name); }
+	/** Hold a displaced instance back until Plan. meshName and meshToWorld
+	 * are as added, element and transform as the instance is written.
+	 * False if the instance should be written as usual.
+	 */
+	bool AddInstance(const std::string& name, const std::string& meshName, const eiMatrix& meshToWorld,
+		const std::string& element, const eiMatrix& transform, const std::vector<std::string>& materials,
+		const EssSceneBounds& bounds);
+	/** The held back instances with their subdivision levels. */
+	std::vector<Instance>& Plan();
+	void PrintReport(EH_LogCallback callback) const;
+};
@@ -0,0 +1,67 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ei.h>
+#include "ElaraHomeAPI.h"
+#include "essbounds.h"
+
+/** Estimates the resolution each texture needs for a render, from how
+ * close the camera gets to the instances using it and the UV density
+ * of their meshes. Textures of distant objects can be downsampled
+ * before the render without visible change.
+ *
+ * The estimate is conservative: instances aren't culled by the view,
+ * they may still be seen in reflections, and a texture used by
+ * anything which can't be measured is left alone.
+ */
+class EssTextureFootprint
+{
+private:
+
+	struct Texture
+	{
+		std::string source;
+		float repeat;
+	};
+
+	struct Instance
+	{
+		std::string mesh_name;
+		eiMatrix transform;
+		std::vector<std::string> materials;
+	};
+
+	/* UV units per object space unit of each mesh with UVs */
+	std::map<std::string, float> mUVDensities;
+	std::map<std::string, std::vector<Texture> > mMaterials;
+	std::vector<Instance> mInstances;
+
+public:
+	void Reset();
+	void AddMesh(const std::string& name, const EH_Mesh& mesh);
+	void AddMaterial(const std::string& name, const EH_Material& mat, const std::string& rootPath);
+	void AddInstance(const EH_MeshInstance& inst);
+	/** The power of two resolution needed by each texture source of an
+	 * instanced material, 0 where it can't be capped.
+	 */
+	void GetResolutions(const EssSceneBounds& bounds, std::map<std::string, unsigned int>& resolutions) const;
+};
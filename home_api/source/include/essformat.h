@@ -0,0 +1,45 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+
+/** Max number of characters written by ess_format_float, e.g. "-1.17549435e-38".
+ */
+#define ESS_FLOAT_MAX_CHARS 16
+
+/** Max number of characters written by ess_format_uint.
+ */
+#define ESS_UINT_MAX_CHARS 10
+
+/** Format a float with the shortest decimal representation that reads
+ * back to the same value. Independent of the current locale.
+ * The buffer must hold ESS_FLOAT_MAX_CHARS characters, no NUL is written.
+ * \return The number of characters written.
+ */
+size_t ess_format_float(float value, char *buffer);
+
+/** Format an unsigned integer, no NUL is written.
+ */
+size_t ess_format_uint(unsigned int value, char *buffer);
+
+/** Format rows of floats as they appear in ESS arrays, one row per line:
+ * "\t\tv0 v1 ... vN\n". The buffer must hold
+ * num_rows * (3 + num_cols * (ESS_FLOAT_MAX_CHARS + 1)) characters.
+ * \return The number of characters written.
+ */
+size_t ess_format_float_rows(const float *values, size_t num_rows, size_t num_cols, char *buffer);
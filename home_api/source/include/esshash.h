@@ -0,0 +1,48 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+/** Streaming 64-bit content hash, compatible with XXH64.
+ */
+class EssHash
+{
+private:
+	unsigned long long mAcc[4];
+	unsigned long long mSeed;
+	unsigned long long mTotalSize;
+	unsigned char mStripe[32];
+	size_t mStripeSize;
+
+public:
+	EssHash(unsigned long long seed = 0);
+	void Reset(unsigned long long seed = 0);
+	void Update(const void* data, size_t size);
+	/** Hash a string with its length, NULL differs from "". */
+	void UpdateString(const char* str);
+	template <typename T>
+	void UpdateValue(const T& value) { Update(&value, sizeof(T)); }
+	unsigned long long Digest() const;
+};
+
+/** One-shot hash of a block of memory. */
+unsigned long long ess_hash(const void* data, size_t size, unsigned long long seed = 0);
+
+/** Format a hash as 16 hex digits. */
+std::string ess_hash_to_string(unsigned long long hash);
@@ -33,10 +33,28 @@
 
 #include <vector>
 #include <string>
+#include <map>
+#include <set>
+#include <memory>
+#include <chrono>
+#include <functional>
 #include "esswriter.h"
+#include "esscache.h"
+#include "essdedup.h"
+#include "essmesh.h"
+#include "essstats.h"
+#include "esstexture.h"
+#include "essbounds.h"
+#include "essfootprint.h"
+#include "esslibrary.h"
+#include "essprune.h"
+#include "esslights.h"
+#include "essdisplace.h"
 #include "ElaraHomeAPI.h"
 
 
+struct EssMeshCopy;
+
 class EssExporter {
 private:
 	std::vector<std::string> mElInstances;
@@ -47,12 +65,73 @@ private:
 	std::string mEnvName;
 	std::string mRootPath;
 	std::string mOptionName;
+	/* output of BeginExport with a file name, outlives mWriter */
+	EssFileSink mFileSink;
 	EssWriter mWriter;
 	int mLightSamples;
 	bool mCheckNormal;
 	bool mIsLeftHand;
 	bool mUseDisplacement;
 	bool mIsNeedEmitGI;
+	unsigned int mNumMeshes;
+	std::chrono::steady_clock::time_point mExportStart;
+	unsigned int mShardMeshes;
+	unsigned int mNumShards;
+	std::string mShardBase;
+	bool mBase85Encoding;
+	std::vector<std::shared_ptr<EssMeshCopy> > mShardMeshList;
+	/* mesh name -> name qualified by the shard namespace */
+	std::map<std::string, std::string> mShardElements;
+	/* meshes without triangles, they aren't written */
+	std::set<std::string> mEmptyMeshes;
+
+	bool mIncremental;
+	EssExportCache mCache;
+	EssMeshDedup mDedup;
+	EssMaterialDedup mMaterialDedup;
+	/* mesh bounds and cameras for the pruner, planners and footprint */
+	EssSceneBounds mBounds;
+	EssInstancePruner mPruner;
+	EssLightPlanner mLightPlanner;
+	EssDisplaceBudget mDisplace;
+	EssMeshSettings mMeshSettings;
+	EssMeshStats mMeshStats;
+	EssMaterialLibrary::Stats mLibraryStats;
+	EssExportStats mStats;
+	EssTextureCache mTextures;
+	EssTextureFootprint mFootprint;
+	bool mCapTextures;
+	std::string mStatsFile;
+	unsigned long long mExpectedBytes;
+	unsigned long long mSubmittedMeshBytes;
+	float mLastProgress;
+	bool mCancelled;
+
+	/** filename enables the outputs placed next to the ESS: sidecar, shards and cache. */
+	bool BeginExport(EssOutputSink *sink, const EH_ExportOptions2 &option, const bool check_normal, const std::string &filename);
+	void ResetProgress(const EH_ExportOptions2 &option);
+	/** Call the progress callback with the done share of the bytes added
+	 * so far, or with fraction if it's given.
+	 */
+	void UpdateProgress(float fraction = -1.0f);
+	void AddMeshCopy(const EH_Mesh& model, const std::string &modelName, unsigned long long meshBytes);
+	/** sceneName tells the textures capped for this scene apart from others in the cache. */
+	void OpenTextureCache(const EH_ExportOptions2 &option, const std::string &sceneName);
+
+	/** Write the pending meshes to a shard file and include it in the master. */
+	void FlushShard();
+	bool EmitLight(const EH_Light& light, const std::string &lightName, const std::string &envName, bool is_show_area, int samples);
+	/** Write the lights held back for clustering and the sample budget. */
+	void FlushLights();
+	/** Write the instances held back by mDisplace with approximations of their subdivision. */
+	void WriteDisplacedInstances();
+
+	/** Writes a node, returns a result and a flag for the caller. */
+	typedef std::function<void(EssWriter&, std::string&, bool&)> NodeGenerator;
+	/** Write a node, or in incremental mode reuse its bytes from the last
+	 * export when its content hash is unchanged.
+	 */
+	void EmitNode(const char *kind, const std::string &name, unsigned long long hash, std::string &result, bool &flag, const NodeGenerator &generate);
 
 public:
 	EH_display_callback display_callback;
@@ -62,7 +141,9 @@ public:
 public:
 	EssExporter(void);
 	~EssExporter();
-	bool BeginExport(std::string &filename, const EH_ExportOptions &option, const bool check_normal);
+	bool BeginExport(std::string &filename, const EH_ExportOptions2 &option, const bool check_normal);
+	/** Export into a caller-owned sink (memory, pipe) instead of a file. */
+	bool BeginExport(EssOutputSink *sink, const EH_ExportOptions2 &option, const bool check_normal);
 	void SetLightSamples(const int samples);
 	bool AddCamera(const EH_Camera &cam, bool panorama, int panorama_size, std::string &NodeName);
 	void AddMesh(const EH_Mesh& model, const std::string &modelName);
@@ -84,7 +165,8 @@ public:
 	void SetTexPath(std::string &path);
 	void AddAssemblyInstance(const char *name, const EH_AssemblyInstance &assembly_inst);
 	void AddMaterialFromEss(const EH_Material &mat, std::string matName, const char *essName);
-	void EndExport();
+	/** Returns false if the output could not be written completely. */
+	bool EndExport();
 };
 
 #endif
@@ -0,0 +1,72 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+
+/* Memory for cached libraries, the least recently used are dropped beyond it */
+#define ESS_LIBRARY_MAX_BYTES (64ull * 1024 * 1024)
+
+/** Keeps the ESS material libraries AddMaterialFromEss reads in memory,
+ * shared by all exports of the process. A library is read again only
+ * when its modification time or size changes, or once it was dropped
+ * to stay within ESS_LIBRARY_MAX_BYTES.
+ */
+class EssMaterialLibrary
+{
+public:
+	/** Counted by the caller of Read, e.g. per export */
+	struct Stats
+	{
+		unsigned long long reads;			/**< Libraries read from disk */
+		unsigned long long hits;			/**< Libraries served from memory */
+		unsigned long long bytes_avoided;	/**< Bytes not read again thanks to hits */
+
+		Stats() : reads(0), hits(0), bytes_avoided(0) {}
+	};
+
+private:
+	struct Entry
+	{
+		long long mtime;
+		unsigned long long size;
+		std::shared_ptr<const std::string> text;
+		unsigned long long last_use;
+	};
+
+	std::mutex mMutex;
+	std::map<std::string, Entry> mEntries;
+	unsigned long long mBytes;
+	unsigned long long mUseCount;
+
+	void EvictLocked(const std::string& keep);
+
+	EssMaterialLibrary();
+	EssMaterialLibrary(const EssMaterialLibrary&);
+	EssMaterialLibrary& operator=(const EssMaterialLibrary&);
+
+public:
+	static EssMaterialLibrary& Get();
+	/** The text of the library ending with a newline, NULL if it can't
+	 * be read. On Windows filename is a wchar_t path, as it always was.
+	 */
+	std::shared_ptr<const std::string> Read(const char* filename, Stats& stats);
+};
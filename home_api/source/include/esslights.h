@@ -0,0 +1,83 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ei.h>
+#include "ElaraHomeAPI.h"
+#include "essbounds.h"
+#include "esslog.h"
+
+/** Holds the lights of an export back until the end, to merge similar
+ * lights far from any geometry into one and to share a sample budget
+ * among them by how much each is estimated to light the view.
+ */
+class EssLightPlanner
+{
+public:
+	struct Light
+	{
+		EH_Light light;
+		std::string ies_filename;	/**< light.ies_filename points here, if it was set */
+		bool has_ies;
+		std::string name;
+		std::string env_name;
+		bool show_area;
+		int samples;
+		unsigned int num_merged;	/**< Lights this one stands for */
+	};
+
+private:
+	float mClusterError;
+	unsigned int mSampleBudget;
+	std::vector<Light> mLights;
+	/* world bounds of the instances, the geometry lights fall on */
+	std::vector<EssSceneBounds::Box> mReceivers;
+	unsigned int mNumInput;
+	unsigned int mNumOutput;
+	unsigned int mMinSamples;
+	unsigned int mMaxSamples;
+	unsigned int mTotalSamples;
+
+	/** Distance from p to the nearest receiver bounds, or to their
+	 * nearest side when p is inside.
+	 */
+	float ReceiverDistance(const eiVector& p) const;
+
+	void Cluster();
+	void Budget(const EssSceneBounds& bounds);
+
+public:
+	EssLightPlanner();
+	/** clusterError bounds the relative change of light reaching the
+	 * geometry by merging, 0 disables clustering. The geometry is
+	 * known by its bounds only, so the bound ignores occlusion and
+	 * surfaces inside the bounds. sampleBudget is the total of light
+	 * samples to share, 0 keeps the samples as given.
+	 */
+	void Reset(float clusterError, unsigned int sampleBudget);
+	bool IsEnabled() const { return mClusterError > 0.0f || mSampleBudget > 0; }
+	void AddInstance(const std::string& meshName, const eiMatrix& transform, const EssSceneBounds& bounds);
+	void AddLight(const EH_Light& light, const std::string& name, const std::string& envName, bool showArea, int samples);
+	/** The lights to write, merged and with their samples, in the order
+	 * added. The samples are shared by distance to the cameras of bounds.
+	 */
+	std::vector<Light>& Plan(const EssSceneBounds& bounds);
+	void PrintReport(EH_LogCallback callback) const;
+};
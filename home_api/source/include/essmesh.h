@@ -0,0 +1,99 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <ei.h>
+#include "ElaraHomeAPI.h"
+
+/** The arrays of a mesh as they are written to the ESS.
+ */
+struct EssMeshArrays
+{
+	std::vector<eiVector> verts;
+	std::vector<eiVector> normals;		/**< Empty without normals */
+	std::vector<eiVector2> uvs;			/**< Empty without UVs */
+	std::vector<uint_t> vert_indices;	/**< 3 per triangle */
+	std::vector<uint_t> n_indices;		/**< Empty when normals are varying */
+	std::vector<uint_t> uv_indices;		/**< Empty when UVs are varying */
+	std::vector<uint_t> mtl_indices;	/**< 1 per triangle, empty for a single material */
+};
+
+/** Sort the triangles of the index streams along a Morton curve of their
+ * centroids, so that neighbouring triangles are close in memory. Run it
+ * before ess_compact_mesh, which numbers the vertices in first-use order.
+ */
+void ess_reorder_triangles(const EH_Mesh& model, EssMeshArrays& mesh);
+
+/** Split the triangles of the index streams into spatially compact
+ * clusters of at most maxTriangles, by median splits of the triangle
+ * centroids along the longest axis. The clusters only get index streams.
+ */
+void ess_split_triangles(const EH_Mesh& model, const EssMeshArrays& mesh, size_t maxTriangles, std::vector<EssMeshArrays>& clusters);
+
+/** Fill the vertex arrays with the vertices of the mesh referenced by
+ * the index streams, and remap the index streams to them.
+ *
+ * With a weld tolerance > 0, vertices closer than the tolerance times
+ * the mesh size, whose normal and UV match too, are merged into one.
+ */
+void ess_compact_mesh(const EH_Mesh& model, EssMeshArrays& mesh, float weldTolerance);
+
+/** Mesh processing settings of an export */
+struct EssMeshSettings
+{
+	float weld_tolerance;		/**< Relative to the mesh size, 0 only removes unreferenced vertices */
+	bool reorder_triangles;		/**< Morton order triangles */
+	unsigned int split_triangles;	/**< Split larger meshes into clusters, 0 never splits */
+	EH_ValidatePolicy validate_policy;
+	float max_coordinate;		/**< Larger position coordinates are reported */
+	EH_LogCallback log_callback;	/**< Invalid meshes are reported through it */
+
+	EssMeshSettings() :
+		weld_tolerance(0.0f),
+		reorder_triangles(false),
+		split_triangles(0),
+		validate_policy(EH_VALIDATE_REPORT),
+		max_coordinate(1.0e7f),
+		log_callback(NULL)
+	{
+	}
+};
+
+/** Totals over the meshes of an export, updated by the encoding threads */
+struct EssMeshStats
+{
+	std::atomic<unsigned long long> input_verts;
+	std::atomic<unsigned long long> output_verts;
+	std::atomic<unsigned int> split_meshes;
+	std::atomic<unsigned int> split_clusters;
+	std::atomic<unsigned int> invalid_meshes;
+
+	EssMeshStats()
+	{
+		Reset();
+	}
+	void Reset()
+	{
+		input_verts = 0;
+		output_verts = 0;
+		split_meshes = 0;
+		split_clusters = 0;
+		invalid_meshes = 0;
+	}
+};
@@ -0,0 +1,90 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "esssink.h"
+
+class EssWriter;
+class EssExportStats;
+
+/** Encodes nodes on worker threads and keeps the output in submission order.
+ * Each job writes its nodes into a private writer. The pipeline is also
+ * the sink of the main writer: bytes written while earlier jobs are in
+ * flight are held in memory until those jobs are done, so the file is
+ * identical to a serial export.
+ */
+class EssPipeline : public EssOutputSink
+{
+public:
+	/** Writes nodes into the private writer it's given. Returns false if
+	 * an output of its own failed, e.g. a shard file, which fails the
+	 * pipeline like a failed write.
+	 */
+	typedef std::function<bool(EssWriter&)> Job;
+
+private:
+	struct Segment
+	{
+		std::vector<char> data;
+		bool done;
+	};
+
+	EssOutputSink* mOutput;
+	EssExportStats* mStats;
+	bool mEncoding;
+	std::deque<Segment*> mSegments;
+	std::deque<std::pair<Job, Segment*> > mJobs;
+	std::vector<std::thread> mThreads;
+	std::mutex mMutex;
+	std::condition_variable mJobReady;
+	std::condition_variable mJobDone;
+	size_t mMaxPending;
+	size_t mNumPending;
+	unsigned long long mJobBytes;
+	bool mStop;
+	bool mFailed;
+
+	void WorkerLoop();
+	void DrainLocked();
+
+public:
+	EssPipeline();
+	~EssPipeline();
+	/** Start numThreads workers writing to output, 0 uses all cores.
+	 * At most maxPending jobs are queued or in flight, Submit blocks beyond that.
+	 * The writers of the jobs count their encoding time in stats.
+	 */
+	void Start(EssOutputSink* output, bool encoding, unsigned int numThreads, size_t maxPending, EssExportStats* stats = NULL);
+	/** Queue a job, its output goes after everything written so far. */
+	void Submit(const Job& job);
+	/** Wait until all jobs are done and written to the output. */
+	bool Wait();
+	/** Wait and stop the workers. */
+	void Stop();
+	unsigned int GetNumThreads() const { return (unsigned int)mThreads.size(); }
+	/** Bytes written to the output by jobs. */
+	unsigned long long GetJobBytes() const { return mJobBytes; }
+
+	bool Write(const char* data, size_t size);
+	bool Flush();
+};
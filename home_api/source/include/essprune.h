@@ -0,0 +1,74 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <ei.h>
+#include "ElaraHomeAPI.h"
+#include "essbounds.h"
+#include "esslog.h"
+
+/** Decides which mesh instances can be left out of an export because
+ * the cameras can't see them, see EH_PruneMode.
+ *
+ * Only instances added after a camera are pruned, and an instance whose
+ * mesh bounds are unknown is always kept. So is an instance with an
+ * emissive, reflective or refractive material, out of view it still
+ * lights the scene or bends light onto what is seen.
+ */
+class EssInstancePruner
+{
+private:
+	struct Camera
+	{
+		eiVector position;
+		eiVector axes[3];		/**< Unit x, y, z of the view, it looks down -z */
+		float tan_x;			/**< Half width of the view at distance 1 */
+		float tan_y;
+		float far_clip;			/**< 0 for none */
+		bool all_around;		/**< Cubemaps and panoramas see every direction */
+	};
+
+	EH_PruneMode mMode;
+	float mMargin;
+	float mDistance;
+	std::vector<Camera> mCameras;
+	/* emissive, reflective or refractive materials */
+	std::set<std::string> mLightingMaterials;
+	unsigned int mNumKept;
+	unsigned int mNumPruned;
+	unsigned int mNumOccluders;
+	unsigned int mNumLighting;
+	std::vector<std::string> mPruned;
+	std::vector<std::string> mLighting;
+
+	bool IsInView(const Camera& camera, const EssSceneBounds::Box& box) const;
+	bool HasLightingMaterial(const EH_MeshInstance& meshInst) const;
+
+public:
+	EssInstancePruner();
+	void Reset(EH_PruneMode mode, float margin, float distance);
+	bool IsEnabled() const { return mMode != EH_PRUNE_OFF; }
+	void AddCamera(const EH_Camera& cam, bool panorama, bool leftHanded);
+	void AddMaterial(const std::string& name, const EH_Material& mat);
+	/** Should the instance be written? */
+	bool Keep(const std::string& instName, const EH_MeshInstance& meshInst, const EssSceneBounds& bounds);
+	void PrintReport(EH_LogCallback callback) const;
+};
@@ -0,0 +1,163 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#pragma once
+
+#include <streambuf>
+#include <vector>
+#include <string>
+
+/** Default size of the user-space buffer in front of a sink.
+ */
+#define ESS_SINK_DEFAULT_BUFFER_SIZE (1024 * 1024)
+
+/** Alignment of the sink buffer, large enough for direct I/O.
+ */
+#define ESS_SINK_BUFFER_ALIGNMENT 4096
+
+/** Size of the aligned copy direct I/O writes unaligned blocks through.
+ */
+#define ESS_SINK_BOUNCE_SIZE (256 * 1024)
+
+/** Where EssWriter sends its output. Sinks receive large blocks from
+ * EssSinkBuffer, they do no buffering of their own.
+ */
+class EssOutputSink
+{
+public:
+	virtual ~EssOutputSink() {}
+	/** Write the whole block, returns false on error. */
+	virtual bool Write(const char* data, size_t size) = 0;
+	/** Flush written data to the underlying device. */
+	virtual bool Flush() { return true; }
+	/** Release the device, returns false if data could not be committed. */
+	virtual bool Close() { return true; }
+};
+
+/** Options for file output.
+ */
+struct EssFileSinkOptions
+{
+	size_t buffer_size;		/**< Size of the user-space buffer */
+	bool direct_io;			/**< Bypass the OS page cache (O_DIRECT / FILE_FLAG_NO_BUFFERING) */
+	bool sequential;		/**< Hint the OS about sequential access */
+	bool drop_cache;		/**< Drop written pages from the page cache on close (POSIX only) */
+
+	EssFileSinkOptions() :
+		buffer_size(ESS_SINK_DEFAULT_BUFFER_SIZE),
+		direct_io(false),
+		sequential(true),
+		drop_cache(false)
+	{
+	}
+};
+
+/** Output to a file.
+ */
+class EssFileSink : public EssOutputSink
+{
+private:
+	EssFileSinkOptions mOptions;
+	std::string mFilename;
+#ifdef _WIN32
+	void *mHandle;
+#else
+	int mFd;
+#endif
+	bool mDirect;
+	/* aligned copy for blocks direct I/O can't take as they are */
+	char *mBounce;
+
+	void DisableDirectIO();
+	bool WriteAll(const char* data, size_t size);
+
+public:
+	EssFileSink();
+	~EssFileSink();
+	bool Open(const char* filename, const EssFileSinkOptions& options);
+	bool IsOpen() const;
+	virtual bool Write(const char* data, size_t size);
+	virtual bool Flush();
+	virtual bool Close();
+};
+
+/** Output to a growable in-memory buffer.
+ */
+class EssMemorySink : public EssOutputSink
+{
+private:
+	std::vector<char> mData;
+	size_t mSize;
+
+public:
+	EssMemorySink(size_t reserve = 0);
+	virtual bool Write(const char* data, size_t size);
+	const char* GetData() const { return mData.empty() ? NULL : &mData[0]; }
+	size_t GetSize() const { return mSize; }
+	/** Move the written data out and reset the sink. */
+	void Release(std::vector<char>& data);
+	void Clear() { mSize = 0; }
+};
+
+/** Output to a file descriptor, e.g. a pipe to the renderer.
+ */
+class EssFdSink : public EssOutputSink
+{
+private:
+	int mFd;
+	bool mOwnsFd;
+
+public:
+	EssFdSink(int fd, bool ownsFd);
+	~EssFdSink();
+	virtual bool Write(const char* data, size_t size);
+	virtual bool Close();
+};
+
+/** Stream buffer which collects formatted output in a large aligned
+ * buffer and only hands full blocks to the sink, so writing a line
+ * never costs a system call.
+ */
+class EssSinkBuffer : public std::streambuf
+{
+private:
+	EssOutputSink *mSink;
+	char *mBuffer;
+	size_t mBufferSize;
+	unsigned long long mBytesWritten;
+	unsigned long long mWriteCalls;
+	bool mFailed;
+
+	bool FlushBuffer();
+
+protected:
+	virtual int_type overflow(int_type ch);
+	virtual std::streamsize xsputn(const char* s, std::streamsize n);
+	virtual int sync();
+
+public:
+	EssSinkBuffer();
+	~EssSinkBuffer();
+	/** Returns false if the buffer can't be allocated, output then fails. */
+	bool Attach(EssOutputSink *sink, size_t bufferSize);
+	/** Flush pending data and detach the sink, returns false if any write failed. */
+	bool Detach();
+	/** Flush pending data and send further output to another sink, keeping the counters. */
+	void Redirect(EssOutputSink *sink);
+	unsigned long long GetBytesWritten() const { return mBytesWritten; }
+	/** Number of blocks handed to the sink, i.e. write system calls for file sinks. */
+	unsigned long long GetWriteCalls() const { return mWriteCalls; }
+};
@@ -0,0 +1,117 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include "esssink.h"
+
+/** What the time and bytes of an export are spent on. Encoding and
+ * I/O happen inside the other categories and are counted there too.
+ */
+enum EssStatCategory
+{
+	ESS_STAT_MESHES = 0,
+	ESS_STAT_MATERIALS,
+	ESS_STAT_LIGHTS,
+	ESS_STAT_TEXTURES,
+	ESS_STAT_ENCODING,		/**< Formatting and Base85 encoding of arrays */
+	ESS_STAT_IO,			/**< Writes to the output file */
+	ESS_STAT_COUNT,
+};
+
+/** Timing and byte counters of an export, updated from any thread.
+ * Times are summed over threads.
+ */
+class EssExportStats
+{
+private:
+	std::atomic<unsigned long long> mNanoseconds[ESS_STAT_COUNT];
+	std::atomic<unsigned long long> mBytes[ESS_STAT_COUNT];
+	std::atomic<unsigned long long> mItems[ESS_STAT_COUNT];
+
+public:
+	EssExportStats();
+	void Reset();
+	void Add(EssStatCategory category, unsigned long long nanoseconds, unsigned long long bytes, unsigned long long items);
+	double GetSeconds(EssStatCategory category) const { return mNanoseconds[category] * 1e-9; }
+	unsigned long long GetBytes(EssStatCategory category) const { return mBytes[category]; }
+	unsigned long long GetItems(EssStatCategory category) const { return mItems[category]; }
+	/** Write the breakdown as JSON, returns false if the file can't be written. */
+	bool WriteJson(const char* filename, double totalSeconds, unsigned long long outputBytes, unsigned int numThreads) const;
+	static const char* GetCategoryName(EssStatCategory category);
+};
+
+/** Adds the time of its scope to a category, does nothing without stats. */
+class EssStatTimer
+{
+private:
+	EssExportStats* mStats;
+	EssStatCategory mCategory;
+	unsigned long long mBytes;
+	unsigned long long mItems;
+	std::chrono::steady_clock::time_point mStart;
+
+public:
+	EssStatTimer(EssExportStats* stats, EssStatCategory category, unsigned long long bytes = 0, unsigned long long items = 0) :
+		mStats(stats),
+		mCategory(category),
+		mBytes(bytes),
+		mItems(items)
+	{
+		if (mStats != NULL)
+		{
+			mStart = std::chrono::steady_clock::now();
+		}
+	}
+	~EssStatTimer()
+	{
+		if (mStats != NULL)
+		{
+			const std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - mStart;
+			mStats->Add(mCategory, (unsigned long long)elapsed.count(), mBytes, mItems);
+		}
+	}
+	void SetBytes(unsigned long long bytes) { mBytes = bytes; }
+};
+
+/** Forwards to another sink and counts its writes as I/O. */
+class EssTimedSink : public EssOutputSink
+{
+private:
+	EssOutputSink* mSink;
+	EssExportStats* mStats;
+
+public:
+	EssTimedSink() : mSink(NULL), mStats(NULL) {}
+	void Attach(EssOutputSink* sink, EssExportStats* stats) { mSink = sink; mStats = stats; }
+	virtual bool Write(const char* data, size_t size)
+	{
+		EssStatTimer timer(mStats, ESS_STAT_IO, size);
+		return mSink->Write(data, size);
+	}
+	virtual bool Flush()
+	{
+		EssStatTimer timer(mStats, ESS_STAT_IO);
+		return mSink->Flush();
+	}
+	virtual bool Close()
+	{
+		EssStatTimer timer(mStats, ESS_STAT_IO);
+		return mSink->Close();
+	}
+};
@@ -0,0 +1,142 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "essatlas.h"
+#include "esslog.h"
+
+class EssExportStats;
+
+/** Converts the images referenced by materials into tiled, mip-mapped
+ * textures in a cache directory, so the renderer loads tiles on demand
+ * instead of whole images.
+ *
+ * Cached files are named by the content hash of the source image, so
+ * an image used under several paths is converted once. The index of
+ * the directory maps source path, mtime and size to the content hash,
+ * unchanged sources aren't read again. Conversions run on worker
+ * threads while the export goes on.
+ *
+ * With a resolution cap, conversions wait until Close, when the
+ * resolution each texture needs is known, and the files are named for
+ * the scene, as their content depends on its camera.
+ *
+ * Small textures can be packed into atlas pages, which are composed and
+ * converted in Close.
+ *
+ * Converting needs OpenImageIO 2.0 or newer, enabled with the
+ * ESS_USE_OIIO CMake option. Without it sources are referenced as
+ * they are.
+ */
+class EssTextureCache
+{
+private:
+	struct Source
+	{
+		unsigned long long mtime;
+		unsigned long long size;
+		unsigned long long hash;
+	};
+
+	struct Job
+	{
+		std::string source;
+		std::string target;
+		unsigned long long size;
+		unsigned int max_resolution;	/**< 0 keeps the source resolution */
+		const EssTextureAtlas::Page* page;	/**< Compose this atlas page instead */
+	};
+
+	std::string mDirectory;
+	bool mOpen;
+	unsigned int mNumThreads;
+	EssExportStats* mStats;
+	std::map<std::string, Source> mPrevSources;
+	std::map<std::string, Source> mSources;
+	/* source path -> path the ESS refers to */
+	std::map<std::string, std::string> mResolved;
+	std::map<unsigned long long, bool> mQueued;
+	std::string mCapTag;
+	/* cached file name -> resolution cap it was converted with */
+	std::map<std::string, unsigned int> mPrevCaps;
+	std::map<std::string, unsigned int> mCaps;
+	std::map<std::string, Job> mDeferred;
+	std::map<std::string, unsigned int> mMaxResolutions;
+	EssTextureAtlas mAtlas;
+	unsigned int mAtlasSize;
+	std::map<std::string, bool> mNotAtlased;
+	/* atlas page name -> hash of its layout and sources */
+	std::map<std::string, unsigned long long> mPrevAtlases;
+	std::map<std::string, unsigned long long> mAtlases;
+	std::deque<Job> mJobs;
+	std::vector<std::thread> mThreads;
+	std::mutex mMutex;
+	std::condition_variable mJobReady;
+	std::condition_variable mJobDone;
+	size_t mNumRunning;
+	bool mStop;
+	unsigned int mReused;
+	unsigned int mConverted;
+	unsigned int mFailed;
+	unsigned int mDownsampled;
+	unsigned long long mSourceTexels;
+	unsigned long long mCachedTexels;
+	EH_LogCallback mLogCallback;
+
+	void WorkerLoop();
+	void QueueJob(const Job& job);
+	void QueueDeferred();
+	void QueueAtlasPages();
+	std::string GetCachedName(unsigned long long hash) const;
+
+public:
+	EssTextureCache();
+	~EssTextureCache();
+	/** Is texture conversion compiled in? */
+	static bool IsAvailable();
+	/** Use directory as the cache, convert on numThreads workers, 0 uses all cores. */
+	bool Open(const std::string& directory, unsigned int numThreads, EssExportStats* stats);
+	bool IsOpen() const { return mOpen; }
+	/** Report unreadable and failed textures through the callback. */
+	void SetLogCallback(EH_LogCallback callback) { mLogCallback = callback; }
+	/** Defer conversions to Close and downsample them to the resolution
+	 * set for their source. tag names the cached files of the scene.
+	 */
+	void EnableResolutionCap(const std::string& tag) { mCapTag = tag; }
+	bool HasResolutionCap() const { return !mCapTag.empty(); }
+	/** The largest side of the cached texture, 0 keeps the source resolution. */
+	void SetMaxResolution(const std::string& source, unsigned int resolution) { mMaxResolutions[source] = resolution; }
+	/** Pack 8 bit images no larger than maxSize into atlas pages named for the scene. */
+	void EnableAtlas(unsigned int maxSize, const std::string& tag);
+	/** The atlas region of the source if it's packed, otherwise use Resolve. */
+	bool ResolveRegion(const std::string& source, EssTextureAtlas::Region& region);
+	/** The file to refer to for the source image. Queues a conversion
+	 * if the cache has none, returns the source if it can't be read.
+	 */
+	std::string Resolve(const std::string& source);
+	/** Wait for the conversions and write the index. */
+	bool Close();
+	void PrintReport(EH_LogCallback callback) const;
+};
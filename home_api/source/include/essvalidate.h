@@ -0,0 +1,79 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#pragma once
+
+#include <string>
+#include "essmesh.h"
+#include "esslog.h"
+
+/** Problems found in the arrays of one mesh */
+struct EssMeshReport
+{
+	unsigned int bad_verts;			/**< NaN or infinite positions */
+	unsigned int bad_indices;		/**< Triangles with an index past the end of its array */
+	unsigned int huge_verts;		/**< Positions beyond the coordinate limit */
+	unsigned int bad_normals;		/**< NaN, infinite or zero length normals */
+	unsigned int scaled_normals;	/**< Normals which weren't unit length */
+	unsigned int bad_uvs;			/**< NaN or infinite UVs */
+	unsigned int dropped_triangles;
+
+	EssMeshReport();
+	bool HasIssues() const;
+	void Print(const std::string& meshName, bool fixed, EH_LogCallback callback) const;
+};
+
+/** Validates the host arrays of a mesh before its triangles are
+ * filtered. The first scan is vectorized and only finds out whether
+ * anything is wrong, the vertices are classified one by one only then.
+ */
+class EssMeshValidator
+{
+private:
+	const EH_Mesh* mModel;
+	std::vector<unsigned char> mBadVerts;	/**< Empty when all positions are finite */
+	bool mCheckIndices;
+
+public:
+	EssMeshValidator();
+	/** Scan the positions and index streams, returns false when some
+	 * triangles have to be dropped.
+	 */
+	bool Check(const EH_Mesh& model, EssMeshReport& report);
+	/** May triangle i be written? Out of range indices would read past
+	 * the host arrays, so they are dropped by every policy.
+	 */
+	inline bool IsTriangleValid(uint_t i, bool dropBadVerts) const
+	{
+		if (!mCheckIndices && mBadVerts.empty())
+		{
+			return true;
+		}
+		return IsTriangleValidSlow(i, dropBadVerts);
+	}
+	bool IsTriangleValidSlow(uint_t i, bool dropBadVerts) const;
+};
+
+/** Check the compacted arrays of a mesh, and with fix set clamp huge
+ * positions, renormalize normals, replace degenerate normals by the
+ * face normal and zero invalid UVs.
+ */
+void ess_sanitize_mesh(EssMeshArrays& mesh, float maxCoordinate, bool fix, EssMeshReport& report);
+
+/** Are all values finite and no larger than limit in magnitude? */
+bool ess_check_floats(const float* data, size_t count, float limit);
+/** Are all indices less than limit? */
+bool ess_check_indices(const uint_t* data, size_t count, uint_t limit);
@@ -16,24 +16,91 @@
 
 #pragma once
 
-#include <fstream>
+#include <ostream>
 #include <vector>
 #include <string>
 #include <ei.h>
+#include "esssink.h"
+#include "essbin.h"
+#include "esspipeline.h"
+#include "essstats.h"
 
 class EssWriter
 {
 private:
 	std::locale mPreviousLocale;
-	std::ofstream mStream;
+	EssSinkBuffer mBuffer;
+	std::ostream mStream;
+	EssOutputSink* mSink;
+	EssOutputSink* mOutput;		/**< mSink, or mTimedSink in front of it */
+	EssTimedSink mTimedSink;
+	EssExportStats* mStats;
+	bool mOwnsSink;
+	bool mSwapLocale;
+	EssPipeline* mPipeline;
 	bool mInNode;
 	bool mBinartyEncoding;
+	std::vector<unsigned char> mEncodeBuffer;
+	std::vector<char> mFormatBuffer;
+	EssBinWriter mSidecar;
+	std::string mSidecarName;
+	std::string mSidecarNode;
+	bool mInSidecarNode;
+	std::string mDeclareName;
+	unsigned int mDeclareStorage;
+	EH_LogCallback mLogCallback;
+	bool mJobFailed;
+
+	void WriteBase85(const void* pData, size_t dataSize);
+	void WriteFloats(const float* pValues, size_t count);
+	void WriteFloatRows(const float* pValues, size_t numRows, size_t numCols);
+	void AddSidecarArray(const char* name, unsigned int type, bool faceVarying, const void* pData, size_t arraySize);
 
 public:
 	EssWriter();
 	~EssWriter();
 	bool Initialize(const char* filename, const bool encoding);
-	void Close();
+	bool Initialize(const char* filename, const bool encoding, const EssFileSinkOptions& options);
+	/** Write to a caller-owned sink, e.g. EssMemorySink or EssFdSink. */
+	bool Initialize(EssOutputSink* sink, const bool encoding, size_t bufferSize = ESS_SINK_DEFAULT_BUFFER_SIZE);
+	/** Write nodes without the file header, e.g. into the buffer of a pipeline job. */
+	bool InitializeFragment(EssOutputSink* sink, const bool encoding, size_t bufferSize);
+	unsigned long long GetBytesWritten() const { return mBuffer.GetBytesWritten() + (mPipeline ? mPipeline->GetJobBytes() : 0); }
+	unsigned long long GetWriteCalls() const { return mBuffer.GetWriteCalls(); }
+	/** Flush and release the output, returns false if anything failed to write. */
+	bool Close();
+	/** Count encoding and, for the next Initialize, output time in stats. */
+	void SetStats(EssExportStats* stats) { mStats = stats; }
+	EssExportStats* GetStats() const { return mStats; }
+	/** Report sidecar failures and compression through the callback. */
+	void SetLogCallback(EH_LogCallback callback) { mLogCallback = callback; mSidecar.SetLogCallback(callback); }
+
+	/** Store bulk arrays raw in a memory-mappable .essbin sidecar, see essbin.h.
+	 * sidecarName is how the ESS refers to the file, usually relative to it.
+	 */
+	bool OpenSidecar(const char* filename, const char* sidecarName);
+	bool HasSidecar() const { return mSidecar.IsOpen(); }
+	/** Compress sidecar arrays in blocks, see EssBinWriter::SetCompression. */
+	bool SetSidecarCompression(unsigned int codec, int level, unsigned int numThreads = 0) { return mSidecar.SetCompression(codec, level, numThreads); }
+	const std::string& GetSidecarName() const { return mSidecarName; }
+	/** Declares and arrays between these calls go to the sidecar
+	 * under the node name, nothing is written to the ESS.
+	 */
+	void BeginSidecarNode(const char* name);
+	void EndSidecarNode();
+
+	/** Encode nodes submitted with SubmitNodes on numThreads workers, 0 uses all cores.
+	 * The output stays in submission order.
+	 */
+	bool StartPipeline(unsigned int numThreads);
+	/** Run the job on a worker with a private writer, or right away without
+	 * a pipeline. A failed job fails Close.
+	 */
+	void SubmitNodes(const EssPipeline::Job& job);
+	/** Wait until all submitted nodes are written. */
+	void WaitPipeline();
+	bool HasPipeline() const { return mPipeline != NULL; }
+	unsigned int GetPipelineThreads() const { return mPipeline ? mPipeline->GetNumThreads() : 1; }
 
 	void BeginNode(const char* type, const char* name);
 	void BeginNode(const char* type, const std::string& name);
@@ -62,5 +129,7 @@ public:
 	void AddVector2Array(const char* name, const eiVector2* pVectorArray, size_t arraySize);
 	void AddPointArray(const char* name, const eiVector* pVectorArray, size_t arraySize);
 	void AddCustomString(const char* string);
+	/** Write ESS text produced by another writer, e.g. a cached node. */
+	void AddRawNodes(const char* data, size_t size);
 	void EndNode();
 };
\ No newline at end of file
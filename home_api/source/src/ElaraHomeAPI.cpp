@@ -22,6 +22,7 @@
 #include <ei_base_bucket.h>
 #include <ei_timer.h>
 #include <string>
+#include <string.h>
 
 #ifdef _WIN32
 	#include <Windows.h>
@@ -359,12 +360,32 @@ void EH_delete(EH_Context *ctx)
 
 void EH_begin_export(EH_Context *ctx, const char *filename, const EH_ExportOptions *opt)
 {
-	reinterpret_cast<EssExporter*>(ctx)->BeginExport(std::string(filename), *opt, false);
+	EH_ExportOptions2 options;
+	options.base85_encoding = opt->base85_encoding;
+	options.left_handed = opt->left_handed;
+	reinterpret_cast<EssExporter*>(ctx)->BeginExport(std::string(filename), options, false);
 }
 
-void EH_end_export(EH_Context *ctx)
+void EH_begin_export2(EH_Context *ctx, const char *filename, const EH_ExportOptions2 *opt)
 {
-	reinterpret_cast<EssExporter*>(ctx)->EndExport();
+	// a caller built against an older header passes a shorter struct
+	EH_ExportOptions2 options;
+	size_t size = opt->size;
+	if (size > sizeof(options))
+	{
+		size = sizeof(options);
+	}
+	if (size > sizeof(options.size))
+	{
+		memcpy(&options, opt, size);
+	}
+	options.size = sizeof(options);
+	reinterpret_cast<EssExporter*>(ctx)->BeginExport(std::string(filename), options, false);
+}
+
+bool EH_end_export(EH_Context *ctx)
+{
+	return reinterpret_cast<EssExporter*>(ctx)->EndExport();
 }
 
 void EH_set_log_callback(EH_Context *ctx, EH_LogCallback cb)
@@ -0,0 +1,550 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#include "base85.h"
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#	define B85_X86
+#endif
+
+#ifdef B85_X86
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#		define B85_TARGET_SSE41
+#		define B85_TARGET_AVX2
+#	else
+#		include <cpuid.h>
+#		define B85_TARGET_SSE41	__attribute__((target("sse4.1")))
+#		define B85_TARGET_AVX2	__attribute__((target("avx2")))
+#	endif
+#	include <immintrin.h>
+#endif
+
+/** Standard conforming implementation of Base85 encoding
+ * reference:
+ * https://raw.githubusercontent.com/zeromq/rfc/master/src/spec_32.c
+ */
+// Maps base 256 to base 85
+static const char encoder[85 + 1] = {
+    "0123456789"
+    "abcdefghij"
+    "klmnopqrst"
+    "uvwxyzABCD"
+    "EFGHIJKLMN"
+    "OPQRSTUVWX"
+    "YZ.-:+=^!/"
+    "*?&<>()[]{"
+    "}@%$#"
+};
+
+size_t base85_calc_encode_bound(size_t input_length)
+{
+	size_t padding_size = 0;
+	size_t remainder = input_length % 4;
+	if (remainder > 0)
+	{
+		padding_size = 4 - remainder;
+	}
+	size_t padded_length = input_length + padding_size;
+	size_t output_length = (padded_length / 4) * 5 - padding_size;
+	return output_length + 1;
+}
+
+size_t base85_encode_scalar(const unsigned char *data, size_t input_length, unsigned char *encoded_data)
+{
+	size_t remainder = input_length % 4;
+	size_t padding_size = 0;
+	if (remainder > 0)
+	{
+		padding_size = 4 - remainder;
+	}
+	size_t padded_length = input_length + padding_size;
+	size_t output_length = (padded_length / 4) * 5 - padding_size;
+
+	size_t char_nbr = 0;
+	for (size_t byte_nbr = 0; byte_nbr < padded_length; byte_nbr += 4)
+	{
+		unsigned int value = 0;
+		if (byte_nbr + 0 < input_length)
+		{
+			value += (data[byte_nbr + 0] << 3 * 8);
+		}
+		if (byte_nbr + 1 < input_length)
+		{
+			value += (data[byte_nbr + 1] << 2 * 8);
+		}
+		if (byte_nbr + 2 < input_length)
+		{
+			value += (data[byte_nbr + 2] << 1 * 8);
+		}
+		if (byte_nbr + 3 < input_length)
+		{
+			value += data[byte_nbr + 3];
+		}
+		if (char_nbr < output_length)
+		{
+			encoded_data[char_nbr] = encoder[value / (85 * 85 * 85 * 85) % 85];
+			++ char_nbr;
+		}
+		if (char_nbr < output_length)
+		{
+			encoded_data[char_nbr] = encoder[value / (85 * 85 * 85) % 85];
+			++ char_nbr;
+		}
+		if (char_nbr < output_length)
+		{
+			encoded_data[char_nbr] = encoder[value / (85 * 85) % 85];
+			++ char_nbr;
+		}
+		if (char_nbr < output_length)
+		{
+			encoded_data[char_nbr] = encoder[value / 85 % 85];
+			++ char_nbr;
+		}
+		if (char_nbr < output_length)
+		{
+			encoded_data[char_nbr] = encoder[value % 85];
+			++ char_nbr;
+		}
+	}
+
+	encoded_data[char_nbr] = '\0';
+
+	return char_nbr + 1;
+}
+
+/** Encode one big-endian group into 5 characters.
+ */
+static inline void encode_group(unsigned int value, unsigned char *out)
+{
+	unsigned int q;
+	q = value / 85; out[4] = encoder[value - q * 85]; value = q;
+	q = value / 85; out[3] = encoder[value - q * 85]; value = q;
+	q = value / 85; out[2] = encoder[value - q * 85]; value = q;
+	q = value / 85; out[1] = encoder[value - q * 85];
+	out[0] = encoder[q];
+}
+
+static inline unsigned int load_group(const unsigned char *data)
+{
+	return ((unsigned int)data[0] << 24) |
+		((unsigned int)data[1] << 16) |
+		((unsigned int)data[2] << 8) |
+		(unsigned int)data[3];
+}
+
+static size_t encode_groups_scalar(const unsigned char *data, size_t num_groups, unsigned char *out)
+{
+	for (size_t i = 0; i < num_groups; ++i)
+	{
+		encode_group(load_group(data), out);
+		data += 4;
+		out += 5;
+	}
+	return num_groups;
+}
+
+#ifdef B85_X86
+
+/* For any 32-bit v, v / 85 == (v * 0xC0C0C0C1) >> 38, which lets us
+   divide 4 or 8 groups at once with 32x32->64 multiplies. */
+#define B85_RECIPROCAL	((int)0xC0C0C0C1)
+
+B85_TARGET_SSE41 static inline __m128i div85_sse41(__m128i v)
+{
+	const __m128i magic = _mm_set1_epi32(B85_RECIPROCAL);
+	__m128i even = _mm_srli_epi64(_mm_mul_epu32(v, magic), 38);
+	__m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(v, 32), magic), 38);
+	return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+}
+
+/** Map digits in [0, 84] to the encoder alphabet, byte-wise.
+ */
+B85_TARGET_SSE41 static inline __m128i map_digits_sse41(__m128i d)
+{
+	const __m128i punct0 = _mm_setr_epi8('.', '-', ':', '+', '=', '^', '!', '/', '*', '?', '&', '<', '>', '(', ')', '[');
+	const __m128i punct1 = _mm_setr_epi8(']', '{', '}', '@', '%', '$', '#', 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+	__m128i c = _mm_add_epi8(d, _mm_set1_epi8('0'));
+	c = _mm_add_epi8(c, _mm_and_si128(_mm_cmpgt_epi8(d, _mm_set1_epi8(9)), _mm_set1_epi8('a' - 10 - '0')));
+	c = _mm_add_epi8(c, _mm_and_si128(_mm_cmpgt_epi8(d, _mm_set1_epi8(35)), _mm_set1_epi8(('A' - 36) - ('a' - 10))));
+
+	/* negative indices make pshufb return zero */
+	__m128i idx = _mm_sub_epi8(d, _mm_set1_epi8(62));
+	__m128i p = _mm_or_si128(
+		_mm_shuffle_epi8(punct0, _mm_or_si128(idx, _mm_cmpgt_epi8(idx, _mm_set1_epi8(15)))),
+		_mm_shuffle_epi8(punct1, _mm_sub_epi8(idx, _mm_set1_epi8(16))));
+
+	return _mm_blendv_epi8(c, p, _mm_cmpgt_epi8(d, _mm_set1_epi8(61)));
+}
+
+/** Encode 4 groups held as big-endian values in v into 20 characters.
+ */
+B85_TARGET_SSE41 static inline void encode4_sse41(__m128i v, unsigned char *out)
+{
+	const __m128i k85 = _mm_set1_epi32(85);
+	__m128i q1 = div85_sse41(v);
+	__m128i d4 = _mm_sub_epi32(v, _mm_mullo_epi32(q1, k85));
+	__m128i q2 = div85_sse41(q1);
+	__m128i d3 = _mm_sub_epi32(q1, _mm_mullo_epi32(q2, k85));
+	__m128i q3 = div85_sse41(q2);
+	__m128i d2 = _mm_sub_epi32(q2, _mm_mullo_epi32(q3, k85));
+	__m128i d0 = div85_sse41(q3);
+	__m128i d1 = _mm_sub_epi32(q3, _mm_mullo_epi32(d0, k85));
+
+	__m128i a = _mm_or_si128(
+		_mm_or_si128(d0, _mm_slli_epi32(d1, 8)),
+		_mm_or_si128(_mm_slli_epi32(d2, 16), _mm_slli_epi32(d3, 24)));
+	a = map_digits_sse41(a);
+	__m128i b = map_digits_sse41(d4);
+
+	__m128i lo = _mm_or_si128(
+		_mm_shuffle_epi8(a, _mm_setr_epi8(0, 1, 2, 3, -1, 4, 5, 6, 7, -1, 8, 9, 10, 11, -1, 12)),
+		_mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, 0, -1, -1, -1, -1, 4, -1, -1, -1, -1, 8, -1)));
+	__m128i hi = _mm_or_si128(
+		_mm_shuffle_epi8(a, _mm_setr_epi8(13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)));
+
+	_mm_storeu_si128((__m128i *)out, lo);
+	int tail = _mm_cvtsi128_si32(hi);
+	memcpy(out + 16, &tail, 4);
+}
+
+B85_TARGET_SSE41 static size_t encode_groups_sse41(const unsigned char *data, size_t num_groups, unsigned char *out)
+{
+	const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	size_t i = 0;
+	for (; i + 4 <= num_groups; i += 4)
+	{
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), bswap);
+		encode4_sse41(v, out);
+		data += 16;
+		out += 20;
+	}
+	return i + encode_groups_scalar(data, num_groups - i, out);
+}
+
+B85_TARGET_AVX2 static inline __m256i div85_avx2(__m256i v)
+{
+	const __m256i magic = _mm256_set1_epi32(B85_RECIPROCAL);
+	__m256i even = _mm256_srli_epi64(_mm256_mul_epu32(v, magic), 38);
+	__m256i odd = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(v, 32), magic), 38);
+	return _mm256_or_si256(even, _mm256_slli_epi64(odd, 32));
+}
+
+B85_TARGET_AVX2 static inline __m256i map_digits_avx2(__m256i d)
+{
+	const __m256i punct0 = _mm256_broadcastsi128_si256(
+		_mm_setr_epi8('.', '-', ':', '+', '=', '^', '!', '/', '*', '?', '&', '<', '>', '(', ')', '['));
+	const __m256i punct1 = _mm256_broadcastsi128_si256(
+		_mm_setr_epi8(']', '{', '}', '@', '%', '$', '#', 0, 0, 0, 0, 0, 0, 0, 0, 0));
+
+	__m256i c = _mm256_add_epi8(d, _mm256_set1_epi8('0'));
+	c = _mm256_add_epi8(c, _mm256_and_si256(_mm256_cmpgt_epi8(d, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - 10 - '0')));
+	c = _mm256_add_epi8(c, _mm256_and_si256(_mm256_cmpgt_epi8(d, _mm256_set1_epi8(35)), _mm256_set1_epi8(('A' - 36) - ('a' - 10))));
+
+	__m256i idx = _mm256_sub_epi8(d, _mm256_set1_epi8(62));
+	__m256i p = _mm256_or_si256(
+		_mm256_shuffle_epi8(punct0, _mm256_or_si256(idx, _mm256_cmpgt_epi8(idx, _mm256_set1_epi8(15)))),
+		_mm256_shuffle_epi8(punct1, _mm256_sub_epi8(idx, _mm256_set1_epi8(16))));
+
+	return _mm256_blendv_epi8(c, p, _mm256_cmpgt_epi8(d, _mm256_set1_epi8(61)));
+}
+
+B85_TARGET_AVX2 static size_t encode_groups_avx2(const unsigned char *data, size_t num_groups, unsigned char *out)
+{
+	const __m256i bswap = _mm256_broadcastsi128_si256(
+		_mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+	const __m256i k85 = _mm256_set1_epi32(85);
+	const __m256i shuf_a_lo = _mm256_broadcastsi128_si256(
+		_mm_setr_epi8(0, 1, 2, 3, -1, 4, 5, 6, 7, -1, 8, 9, 10, 11, -1, 12));
+	const __m256i shuf_b_lo = _mm256_broadcastsi128_si256(
+		_mm_setr_epi8(-1, -1, -1, -1, 0, -1, -1, -1, -1, 4, -1, -1, -1, -1, 8, -1));
+	const __m256i shuf_a_hi = _mm256_broadcastsi128_si256(
+		_mm_setr_epi8(13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+	const __m256i shuf_b_hi = _mm256_broadcastsi128_si256(
+		_mm_setr_epi8(-1, -1, -1, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+
+	size_t i = 0;
+	for (; i + 8 <= num_groups; i += 8)
+	{
+		__m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)data), bswap);
+
+		__m256i q1 = div85_avx2(v);
+		__m256i d4 = _mm256_sub_epi32(v, _mm256_mullo_epi32(q1, k85));
+		__m256i q2 = div85_avx2(q1);
+		__m256i d3 = _mm256_sub_epi32(q1, _mm256_mullo_epi32(q2, k85));
+		__m256i q3 = div85_avx2(q2);
+		__m256i d2 = _mm256_sub_epi32(q2, _mm256_mullo_epi32(q3, k85));
+		__m256i d0 = div85_avx2(q3);
+		__m256i d1 = _mm256_sub_epi32(q3, _mm256_mullo_epi32(d0, k85));
+
+		__m256i a = _mm256_or_si256(
+			_mm256_or_si256(d0, _mm256_slli_epi32(d1, 8)),
+			_mm256_or_si256(_mm256_slli_epi32(d2, 16), _mm256_slli_epi32(d3, 24)));
+		a = map_digits_avx2(a);
+		__m256i b = map_digits_avx2(d4);
+
+		/* pshufb works per 128-bit lane, each lane yields 4 groups */
+		__m256i lo = _mm256_or_si256(_mm256_shuffle_epi8(a, shuf_a_lo), _mm256_shuffle_epi8(b, shuf_b_lo));
+		__m256i hi = _mm256_or_si256(_mm256_shuffle_epi8(a, shuf_a_hi), _mm256_shuffle_epi8(b, shuf_b_hi));
+
+		int tail0 = _mm_cvtsi128_si32(_mm256_castsi256_si128(hi));
+		int tail1 = _mm_cvtsi128_si32(_mm256_extracti128_si256(hi, 1));
+		_mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(lo));
+		memcpy(out + 16, &tail0, 4);
+		_mm_storeu_si128((__m128i *)(out + 20), _mm256_extracti128_si256(lo, 1));
+		memcpy(out + 36, &tail1, 4);
+
+		data += 32;
+		out += 40;
+	}
+	return i + encode_groups_scalar(data, num_groups - i, out);
+}
+
+enum
+{
+	B85_CPU_NONE = 0,
+	B85_CPU_SSE41,
+	B85_CPU_AVX2,
+};
+
+static int detect_cpu()
+{
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+	unsigned int max_leaf;
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	max_leaf = info[0];
+	__cpuid(info, 1);
+	ecx = info[2];
+#else
+	if (!__get_cpuid(0, &max_leaf, &ebx, &ecx, &edx))
+	{
+		return B85_CPU_NONE;
+	}
+	__get_cpuid(1, &eax, &ebx, &ecx, &edx);
+#endif
+	const bool sse41 = (ecx & (1 << 19)) != 0;
+	const bool osxsave = (ecx & (1 << 27)) != 0;
+	const bool avx = (ecx & (1 << 28)) != 0;
+
+	bool avx2 = false;
+	if (max_leaf >= 7 && osxsave && avx)
+	{
+		/* the OS must save YMM registers as well */
+		unsigned long long xcr0;
+#ifdef _MSC_VER
+		xcr0 = _xgetbv(0);
+		__cpuidex(info, 7, 0);
+		ebx = info[1];
+#else
+		unsigned int xcr0_lo, xcr0_hi;
+		__asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+		xcr0 = ((unsigned long long)xcr0_hi << 32) | xcr0_lo;
+		__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+#endif
+		avx2 = (xcr0 & 6) == 6 && (ebx & (1 << 5)) != 0;
+	}
+
+	if (avx2)
+	{
+		return B85_CPU_AVX2;
+	}
+	if (sse41)
+	{
+		return B85_CPU_SSE41;
+	}
+	return B85_CPU_NONE;
+}
+
+#endif /* B85_X86 */
+
+typedef size_t (*b85_groups_kernel)(const unsigned char *data, size_t num_groups, unsigned char *out);
+
+struct b85_kernel_choice
+{
+	b85_groups_kernel	kernel;
+	const char			*name;
+};
+
+/** The kernel, or NULL if the CPU can't run it. */
+static b85_groups_kernel find_kernel(base85_kernel kernel)
+{
+#ifdef B85_X86
+	const int cpu = detect_cpu();
+	switch (kernel)
+	{
+	case BASE85_KERNEL_AVX2:
+		return (cpu >= B85_CPU_AVX2) ? encode_groups_avx2 : NULL;
+	case BASE85_KERNEL_SSE41:
+		return (cpu >= B85_CPU_SSE41) ? encode_groups_sse41 : NULL;
+	default:
+		break;
+	}
+#endif
+	return (kernel == BASE85_KERNEL_SCALAR) ? encode_groups_scalar : NULL;
+}
+
+static b85_kernel_choice choose_kernel()
+{
+	b85_kernel_choice choice = { encode_groups_scalar, "scalar" };
+	if (find_kernel(BASE85_KERNEL_AVX2) != NULL)
+	{
+		choice.kernel = find_kernel(BASE85_KERNEL_AVX2);
+		choice.name = "avx2";
+	}
+	else if (find_kernel(BASE85_KERNEL_SSE41) != NULL)
+	{
+		choice.kernel = find_kernel(BASE85_KERNEL_SSE41);
+		choice.name = "sse4.1";
+	}
+	return choice;
+}
+
+/** Function-local static, so the first call is thread-safe even when
+ * several pipeline workers encode concurrently.
+ */
+static const b85_kernel_choice &select_kernel()
+{
+	static const b85_kernel_choice choice = choose_kernel();
+	return choice;
+}
+
+const char *base85_kernel_name()
+{
+	return select_kernel().name;
+}
+
+size_t base85_encode_groups(const unsigned char *data, size_t input_length, unsigned char *encoded_data)
+{
+	const size_t num_groups = input_length / 4;
+	select_kernel().kernel(data, num_groups, encoded_data);
+	return num_groups * 5;
+}
+
+bool base85_kernel_supported(base85_kernel kernel)
+{
+	return find_kernel(kernel) != NULL;
+}
+
+static size_t encode_with(b85_groups_kernel kernel, const unsigned char *data, size_t input_length, unsigned char *encoded_data)
+{
+	const size_t num_groups = input_length / 4;
+	kernel(data, num_groups, encoded_data);
+	size_t char_nbr = num_groups * 5;
+
+	const size_t remainder = input_length % 4;
+	if (remainder > 0)
+	{
+		unsigned char last[4] = {0, 0, 0, 0};
+		unsigned char chars[5];
+		memcpy(last, data + (input_length - remainder), remainder);
+		encode_group(load_group(last), chars);
+		memcpy(encoded_data + char_nbr, chars, remainder + 1);
+		char_nbr += remainder + 1;
+	}
+
+	encoded_data[char_nbr] = '\0';
+
+	return char_nbr + 1;
+}
+
+size_t base85_encode(const unsigned char *data, size_t input_length, unsigned char *encoded_data)
+{
+	return encode_with(select_kernel().kernel, data, input_length, encoded_data);
+}
+
+size_t base85_encode_kernel(base85_kernel kernel, const unsigned char *data, size_t input_length, unsigned char *encoded_data)
+{
+	const b85_groups_kernel groups = find_kernel(kernel);
+	return (groups != NULL) ? encode_with(groups, data, input_length, encoded_data) : 0;
+}
+
+/** Inverse of encoder, -1 for characters outside the alphabet.
+ */
+struct b85_decoder_table
+{
+	signed char	digits[256];
+
+	b85_decoder_table()
+	{
+		memset(digits, -1, sizeof(digits));
+		for (int i = 0; i < 85; ++i)
+		{
+			digits[(unsigned char)encoder[i]] = (signed char)i;
+		}
+	}
+};
+
+size_t base85_calc_decode_size(size_t encoded_length)
+{
+	size_t remainder = encoded_length % 5;
+	return (encoded_length / 5) * 4 + (remainder > 0 ? remainder - 1 : 0);
+}
+
+size_t base85_decode(const unsigned char *encoded_data, size_t encoded_length, unsigned char *data)
+{
+	static const b85_decoder_table decoder;
+
+	/* a single trailing character can not carry a byte */
+	if (encoded_length % 5 == 1)
+	{
+		return 0;
+	}
+
+	size_t byte_nbr = 0;
+	for (size_t char_nbr = 0; char_nbr < encoded_length; char_nbr += 5)
+	{
+		size_t count = encoded_length - char_nbr;
+		if (count > 5)
+		{
+			count = 5;
+		}
+
+		/* missing characters of the last group are padded with the
+		   highest digit, so the truncated value rounds back up */
+		unsigned long long value = 0;
+		for (size_t i = 0; i < 5; ++i)
+		{
+			int digit = 84;
+			if (i < count)
+			{
+				digit = decoder.digits[encoded_data[char_nbr + i]];
+				if (digit < 0)
+				{
+					return 0;
+				}
+			}
+			value = value * 85 + digit;
+		}
+		if (count == 5 && value > 0xFFFFFFFFull)
+		{
+			return 0;
+		}
+
+		const size_t num_bytes = count - 1;
+		for (size_t i = 0; i < num_bytes; ++i)
+		{
+			data[byte_nbr + i] = (unsigned char)(value >> (24 - i * 8));
+		}
+		byte_nbr += num_bytes;
+	}
+
+	return byte_nbr;
+}
@@ -0,0 +1,223 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "essatlas.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+EssSkylinePacker::EssSkylinePacker() :
+	mWidth(0),
+	mHeight(0)
+{
+}
+
+void EssSkylinePacker::Reset(int width, int height)
+{
+	mWidth = width;
+	mHeight = height;
+	mSkyline.clear();
+	Node node;
+	node.x = 0;
+	node.y = 0;
+	node.width = width;
+	mSkyline.push_back(node);
+}
+
+int EssSkylinePacker::Fit(size_t i, int width, int height) const
+{
+	const int x = mSkyline[i].x;
+	if (x + width > mWidth)
+	{
+		return -1;
+	}
+	int y = 0;
+	int remaining = width;
+	for (; remaining > 0; ++i)
+	{
+		y = std::max(y, mSkyline[i].y);
+		if (y + height > mHeight)
+		{
+			return -1;
+		}
+		remaining -= mSkyline[i].width;
+	}
+	return y;
+}
+
+bool EssSkylinePacker::Insert(int width, int height, int& x, int& y)
+{
+	// the lowest place, then the narrowest node
+	size_t best = mSkyline.size();
+	int bestY = mHeight;
+	int bestWidth = mWidth + 1;
+	for (size_t i = 0; i < mSkyline.size(); ++i)
+	{
+		const int fitY = Fit(i, width, height);
+		if (fitY >= 0 && (fitY < bestY || (fitY == bestY && mSkyline[i].width < bestWidth)))
+		{
+			best = i;
+			bestY = fitY;
+			bestWidth = mSkyline[i].width;
+		}
+	}
+	if (best == mSkyline.size())
+	{
+		return false;
+	}
+	x = mSkyline[best].x;
+	y = bestY;
+
+	Node node;
+	node.x = x;
+	node.y = y + height;
+	node.width = width;
+	mSkyline.insert(mSkyline.begin() + best, node);
+
+	// cut the nodes under the new one
+	for (size_t i = best + 1; i < mSkyline.size(); )
+	{
+		const int overlap = mSkyline[i - 1].x + mSkyline[i - 1].width - mSkyline[i].x;
+		if (overlap <= 0)
+		{
+			break;
+		}
+		mSkyline[i].x += overlap;
+		mSkyline[i].width -= overlap;
+		if (mSkyline[i].width > 0)
+		{
+			break;
+		}
+		mSkyline.erase(mSkyline.begin() + i);
+	}
+	for (size_t i = 0; i + 1 < mSkyline.size(); )
+	{
+		if (mSkyline[i].y == mSkyline[i + 1].y)
+		{
+			mSkyline[i].width += mSkyline[i + 1].width;
+			mSkyline.erase(mSkyline.begin() + i + 1);
+		}
+		else
+		{
+			++ i;
+		}
+	}
+	return true;
+}
+
+EssTextureAtlas::EssTextureAtlas() :
+	mPageSize(0),
+	mGutter(0)
+{
+}
+
+void EssTextureAtlas::Reset(int pageSize, int gutter, const std::string& pagePrefix)
+{
+	mPageSize = pageSize;
+	mGutter = gutter;
+	mPagePrefix = pagePrefix;
+	mPages.clear();
+	mPackers.clear();
+	mPlaced.clear();
+}
+
+bool EssTextureAtlas::Find(const std::string& source, Region& region) const
+{
+	std::map<std::string, std::pair<size_t, size_t> >::const_iterator iter = mPlaced.find(source);
+	if (iter == mPlaced.end())
+	{
+		return false;
+	}
+	const Page& page = mPages[iter->second.first];
+	const Entry& entry = page.entries[iter->second.second];
+	const float scale = 1.0f / (float)mPageSize;
+	region.filename = page.filename;
+	region.u = entry.x * scale;
+	region.v = entry.y * scale;
+	region.w = entry.width * scale;
+	region.h = entry.height * scale;
+	return true;
+}
+
+bool EssTextureAtlas::Add(const std::string& source, int width, int height, Region& region)
+{
+	if (Find(source, region))
+	{
+		return true;
+	}
+	const int paddedWidth = width + 2 * mGutter;
+	const int paddedHeight = height + 2 * mGutter;
+	if (width <= 0 || height <= 0 || paddedWidth > mPageSize || paddedHeight > mPageSize)
+	{
+		return false;
+	}
+	// the first page with room, small images fill the gaps of earlier pages
+	int x, y;
+	size_t pageIndex = 0;
+	while (pageIndex < mPages.size() && !mPackers[pageIndex].Insert(paddedWidth, paddedHeight, x, y))
+	{
+		++ pageIndex;
+	}
+	if (pageIndex == mPages.size())
+	{
+		mPackers.push_back(EssSkylinePacker());
+		mPackers.back().Reset(mPageSize, mPageSize);
+		mPackers.back().Insert(paddedWidth, paddedHeight, x, y);
+		Page page;
+		char suffix[32];
+		sprintf(suffix, "_%u.tx", (unsigned int)mPages.size());
+		page.filename = mPagePrefix + suffix;
+		mPages.push_back(page);
+	}
+	Entry entry;
+	entry.source = source;
+	entry.x = x + mGutter;
+	entry.y = y + mGutter;
+	entry.width = width;
+	entry.height = height;
+	Page& page = mPages[pageIndex];
+	page.entries.push_back(entry);
+	mPlaced[source] = std::make_pair(pageIndex, page.entries.size() - 1);
+	return Find(source, region);
+}
+
+bool EssTextureAtlas::ComposePage(const Page& page, const Loader& load, std::vector<unsigned char>& pixels, EH_LogCallback callback) const
+{
+	pixels.assign((size_t)mPageSize * mPageSize * 4, 0);
+	std::vector<unsigned char> image;
+	for (size_t i = 0; i < page.entries.size(); ++i)
+	{
+		const Entry& entry = page.entries[i];
+		if (!load(entry.source, entry.width, entry.height, image) || image.size() < (size_t)entry.width * entry.height * 4)
+		{
+			ess_log(callback, EH_WARNING, "Can't read texture %s for the atlas\n", entry.source.c_str());
+			return false;
+		}
+		// the gutter repeats the image as the UVs wrap
+		for (int y = -mGutter; y < entry.height + mGutter; ++y)
+		{
+			const int srcY = (y % entry.height + entry.height) % entry.height;
+			unsigned char* dst = &pixels[((size_t)(entry.y + y) * mPageSize + entry.x) * 4];
+			for (int x = -mGutter; x < entry.width + mGutter; ++x)
+			{
+				const int srcX = (x % entry.width + entry.width) % entry.width;
+				memcpy(dst + x * 4, &image[((size_t)srcY * entry.width + srcX) * 4], 4);
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,334 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#include "essbin.h"
+#include <string.h>
+#include <stdio.h>
+#include <thread>
+#include <chrono>
+#include <zlib.h>
+#ifdef ESS_USE_ZSTD
+#	include <zstd.h>
+#endif
+#ifdef _WIN32
+#	include <Windows.h>
+#endif
+
+#define ESSBIN_PARTIAL_SUFFIX	".part"
+
+/** Replace target by source, also when target exists.
+ */
+static bool replace_file(const char* source, const char* target)
+{
+#ifdef _WIN32
+	return MoveFileExA(source, target, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(source, target) == 0;
+#endif
+}
+
+/** Compress one block, returns false if the codec failed.
+ */
+static bool compress_block(unsigned int codec, int level, const char* src, size_t size, std::vector<char>& dst)
+{
+	switch (codec)
+	{
+	case ESSBIN_CODEC_ZLIB:
+		{
+			uLongf dstSize = compressBound((uLong)size);
+			dst.resize(dstSize);
+			if (compress2((Bytef*)&dst[0], &dstSize, (const Bytef*)src, (uLong)size, level > 0 ? level : Z_DEFAULT_COMPRESSION) != Z_OK)
+			{
+				return false;
+			}
+			dst.resize(dstSize);
+			return true;
+		}
+#ifdef ESS_USE_ZSTD
+	case ESSBIN_CODEC_ZSTD:
+		{
+			dst.resize(ZSTD_compressBound(size));
+			size_t dstSize = ZSTD_compress(&dst[0], dst.size(), src, size, level > 0 ? level : 3);
+			if (ZSTD_isError(dstSize))
+			{
+				return false;
+			}
+			dst.resize(dstSize);
+			return true;
+		}
+#endif
+	}
+	return false;
+}
+
+size_t essbin_item_size(unsigned int type)
+{
+	switch (type)
+	{
+	case ESSBIN_TYPE_INDEX:
+		return sizeof(unsigned int);
+	case ESSBIN_TYPE_POINT:
+	case ESSBIN_TYPE_VECTOR:
+		return 3 * sizeof(float);
+	case ESSBIN_TYPE_VECTOR2:
+		return 2 * sizeof(float);
+	}
+	return 0;
+}
+
+EssBinWriter::EssBinWriter() :
+	mOffset(0),
+	mOpen(false),
+	mCodec(ESSBIN_CODEC_RAW),
+	mLevel(0),
+	mNumThreads(0),
+	mRawBytes(0),
+	mStoredBytes(0),
+	mLogCallback(NULL)
+{
+}
+
+EssBinWriter::~EssBinWriter()
+{
+	Close();
+}
+
+bool EssBinWriter::Open(const char* filename)
+{
+	Close();
+	mFilename = filename;
+	const std::string partial = mFilename + ESSBIN_PARTIAL_SUFFIX;
+	if (!mFile.Open(partial.c_str(), EssFileSinkOptions()))
+	{
+		return false;
+	}
+	if (!mBuffer.Attach(&mFile, ESS_SINK_DEFAULT_BUFFER_SIZE))
+	{
+		mFile.Close();
+		remove(partial.c_str());
+		return false;
+	}
+	mEntries.clear();
+	mStrings.clear();
+	mOffset = 0;
+	mRawBytes = 0;
+	mStoredBytes = 0;
+	mOpen = true;
+
+	EssBinHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ESSBIN_MAGIC, sizeof(header.magic));
+	header.version = ESSBIN_VERSION;
+	Write(&header, sizeof(header));
+	return true;
+}
+
+bool EssBinWriter::SetCompression(unsigned int codec, int level, unsigned int numThreads)
+{
+#ifndef ESS_USE_ZSTD
+	if (codec == ESSBIN_CODEC_ZSTD)
+	{
+		return false;
+	}
+#endif
+	if (codec > ESSBIN_CODEC_ZSTD)
+	{
+		return false;
+	}
+	mCodec = codec;
+	mLevel = level;
+	mNumThreads = numThreads;
+	return true;
+}
+
+bool EssBinWriter::CompressBlocks(const char* data, size_t size)
+{
+	const size_t numBlocks = (size + ESSBIN_BLOCK_SIZE - 1) / ESSBIN_BLOCK_SIZE;
+	mBlocks.resize(numBlocks);
+
+	size_t numThreads = mNumThreads > 0 ? mNumThreads : std::thread::hardware_concurrency();
+	if (numThreads > numBlocks)
+	{
+		numThreads = numBlocks;
+	}
+	if (numThreads == 0)
+	{
+		numThreads = 1;
+	}
+
+	// thread t compresses blocks t, t + numThreads, ...
+	std::vector<char> failed(numThreads, 0);
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < numThreads; ++t)
+	{
+		threads.push_back(std::thread([this, data, size, numBlocks, numThreads, t, &failed]()
+		{
+			for (size_t i = t; i < numBlocks; i += numThreads)
+			{
+				const size_t blockOffset = i * ESSBIN_BLOCK_SIZE;
+				const size_t blockSize = (size - blockOffset) < ESSBIN_BLOCK_SIZE ? (size - blockOffset) : ESSBIN_BLOCK_SIZE;
+				if (!compress_block(mCodec, mLevel, data + blockOffset, blockSize, mBlocks[i]))
+				{
+					failed[t] = 1;
+				}
+			}
+		}));
+	}
+	bool ok = true;
+	for (size_t t = 0; t < numThreads; ++t)
+	{
+		threads[t].join();
+		if (failed[t])
+		{
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+unsigned int EssBinWriter::AddString(const char* str)
+{
+	unsigned int offset = (unsigned int)mStrings.size();
+	mStrings.insert(mStrings.end(), str, str + strlen(str) + 1);
+	return offset;
+}
+
+void EssBinWriter::Write(const void* data, size_t size)
+{
+	mBuffer.sputn((const char*)data, (std::streamsize)size);
+	mOffset += size;
+}
+
+void EssBinWriter::Align()
+{
+	static const char zeros[ESSBIN_ALIGNMENT] = { 0 };
+	size_t pad = (size_t)((ESSBIN_ALIGNMENT - (mOffset % ESSBIN_ALIGNMENT)) % ESSBIN_ALIGNMENT);
+	if (pad > 0)
+	{
+		Write(zeros, pad);
+	}
+}
+
+void EssBinWriter::AddArray(const char* nodeName, const char* paramName, unsigned int type, unsigned int storage, const void* data, size_t count)
+{
+	if (!mOpen)
+	{
+		return;
+	}
+	Align();
+
+	const size_t rawSize = count * essbin_item_size(type);
+	EssBinEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.offset = mOffset;
+	entry.size = rawSize;
+	entry.count = count;
+	entry.node_name = AddString(nodeName);
+	entry.param_name = AddString(paramName);
+	entry.type = type;
+	entry.storage = storage;
+	entry.codec = ESSBIN_CODEC_RAW;
+	mRawBytes += rawSize;
+
+	if (mCodec != ESSBIN_CODEC_RAW && rawSize >= ESSBIN_MIN_COMPRESS_SIZE)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (CompressBlocks((const char*)data, rawSize))
+		{
+			EssBinBlockHeader header;
+			header.block_size = ESSBIN_BLOCK_SIZE;
+			header.num_blocks = (unsigned int)mBlocks.size();
+			std::vector<unsigned long long> offsets(mBlocks.size() + 1);
+			offsets[0] = sizeof(header) + offsets.size() * sizeof(unsigned long long);
+			for (size_t i = 0; i < mBlocks.size(); ++i)
+			{
+				offsets[i + 1] = offsets[i] + mBlocks[i].size();
+			}
+
+			// keep incompressible arrays raw, they map without a copy
+			if (offsets.back() < rawSize)
+			{
+				entry.codec = mCodec;
+				entry.size = offsets.back();
+				mEntries.push_back(entry);
+				Write(&header, sizeof(header));
+				Write(&offsets[0], offsets.size() * sizeof(unsigned long long));
+				for (size_t i = 0; i < mBlocks.size(); ++i)
+				{
+					Write(&mBlocks[i][0], mBlocks[i].size());
+				}
+				mStoredBytes += entry.size;
+
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				ess_log(mLogCallback, EH_INFO, "essbin %s.%s: %llu -> %llu bytes, ratio %.2f, %.1f MB/s\n",
+					nodeName, paramName, (unsigned long long)rawSize, entry.size,
+					(double)rawSize / (double)entry.size,
+					seconds > 0.0 ? (double)rawSize / (1024.0 * 1024.0) / seconds : 0.0);
+				return;
+			}
+		}
+	}
+
+	mEntries.push_back(entry);
+	Write(data, rawSize);
+	mStoredBytes += rawSize;
+}
+
+bool EssBinWriter::Close()
+{
+	if (!mOpen)
+	{
+		return false;
+	}
+	mOpen = false;
+
+	Align();
+	EssBinFooter footer;
+	memset(&footer, 0, sizeof(footer));
+	footer.table_offset = mOffset;
+	footer.num_entries = (unsigned int)mEntries.size();
+	if (!mEntries.empty())
+	{
+		Write(&mEntries[0], mEntries.size() * sizeof(EssBinEntry));
+	}
+	footer.strings_offset = mOffset;
+	footer.strings_size = mStrings.size();
+	if (!mStrings.empty())
+	{
+		Write(&mStrings[0], mStrings.size());
+	}
+	footer.version = ESSBIN_VERSION;
+	memcpy(footer.magic, ESSBIN_MAGIC, sizeof(footer.magic));
+	Write(&footer, sizeof(footer));
+
+	bool ok = mBuffer.Detach();
+	ok = mFile.Close() && ok;
+	const std::string partial = mFilename + ESSBIN_PARTIAL_SUFFIX;
+	ok = ok && replace_file(partial.c_str(), mFilename.c_str());
+	if (!ok)
+	{
+		remove(partial.c_str());
+	}
+	if (mCodec != ESSBIN_CODEC_RAW && mStoredBytes > 0)
+	{
+		ess_log(mLogCallback, EH_INFO, "essbin total: %llu -> %llu bytes, ratio %.2f\n",
+			mRawBytes, mStoredBytes, (double)mRawBytes / (double)mStoredBytes);
+	}
+	mEntries.clear();
+	mStrings.clear();
+	mBlocks.clear();
+	return ok;
+}
@@ -0,0 +1,155 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "essbounds.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+#define ESS_BOUNDS_PI 3.14159265358979f
+
+static inline float AxisDistance(float p, float lo, float hi)
+{
+	return (p < lo) ? lo - p : ((p > hi) ? p - hi : 0.0f);
+}
+
+EssSceneBounds::EssSceneBounds() :
+	mEnabled(false)
+{
+}
+
+void EssSceneBounds::Reset(bool enabled)
+{
+	mEnabled = enabled;
+	mCameras.clear();
+	mMeshes.clear();
+}
+
+void EssSceneBounds::AddCamera(const EH_Camera& cam, bool panorama, int panoramaSize, bool leftHanded)
+{
+	if (!mEnabled)
+	{
+		return;
+	}
+	// the same transform and film as AddCameraData writes
+	Camera camera;
+	camera.position = ei_vector(cam.view_to_world[12], cam.view_to_world[13], cam.view_to_world[14] * (leftHanded ? -1.0f : 1.0f));
+	if (cam.spherical_render)
+	{
+		camera.pixel_size = 2.0f * ESS_BOUNDS_PI / (float)(panorama ? panoramaSize * 6 : cam.image_width);
+	}
+	else if (cam.cubemap_render || panorama)
+	{
+		// 90 degree faces
+		camera.pixel_size = 2.0f / (float)(panorama ? panoramaSize : cam.image_width / 6);
+	}
+	else
+	{
+		const float aspect = (cam.aspect <= 0.0f) ? (float)cam.image_width / (float)cam.image_height : cam.aspect;
+		camera.pixel_size = tanf(cam.fov / 2.0f) * 2.0f * aspect / (float)cam.image_width;
+	}
+	if (!(camera.pixel_size > 0.0f) || !_finite(camera.pixel_size))
+	{
+		camera.pixel_size = 0.0f;
+	}
+	mCameras.push_back(camera);
+}
+
+void EssSceneBounds::AddMesh(const std::string& name, const EH_Mesh& mesh)
+{
+	if (!mEnabled || mesh.num_verts == 0 || mesh.verts == NULL)
+	{
+		return;
+	}
+	Box& box = mMeshes[name];
+	box.lo = ei_vector(FLT_MAX, FLT_MAX, FLT_MAX);
+	box.hi = ei_vector(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (uint_t i = 0; i < mesh.num_verts; ++i)
+	{
+		const EH_Vec& v = mesh.verts[i];
+		box.lo = ei_vector(std::min(box.lo.x, v[0]), std::min(box.lo.y, v[1]), std::min(box.lo.z, v[2]));
+		box.hi = ei_vector(std::max(box.hi.x, v[0]), std::max(box.hi.y, v[1]), std::max(box.hi.z, v[2]));
+	}
+}
+
+const EssSceneBounds::Box* EssSceneBounds::FindMesh(const std::string& name) const
+{
+	std::map<std::string, Box>::const_iterator iter = mMeshes.find(name);
+	return (iter != mMeshes.end()) ? &iter->second : NULL;
+}
+
+bool EssSceneBounds::GetWorldBounds(const std::string& meshName, const eiMatrix& transform, Box& bounds) const
+{
+	const Box* mesh = FindMesh(meshName);
+	if (mesh == NULL)
+	{
+		return false;
+	}
+	bounds.lo = ei_vector(FLT_MAX, FLT_MAX, FLT_MAX);
+	bounds.hi = ei_vector(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int c = 0; c < 8; ++c)
+	{
+		const eiVector corner = ei_vector(
+			(c & 1) ? mesh->hi.x : mesh->lo.x,
+			(c & 2) ? mesh->hi.y : mesh->lo.y,
+			(c & 4) ? mesh->hi.z : mesh->lo.z);
+		const eiVector p = TransformPoint(corner, transform);
+		bounds.lo = ei_vector(std::min(bounds.lo.x, p.x), std::min(bounds.lo.y, p.y), std::min(bounds.lo.z, p.z));
+		bounds.hi = ei_vector(std::max(bounds.hi.x, p.x), std::max(bounds.hi.y, p.y), std::max(bounds.hi.z, p.z));
+	}
+	return _finite(bounds.lo.x) && _finite(bounds.lo.y) && _finite(bounds.lo.z) &&
+		_finite(bounds.hi.x) && _finite(bounds.hi.y) && _finite(bounds.hi.z);
+}
+
+float EssSceneBounds::GetPixelSize(const Box& bounds) const
+{
+	// the largest a pixel gets on the box is at its nearest point
+	float pixelSize = FLT_MAX;
+	for (size_t k = 0; k < mCameras.size(); ++k)
+	{
+		if (mCameras[k].pixel_size > 0.0f)
+		{
+			pixelSize = std::min(pixelSize, Distance(mCameras[k].position, bounds) * mCameras[k].pixel_size);
+		}
+	}
+	return pixelSize;
+}
+
+eiVector EssSceneBounds::TransformPoint(const eiVector& p, const eiMatrix& m)
+{
+	return ei_vector(
+		p.x * m.m[0][0] + p.y * m.m[1][0] + p.z * m.m[2][0] + m.m[3][0],
+		p.x * m.m[0][1] + p.y * m.m[1][1] + p.z * m.m[2][1] + m.m[3][1],
+		p.x * m.m[0][2] + p.y * m.m[1][2] + p.z * m.m[2][2] + m.m[3][2]);
+}
+
+float EssSceneBounds::Distance(const eiVector& p, const Box& box)
+{
+	const float dx = AxisDistance(p.x, box.lo.x, box.hi.x);
+	const float dy = AxisDistance(p.y, box.lo.y, box.hi.y);
+	const float dz = AxisDistance(p.z, box.lo.z, box.hi.z);
+	return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+float EssSceneBounds::GetScale(const eiMatrix& m)
+{
+	const float det =
+		m.m[0][0] * (m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1]) -
+		m.m[0][1] * (m.m[1][0] * m.m[2][2] - m.m[1][2] * m.m[2][0]) +
+		m.m[0][2] * (m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0]);
+	return cbrtf(fabsf(det));
+}
@@ -0,0 +1,252 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#include "esscache.h"
+#include "esshash.h"
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#define ESS_MANIFEST_VERSION 1
+
+static bool get_file_size(const std::string& filename, unsigned long long& size)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+	{
+		return false;
+	}
+	size = (unsigned long long)st.st_size;
+	return true;
+}
+
+static void split_fields(const std::string& line, std::vector<std::string>& fields)
+{
+	fields.clear();
+	size_t start = 0;
+	for (;;)
+	{
+		size_t end = line.find('\t', start);
+		if (end == std::string::npos)
+		{
+			fields.push_back(line.substr(start));
+			return;
+		}
+		fields.push_back(line.substr(start, end - start));
+		start = end + 1;
+	}
+}
+
+static std::string node_key(const std::string& kind, const std::string& name)
+{
+	return kind + '\t' + name;
+}
+
+EssExportCache::EssExportCache() :
+	mReusedNodes(0),
+	mGeneratedNodes(0),
+	mReusedBytes(0),
+	mGeneratedBytes(0)
+{
+}
+
+void EssExportCache::Load(const std::string& base)
+{
+	mBase = base;
+	size_t slashPos = base.find_last_of("/\\");
+	mDirectory = (slashPos == std::string::npos) ? std::string() : base.substr(0, slashPos + 1);
+	mPrevNodes.clear();
+	mPrevShards.clear();
+	mNodes.clear();
+	mShards.clear();
+	mReusedNodes = 0;
+	mGeneratedNodes = 0;
+	mReusedBytes = 0;
+	mGeneratedBytes = 0;
+
+	std::ifstream manifest((base + ".essmanifest").c_str());
+	if (!manifest)
+	{
+		return;
+	}
+	std::ifstream cacheFile((base + ".esscache").c_str(), std::ios::binary);
+	std::vector<char> cache((std::istreambuf_iterator<char>(cacheFile)), std::istreambuf_iterator<char>());
+
+	std::string line;
+	std::vector<std::string> fields;
+	bool versionOk = false;
+	while (std::getline(manifest, line))
+	{
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+		split_fields(line, fields);
+		if (fields[0] == "version" && fields.size() == 2)
+		{
+			versionOk = atoi(fields[1].c_str()) == ESS_MANIFEST_VERSION;
+		}
+		else if (!versionOk)
+		{
+			// written by another version, regenerate everything
+			break;
+		}
+		else if (fields[0] == "shard" && fields.size() == 5)
+		{
+			Shard shard;
+			shard.hash = strtoull(fields[1].c_str(), NULL, 16);
+			shard.size = strtoull(fields[2].c_str(), NULL, 10);
+			shard.num_meshes = (unsigned int)atoi(fields[3].c_str());
+			shard.filename = fields[4];
+			shard.reused = false;
+			mPrevShards[shard.hash] = shard;
+		}
+		else if (fields[0] == "node" && fields.size() == 8)
+		{
+			Node node;
+			node.kind = fields[1];
+			node.hash = strtoull(fields[2].c_str(), NULL, 16);
+			unsigned long long offset = strtoull(fields[3].c_str(), NULL, 10);
+			unsigned long long size = strtoull(fields[4].c_str(), NULL, 10);
+			node.flag = fields[5] == "1";
+			node.name = fields[6];
+			node.result = fields[7];
+			if (offset + size > cache.size())
+			{
+				continue;
+			}
+			node.bytes.assign(cache.begin() + (size_t)offset, cache.begin() + (size_t)(offset + size));
+			mPrevNodes[node_key(node.kind, node.name)] = node;
+		}
+	}
+}
+
+const EssExportCache::Node* EssExportCache::FindNode(const std::string& kind, const std::string& name, unsigned long long hash) const
+{
+	std::map<std::string, Node>::const_iterator iter = mPrevNodes.find(node_key(kind, name));
+	if (iter == mPrevNodes.end() || iter->second.hash != hash)
+	{
+		return NULL;
+	}
+	return &iter->second;
+}
+
+void EssExportCache::AddNode(const Node& node, bool reused)
+{
+	mNodes.push_back(node);
+	if (reused)
+	{
+		++ mReusedNodes;
+		mReusedBytes += node.bytes.size();
+	}
+	else
+	{
+		++ mGeneratedNodes;
+		mGeneratedBytes += node.bytes.size();
+	}
+}
+
+bool EssExportCache::FindShard(unsigned long long hash, const std::string& filename) const
+{
+	std::map<unsigned long long, Shard>::const_iterator iter = mPrevShards.find(hash);
+	if (iter == mPrevShards.end() || iter->second.filename != filename)
+	{
+		return false;
+	}
+	unsigned long long size = 0;
+	return get_file_size(mDirectory + filename, size) && size == iter->second.size;
+}
+
+void EssExportCache::AddShard(unsigned long long hash, const std::string& filename, unsigned int numMeshes, bool reused)
+{
+	Shard shard;
+	shard.hash = hash;
+	shard.size = 0;
+	shard.num_meshes = numMeshes;
+	shard.filename = filename;
+	shard.reused = reused;
+	std::lock_guard<std::mutex> lock(mShardMutex);
+	mShards.push_back(shard);
+}
+
+bool EssExportCache::Save()
+{
+	if (mBase.empty())
+	{
+		return false;
+	}
+
+	std::map<unsigned long long, bool> usedShards;
+	for (size_t i = 0; i < mShards.size(); ++i)
+	{
+		Shard& shard = mShards[i];
+		get_file_size(mDirectory + shard.filename, shard.size);
+		usedShards[shard.hash] = true;
+		if (shard.reused)
+		{
+			mReusedNodes += shard.num_meshes;
+			mReusedBytes += shard.size;
+		}
+		else
+		{
+			mGeneratedNodes += shard.num_meshes;
+			mGeneratedBytes += shard.size;
+		}
+	}
+	for (std::map<unsigned long long, Shard>::const_iterator iter = mPrevShards.begin(); iter != mPrevShards.end(); ++iter)
+	{
+		if (usedShards.find(iter->first) == usedShards.end())
+		{
+			remove((mDirectory + iter->second.filename).c_str());
+		}
+	}
+
+	std::ofstream cacheFile((mBase + ".esscache").c_str(), std::ios::binary | std::ios::trunc);
+	std::ofstream manifest((mBase + ".essmanifest").c_str(), std::ios::trunc);
+	if (!cacheFile || !manifest)
+	{
+		return false;
+	}
+	manifest << "# ESS export manifest\n";
+	manifest << "version\t" << ESS_MANIFEST_VERSION << '\n';
+	for (size_t i = 0; i < mShards.size(); ++i)
+	{
+		const Shard& shard = mShards[i];
+		manifest << "shard\t" << ess_hash_to_string(shard.hash) << '\t' << shard.size << '\t'
+			<< shard.num_meshes << '\t' << shard.filename << '\n';
+	}
+	unsigned long long offset = 0;
+	for (size_t i = 0; i < mNodes.size(); ++i)
+	{
+		const Node& node = mNodes[i];
+		if (!node.bytes.empty())
+		{
+			cacheFile.write(&node.bytes[0], node.bytes.size());
+		}
+		manifest << "node\t" << node.kind << '\t' << ess_hash_to_string(node.hash) << '\t'
+			<< offset << '\t' << node.bytes.size() << '\t' << (node.flag ? 1 : 0) << '\t'
+			<< node.name << '\t' << node.result << '\n';
+		offset += node.bytes.size();
+	}
+	return cacheFile.good() && manifest.good();
+}
+
+void EssExportCache::PrintReport(EH_LogCallback callback) const
+{
+	ess_log(callback, EH_INFO, "Incremental export: reused %u nodes (%llu bytes), regenerated %u nodes (%llu bytes)\n",
+		mReusedNodes, mReusedBytes, mGeneratedNodes, mGeneratedBytes);
+}
@@ -0,0 +1,514 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#include "essdedup.h"
+#include "esshash.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+
+/* Eigenvalues closer than this, relative to the largest one, leave
+ * the principal axes undefined, e.g. for spheres and cylinders */
+#define ESS_DEDUP_EIGEN_GAP 1e-4
+/* Vertex tolerance of a rigid match, relative to the mesh radius */
+#define ESS_DEDUP_TOLERANCE 1e-4
+/* Vertex tolerance for the position of the mesh in the world */
+#define ESS_DEDUP_POSITION_TOLERANCE 1e-6
+#define ESS_DEDUP_NORMAL_TOLERANCE 1e-3
+/* Variances of a rigid match, relative to the largest one */
+#define ESS_DEDUP_EIGEN_TOLERANCE 1e-3
+/* memory for copies of match candidates */
+#define ESS_DEDUP_MAX_CANDIDATE_BYTES (256ull * 1024 * 1024)
+
+static unsigned long long HashTopology(const EH_Mesh& mesh)
+{
+	EssHash hash;
+	hash.UpdateValue(mesh.num_verts);
+	hash.UpdateValue(mesh.num_faces);
+	const bool hasArrays[] = { mesh.normals != NULL, mesh.uvs != NULL, mesh.n_indices != NULL, mesh.uv_indices != NULL, mesh.mtl_indices != NULL };
+	hash.Update(hasArrays, sizeof(hasArrays));
+	hash.Update(mesh.face_indices, mesh.num_faces * 3 * sizeof(uint_t));
+	if (mesh.uvs) hash.Update(mesh.uvs, mesh.num_verts * sizeof(EH_Vec2));
+	if (mesh.n_indices) hash.Update(mesh.n_indices, mesh.num_faces * 3 * sizeof(uint_t));
+	if (mesh.uv_indices) hash.Update(mesh.uv_indices, mesh.num_faces * 3 * sizeof(uint_t));
+	if (mesh.mtl_indices) hash.Update(mesh.mtl_indices, mesh.num_faces * sizeof(uint_t));
+	return hash.Digest();
+}
+
+/** Does the copy hold the count items of data? A missing array matches an empty copy. */
+template <typename T>
+static bool SameArray(const std::vector<T>& copy, const T* data, size_t count)
+{
+	if (data == NULL || count == 0)
+	{
+		return copy.empty();
+	}
+	return copy.size() == count && memcmp(&copy[0], data, count * sizeof(T)) == 0;
+}
+
+template <typename T>
+static void CopyArray(std::vector<T>& copy, const T* data, size_t count)
+{
+	if (data != NULL && count > 0)
+	{
+		copy.assign(data, data + count);
+	}
+}
+
+template <typename T>
+static size_t ArrayBytes(const std::vector<T>& copy)
+{
+	return copy.size() * sizeof(T);
+}
+
+template <typename T>
+static void FreeArray(std::vector<T>& copy)
+{
+	std::vector<T>().swap(copy);
+}
+
+/** Eigen decomposition of a symmetric 3x3 matrix by Jacobi rotations,
+ * the eigenvectors are returned in the rows of v.
+ */
+static void EigenSymmetric3(double a[3][3], double eigen[3], double v[3][3])
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			v[i][j] = (i == j) ? 1.0 : 0.0;
+		}
+	}
+	for (int sweep = 0; sweep < 32; ++sweep)
+	{
+		const double off = fabs(a[0][1]) + fabs(a[0][2]) + fabs(a[1][2]);
+		if (off < 1e-30)
+		{
+			break;
+		}
+		for (int p = 0; p < 2; ++p)
+		{
+			for (int q = p + 1; q < 3; ++q)
+			{
+				if (fabs(a[p][q]) < 1e-300)
+				{
+					continue;
+				}
+				const double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+				const double t = (theta >= 0.0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+				const double c = 1.0 / sqrt(t * t + 1.0);
+				const double s = t * c;
+				for (int k = 0; k < 3; ++k)
+				{
+					const double akp = a[k][p];
+					const double akq = a[k][q];
+					a[k][p] = c * akp - s * akq;
+					a[k][q] = s * akp + c * akq;
+				}
+				for (int k = 0; k < 3; ++k)
+				{
+					const double apk = a[p][k];
+					const double aqk = a[q][k];
+					a[p][k] = c * apk - s * aqk;
+					a[q][k] = s * apk + c * aqk;
+				}
+				for (int k = 0; k < 3; ++k)
+				{
+					const double vpk = v[p][k];
+					const double vqk = v[q][k];
+					v[p][k] = c * vpk - s * vqk;
+					v[q][k] = s * vpk + c * vqk;
+				}
+			}
+		}
+	}
+	for (int i = 0; i < 3; ++i)
+	{
+		eigen[i] = a[i][i];
+	}
+}
+
+/** Centroid and principal axes of the vertices, sorted by decreasing
+ * variance and right-handed. Returns false when the axes are ambiguous.
+ */
+static bool ComputeFrame(const float* verts, uint_t numVerts, double center[3], double axes[3][3], double eigen[3])
+{
+	center[0] = center[1] = center[2] = 0.0;
+	for (uint_t i = 0; i < numVerts; ++i)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			center[k] += verts[i * 3 + k];
+		}
+	}
+	if (numVerts < 3)
+	{
+		return false;
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		center[k] /= numVerts;
+	}
+
+	double cov[3][3];
+	memset(cov, 0, sizeof(cov));
+	for (uint_t i = 0; i < numVerts; ++i)
+	{
+		const double d[3] = { verts[i * 3] - center[0], verts[i * 3 + 1] - center[1], verts[i * 3 + 2] - center[2] };
+		for (int j = 0; j < 3; ++j)
+		{
+			for (int k = j; k < 3; ++k)
+			{
+				cov[j][k] += d[j] * d[k];
+			}
+		}
+	}
+	for (int j = 0; j < 3; ++j)
+	{
+		for (int k = j; k < 3; ++k)
+		{
+			cov[j][k] /= numVerts;
+			cov[k][j] = cov[j][k];
+		}
+	}
+
+	double v[3][3];
+	double values[3];
+	EigenSymmetric3(cov, values, v);
+	int order[3] = { 0, 1, 2 };
+	for (int i = 0; i < 2; ++i)
+	{
+		for (int j = i + 1; j < 3; ++j)
+		{
+			if (values[order[j]] > values[order[i]])
+			{
+				const int tmp = order[i];
+				order[i] = order[j];
+				order[j] = tmp;
+			}
+		}
+	}
+	for (int i = 0; i < 3; ++i)
+	{
+		eigen[i] = values[order[i]];
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		axes[0][k] = v[order[0]][k];
+		axes[1][k] = v[order[1]][k];
+	}
+	axes[2][0] = axes[0][1] * axes[1][2] - axes[0][2] * axes[1][1];
+	axes[2][1] = axes[0][2] * axes[1][0] - axes[0][0] * axes[1][2];
+	axes[2][2] = axes[0][0] * axes[1][1] - axes[0][1] * axes[1][0];
+
+	const double gap = ESS_DEDUP_EIGEN_GAP * eigen[0];
+	return eigen[0] > 0.0 && (eigen[0] - eigen[1]) > gap && (eigen[1] - eigen[2]) > gap;
+}
+
+EssMeshDedup::EssMeshDedup()
+{
+	Reset(EH_DEDUP_NONE);
+}
+
+void EssMeshDedup::Reset(EH_MeshDedup mode)
+{
+	mMode = mode;
+	mEntries.clear();
+	mBuckets.clear();
+	mMatches.clear();
+	mCandidates.clear();
+	mCandidateBytes = 0;
+	mNumDropped = 0;
+	mNumMeshes = 0;
+	mNumExact = 0;
+	mNumRigid = 0;
+	mSavedVerts = 0;
+	mSavedFaces = 0;
+}
+
+bool EssMeshDedup::MatchTopology(const Entry& entry, const EH_Mesh& mesh) const
+{
+	// the sizes of the vertex arrays too, MatchRigid reads them
+	const size_t vertsSize = mesh.num_verts * 3;
+	const size_t numIndices = mesh.num_faces * 3;
+	return entry.verts.size() == vertsSize &&
+		entry.normals.size() == (mesh.normals ? vertsSize : 0) &&
+		SameArray(entry.uvs, (const float*)mesh.uvs, mesh.num_verts * 2) &&
+		SameArray(entry.face_indices, mesh.face_indices, numIndices) &&
+		SameArray(entry.n_indices, mesh.n_indices, numIndices) &&
+		SameArray(entry.uv_indices, mesh.uv_indices, numIndices) &&
+		SameArray(entry.mtl_indices, mesh.mtl_indices, mesh.num_faces);
+}
+
+bool EssMeshDedup::MatchRigid(const Entry& entry, const EH_Mesh& mesh, const double center[3], const double axes[3][3], Match& match) const
+{
+	double radius = 0.0;
+	for (size_t i = 0; i < entry.verts.size(); i += 3)
+	{
+		const double d[3] = { entry.verts[i] - entry.center[0], entry.verts[i + 1] - entry.center[1], entry.verts[i + 2] - entry.center[2] };
+		radius = std::max(radius, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	}
+	radius = sqrt(radius);
+	const double offset = sqrt(center[0] * center[0] + center[1] * center[1] + center[2] * center[2]);
+	const double tolerance = ESS_DEDUP_TOLERANCE * radius + ESS_DEDUP_POSITION_TOLERANCE * offset;
+
+	// the sign of each axis is arbitrary, try the 4 proper rotations
+	const float* verts = (const float*)mesh.verts;
+	const float* normals = (const float*)mesh.normals;
+	for (int flip = 0; flip < 4; ++flip)
+	{
+		const double sign[3] = { (flip & 1) ? -1.0 : 1.0, (flip & 2) ? -1.0 : 1.0, ((flip == 1) || (flip == 2)) ? -1.0 : 1.0 };
+		// v = M * v_entry + t
+		double M[3][3];
+		for (int j = 0; j < 3; ++j)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				M[j][k] = 0.0;
+				for (int i = 0; i < 3; ++i)
+				{
+					M[j][k] += sign[i] * axes[i][j] * entry.axes[i][k];
+				}
+			}
+		}
+		double t[3];
+		for (int j = 0; j < 3; ++j)
+		{
+			t[j] = center[j] - (M[j][0] * entry.center[0] + M[j][1] * entry.center[1] + M[j][2] * entry.center[2]);
+		}
+
+		bool matched = true;
+		for (uint_t i = 0; i < mesh.num_verts && matched; ++i)
+		{
+			const float* a = &entry.verts[i * 3];
+			for (int j = 0; j < 3; ++j)
+			{
+				const double p = M[j][0] * a[0] + M[j][1] * a[1] + M[j][2] * a[2] + t[j];
+				if (fabs(p - verts[i * 3 + j]) > tolerance)
+				{
+					matched = false;
+					break;
+				}
+			}
+		}
+		for (uint_t i = 0; normals != NULL && i < mesh.num_verts && matched; ++i)
+		{
+			const float* a = &entry.normals[i * 3];
+			for (int j = 0; j < 3; ++j)
+			{
+				const double n = M[j][0] * a[0] + M[j][1] * a[1] + M[j][2] * a[2];
+				if (fabs(n - normals[i * 3 + j]) > ESS_DEDUP_NORMAL_TOLERANCE)
+				{
+					matched = false;
+					break;
+				}
+			}
+		}
+		if (matched)
+		{
+			// row vectors, the translation goes to the last row
+			match.mesh_name = entry.name;
+			match.has_transform = true;
+			match.transform = ei_matrix(
+				(float)M[0][0], (float)M[1][0], (float)M[2][0], 0.0f,
+				(float)M[0][1], (float)M[1][1], (float)M[2][1], 0.0f,
+				(float)M[0][2], (float)M[1][2], (float)M[2][2], 0.0f,
+				(float)t[0], (float)t[1], (float)t[2], 1.0f);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool EssMeshDedup::Add(const EH_Mesh& mesh, const std::string& name)
+{
+	if (mMode == EH_DEDUP_NONE || mesh.num_verts == 0 || mesh.verts == NULL || mesh.face_indices == NULL)
+	{
+		return false;
+	}
+	++ mNumMeshes;
+
+	const unsigned long long topology = HashTopology(mesh);
+	std::vector<size_t>& bucket = mBuckets[topology];
+	const size_t vertsSize = mesh.num_verts * 3;
+	const float* verts = (const float*)mesh.verts;
+	const float* normals = (const float*)mesh.normals;
+
+	EssHash hash;
+	hash.Update(verts, vertsSize * sizeof(float));
+	if (normals)
+	{
+		hash.Update(normals, vertsSize * sizeof(float));
+	}
+	const unsigned long long content = hash.Digest();
+
+	for (size_t i = 0; i < bucket.size(); ++i)
+	{
+		const Entry& entry = mEntries[bucket[i]];
+		// equal hashes only make it a candidate
+		if (entry.content == content && MatchTopology(entry, mesh) &&
+			SameArray(entry.verts, verts, vertsSize) && SameArray(entry.normals, normals, vertsSize))
+		{
+			Match& match = mMatches[name];
+			match.mesh_name = entry.name;
+			match.has_transform = false;
+			++ mNumExact;
+			mSavedVerts += mesh.num_verts;
+			mSavedFaces += mesh.num_faces;
+			return true;
+		}
+	}
+
+	Entry entry;
+	entry.name = name;
+	entry.content = content;
+	entry.has_frame = ComputeFrame(verts, mesh.num_verts, entry.center, entry.axes, entry.eigen);
+	if (mMode == EH_DEDUP_RIGID && entry.has_frame)
+	{
+		for (size_t i = 0; i < bucket.size(); ++i)
+		{
+			const Entry& other = mEntries[bucket[i]];
+			// variances are invariant under rotation, a cheap reject
+			if (!other.has_frame || !MatchTopology(other, mesh) ||
+				fabs(other.eigen[0] - entry.eigen[0]) > ESS_DEDUP_EIGEN_TOLERANCE * entry.eigen[0] ||
+				fabs(other.eigen[1] - entry.eigen[1]) > ESS_DEDUP_EIGEN_TOLERANCE * entry.eigen[0] ||
+				fabs(other.eigen[2] - entry.eigen[2]) > ESS_DEDUP_EIGEN_TOLERANCE * entry.eigen[0])
+			{
+				continue;
+			}
+			Match match;
+			if (MatchRigid(other, mesh, entry.center, entry.axes, match))
+			{
+				mMatches[name] = match;
+				++ mNumRigid;
+				mSavedVerts += mesh.num_verts;
+				mSavedFaces += mesh.num_faces;
+				return true;
+			}
+		}
+	}
+
+	bucket.push_back(mEntries.size());
+	mEntries.push_back(entry);
+	Entry& candidate = mEntries.back();
+	const size_t numIndices = mesh.num_faces * 3;
+	CopyArray(candidate.verts, verts, vertsSize);
+	CopyArray(candidate.normals, normals, vertsSize);
+	CopyArray(candidate.uvs, (const float*)mesh.uvs, mesh.num_verts * 2);
+	CopyArray(candidate.face_indices, (const uint_t*)mesh.face_indices, numIndices);
+	CopyArray(candidate.n_indices, (const uint_t*)mesh.n_indices, numIndices);
+	CopyArray(candidate.uv_indices, (const uint_t*)mesh.uv_indices, numIndices);
+	CopyArray(candidate.mtl_indices, (const uint_t*)mesh.mtl_indices, (size_t)mesh.num_faces);
+	mCandidateBytes += GetCopyBytes(candidate);
+	mCandidates.push_back(mEntries.size() - 1);
+	// repeated parts tend to be added close together, drop the oldest
+	while (mCandidateBytes > ESS_DEDUP_MAX_CANDIDATE_BYTES && mCandidates.size() > 1)
+	{
+		Entry& oldest = mEntries[mCandidates.front()];
+		mCandidates.pop_front();
+		mCandidateBytes -= GetCopyBytes(oldest);
+		FreeArray(oldest.verts);
+		FreeArray(oldest.normals);
+		FreeArray(oldest.uvs);
+		FreeArray(oldest.face_indices);
+		FreeArray(oldest.n_indices);
+		FreeArray(oldest.uv_indices);
+		FreeArray(oldest.mtl_indices);
+		++ mNumDropped;
+	}
+	return false;
+}
+
+size_t EssMeshDedup::GetCopyBytes(const Entry& entry)
+{
+	return ArrayBytes(entry.verts) + ArrayBytes(entry.normals) + ArrayBytes(entry.uvs) +
+		ArrayBytes(entry.face_indices) + ArrayBytes(entry.n_indices) + ArrayBytes(entry.uv_indices) + ArrayBytes(entry.mtl_indices);
+}
+
+const EssMeshDedup::Match* EssMeshDedup::Find(const std::string& name) const
+{
+	std::map<std::string, Match>::const_iterator iter = mMatches.find(name);
+	return (iter == mMatches.end()) ? NULL : &iter->second;
+}
+
+void EssMeshDedup::PrintReport(EH_LogCallback callback) const
+{
+	if (mMode == EH_DEDUP_NONE)
+	{
+		return;
+	}
+	ess_log(callback, EH_INFO, "Deduplicated %u of %u meshes (%u exact, %u rigid), saved %llu vertices and %llu triangles\n",
+		mNumExact + mNumRigid, mNumMeshes, mNumExact, mNumRigid, mSavedVerts, mSavedFaces);
+	if (mNumDropped > 0)
+	{
+		ess_log(callback, EH_INFO, "%u meshes were dropped as match candidates to bound memory\n", mNumDropped);
+	}
+}
+
+EssMaterialDedup::EssMaterialDedup() :
+	mEnabled(false),
+	mNumMaterials(0)
+{
+}
+
+void EssMaterialDedup::Reset(bool enabled)
+{
+	mEnabled = enabled;
+	mMaterials.clear();
+	mMatches.clear();
+	mReferenced.clear();
+	mTopologies.clear();
+	mNumMaterials = 0;
+}
+
+bool EssMaterialDedup::Add(const std::string& name, unsigned long long hash, unsigned int topology)
+{
+	++ mNumMaterials;
+	if (mEnabled && mReferenced.find(name) == mReferenced.end() && mMatches.find(name) == mMatches.end())
+	{
+		std::map<unsigned long long, std::string>::const_iterator iter = mMaterials.find(hash);
+		if (iter != mMaterials.end() && iter->second != name)
+		{
+			mMatches[name] = iter->second;
+			return true;
+		}
+		mMaterials[hash] = name;
+	}
+	mTopologies.insert(topology);
+	return false;
+}
+
+const std::string& EssMaterialDedup::Find(const std::string& name)
+{
+	std::map<std::string, std::string>::const_iterator iter = mMatches.find(name);
+	if (iter != mMatches.end())
+	{
+		return iter->second;
+	}
+	mReferenced.insert(name);
+	return name;
+}
+
+void EssMaterialDedup::PrintReport(EH_LogCallback callback) const
+{
+	if (mNumMaterials == 0)
+	{
+		return;
+	}
+	ess_log(callback, EH_INFO, "Wrote %u of %u materials, %u shader group topologies\n",
+		mNumMaterials - (unsigned int)mMatches.size(), mNumMaterials, (unsigned int)mTopologies.size());
+}
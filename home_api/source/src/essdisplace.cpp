@@ -0,0 +1,182 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "essdisplace.h"
+#include <algorithm>
+#include <queue>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+
+/* The most the global approximation subdivides */
+#define ESS_DISPLACE_MAX_SUBDIV 7
+
+EssDisplaceBudget::EssDisplaceBudget() :
+	mEnabled(false),
+	mEdgeLength(1.0f),
+	mBudget(0),
+	mNeededTriangles(0.0),
+	mPlannedTriangles(0.0)
+{
+}
+
+void EssDisplaceBudget::Reset(bool enabled, float edgeLength, unsigned long long budget)
+{
+	mEnabled = enabled;
+	mEdgeLength = (edgeLength > 0.0f) ? edgeLength : 1.0f;
+	mBudget = budget;
+	mMeshes.clear();
+	mMaterials.clear();
+	mInstances.clear();
+	mNeededTriangles = 0.0;
+	mPlannedTriangles = 0.0;
+}
+
+void EssDisplaceBudget::AddMesh(const std::string& name, const EH_Mesh& mesh)
+{
+	if (!mEnabled || mesh.num_verts == 0 || mesh.verts == NULL || mesh.face_indices == NULL)
+	{
+		return;
+	}
+	Mesh& info = mMeshes[name];
+	info.area = 0.0;
+	info.triangles = 0.0;
+	for (uint_t f = 0; f < mesh.num_faces; ++f)
+	{
+		const uint_t* tri = mesh.face_indices + f * 3;
+		if (tri[0] >= mesh.num_verts || tri[1] >= mesh.num_verts || tri[2] >= mesh.num_verts)
+		{
+			continue;
+		}
+		const EH_Vec& p0 = mesh.verts[tri[0]];
+		const EH_Vec& p1 = mesh.verts[tri[1]];
+		const EH_Vec& p2 = mesh.verts[tri[2]];
+		const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		const double cx = e1[1] * e2[2] - e1[2] * e2[1];
+		const double cy = e1[2] * e2[0] - e1[0] * e2[2];
+		const double cz = e1[0] * e2[1] - e1[1] * e2[0];
+		info.area += 0.5 * sqrt(cx * cx + cy * cy + cz * cz);
+		info.triangles += 1.0;
+	}
+}
+
+bool EssDisplaceBudget::AddInstance(const std::string& name, const std::string& meshName, const eiMatrix& meshToWorld,
+	const std::string& element, const eiMatrix& transform, const std::vector<std::string>& materials,
+	const EssSceneBounds& bounds)
+{
+	if (!mEnabled)
+	{
+		return false;
+	}
+	bool displaced = false;
+	for (size_t i = 0; i < materials.size() && !displaced; ++i)
+	{
+		displaced = mMaterials.find(materials[i]) != mMaterials.end();
+	}
+	std::map<std::string, Mesh>::const_iterator mesh = mMeshes.find(meshName);
+	EssSceneBounds::Box world;
+	if (!displaced || mesh == mMeshes.end() || !(mesh->second.triangles > 0.0) ||
+		!bounds.GetWorldBounds(meshName, meshToWorld, world))
+	{
+		return false;
+	}
+	// planned only when a camera has a known pixel size
+	const float pixelSize = bounds.GetPixelSize(world);
+	if (pixelSize == FLT_MAX)
+	{
+		return false;
+	}
+	const double scale = EssSceneBounds::GetScale(meshToWorld);
+
+	Instance instance;
+	instance.name = name;
+	instance.element = element;
+	instance.materials = materials;
+	instance.transform = transform;
+	instance.triangles = mesh->second.triangles;
+	// the mean edge of equilateral triangles of the same area
+	const double edge = sqrt(4.0 * mesh->second.area / (sqrt(3.0) * mesh->second.triangles)) * scale;
+	instance.pixel_edge = (pixelSize > 0.0) ? edge / pixelSize : DBL_MAX;
+	instance.level = ESS_DISPLACE_MAX_SUBDIV;
+	if (instance.pixel_edge < DBL_MAX && _finite(instance.pixel_edge))
+	{
+		const double levels = ceil(log2(std::max(instance.pixel_edge / mEdgeLength, 1.0)));
+		instance.level = (unsigned int)std::min(levels, (double)ESS_DISPLACE_MAX_SUBDIV);
+	}
+	mInstances.push_back(instance);
+	return true;
+}
+
+std::vector<EssDisplaceBudget::Instance>& EssDisplaceBudget::Plan()
+{
+	mNeededTriangles = 0.0;
+	for (size_t i = 0; i < mInstances.size(); ++i)
+	{
+		mNeededTriangles += mInstances[i].triangles * pow(4.0, (double)mInstances[i].level);
+	}
+	mPlannedTriangles = mNeededTriangles;
+	if (mBudget == 0)
+	{
+		return mInstances;
+	}
+
+	// coarsen where the micro-triangles end up smallest on screen first
+	typedef std::pair<double, size_t> Candidate;
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > candidates;
+	for (size_t i = 0; i < mInstances.size(); ++i)
+	{
+		if (mInstances[i].level > 0)
+		{
+			candidates.push(Candidate(ldexp(mInstances[i].pixel_edge, 1 - (int)mInstances[i].level), i));
+		}
+	}
+	while (mPlannedTriangles > (double)mBudget && !candidates.empty())
+	{
+		const size_t index = candidates.top().second;
+		Instance& instance = mInstances[index];
+		candidates.pop();
+		const double triangles = instance.triangles * pow(4.0, (double)instance.level);
+		mPlannedTriangles -= triangles * 0.75;
+		-- instance.level;
+		if (instance.level > 0)
+		{
+			candidates.push(Candidate(ldexp(instance.pixel_edge, 1 - (int)instance.level), index));
+		}
+	}
+	return mInstances;
+}
+
+void EssDisplaceBudget::PrintReport(EH_LogCallback callback) const
+{
+	if (!mEnabled || mInstances.empty())
+	{
+		return;
+	}
+	unsigned int minLevel = ESS_DISPLACE_MAX_SUBDIV, maxLevel = 0;
+	for (size_t i = 0; i < mInstances.size(); ++i)
+	{
+		minLevel = std::min(minLevel, mInstances[i].level);
+		maxLevel = std::max(maxLevel, mInstances[i].level);
+	}
+	ess_log(callback, EH_INFO, "Displaced %u instances, subdivided %u to %u times by their estimated size on screen\n", (unsigned int)mInstances.size(), minLevel, maxLevel);
+	ess_log(callback, EH_INFO, "Estimated %.0f micro-triangles for %.2f pixel edges, from mesh bounds and mean triangle areas\n", mNeededTriangles, mEdgeLength);
+	if (mBudget > 0)
+	{
+		ess_log(callback, EH_INFO, "Estimated %.0f micro-triangles within the budget of %llu\n", mPlannedTriangles, mBudget);
+	}
+}
@@ -0,0 +1,160 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "essfootprint.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+/* Texels per pixel kept, for filtering and camera moves */
+#define ESS_FOOTPRINT_MARGIN 2.0f
+/* Textures aren't capped below this */
+#define ESS_FOOTPRINT_MIN_RESOLUTION 64
+
+void EssTextureFootprint::Reset()
+{
+	mUVDensities.clear();
+	mMaterials.clear();
+	mInstances.clear();
+}
+
+void EssTextureFootprint::AddMesh(const std::string& name, const EH_Mesh& mesh)
+{
+	// the ratio of the areas gives the mean UV density
+	mUVDensities.erase(name);
+	if (mesh.num_verts == 0 || mesh.verts == NULL || mesh.face_indices == NULL || mesh.uvs == NULL)
+	{
+		return;
+	}
+	const uint_t* uvIndices = mesh.uv_indices ? mesh.uv_indices : mesh.face_indices;
+	double area = 0.0, uvArea = 0.0;
+	for (uint_t f = 0; f < mesh.num_faces; ++f)
+	{
+		const uint_t* tri = mesh.face_indices + f * 3;
+		const uint_t* uvTri = uvIndices + f * 3;
+		if (tri[0] >= mesh.num_verts || tri[1] >= mesh.num_verts || tri[2] >= mesh.num_verts)
+		{
+			continue;
+		}
+		const EH_Vec& p0 = mesh.verts[tri[0]];
+		const EH_Vec& p1 = mesh.verts[tri[1]];
+		const EH_Vec& p2 = mesh.verts[tri[2]];
+		const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		const double cx = e1[1] * e2[2] - e1[2] * e2[1];
+		const double cy = e1[2] * e2[0] - e1[0] * e2[2];
+		const double cz = e1[0] * e2[1] - e1[1] * e2[0];
+		const EH_Vec2& t0 = mesh.uvs[uvTri[0]];
+		const EH_Vec2& t1 = mesh.uvs[uvTri[1]];
+		const EH_Vec2& t2 = mesh.uvs[uvTri[2]];
+		area += sqrt(cx * cx + cy * cy + cz * cz);
+		uvArea += fabs((double)(t1[0] - t0[0]) * (t2[1] - t0[1]) - (double)(t2[0] - t0[0]) * (t1[1] - t0[1]));
+	}
+	if (area > 0.0 && uvArea > 0.0)
+	{
+		mUVDensities[name] = (float)sqrt(uvArea / area);
+	}
+}
+
+void EssTextureFootprint::AddMaterial(const std::string& name, const EH_Material& mat, const std::string& rootPath)
+{
+	const EH_Texture* texs[] = { &mat.diffuse_tex, &mat.specular_tex, &mat.transp_tex, &mat.bump_tex,
+		&mat.refract_tex, &mat.emission_tex, &mat.displace_tex };
+	std::vector<Texture>& textures = mMaterials[name];
+	textures.clear();
+	for (size_t i = 0; i < sizeof(texs) / sizeof(texs[0]); ++i)
+	{
+		if (texs[i]->filename && strlen(texs[i]->filename) > 0)
+		{
+			Texture texture;
+			texture.source = rootPath + texs[i]->filename;
+			texture.repeat = std::max(fabsf(texs[i]->repeat_u), fabsf(texs[i]->repeat_v));
+			textures.push_back(texture);
+		}
+	}
+}
+
+void EssTextureFootprint::AddInstance(const EH_MeshInstance& inst)
+{
+	Instance instance;
+	instance.mesh_name = inst.mesh_name ? inst.mesh_name : "";
+	instance.transform = *((const eiMatrix*)inst.mesh_to_world);
+	for (uint_t i = 0; i < MAX_NUM_MTLS; ++i)
+	{
+		if (inst.mtl_names[i])
+		{
+			instance.materials.push_back(inst.mtl_names[i]);
+		}
+	}
+	mInstances.push_back(instance);
+}
+
+void EssTextureFootprint::GetResolutions(const EssSceneBounds& bounds, std::map<std::string, unsigned int>& resolutions) const
+{
+	// texels needed across each texture, FLT_MAX can't be capped
+	std::map<std::string, float> needed;
+	for (size_t i = 0; i < mInstances.size(); ++i)
+	{
+		const Instance& instance = mInstances[i];
+		float uvPerPixel = 0.0f;
+		std::map<std::string, float>::const_iterator density = mUVDensities.find(instance.mesh_name);
+		EssSceneBounds::Box world;
+		if (density != mUVDensities.end() && bounds.GetWorldBounds(instance.mesh_name, instance.transform, world))
+		{
+			// the smallest pixel footprint over all cameras
+			const float pixelSize = bounds.GetPixelSize(world);
+			const float scale = EssSceneBounds::GetScale(instance.transform);
+			if (pixelSize < FLT_MAX && scale > 0.0f && _finite(scale))
+			{
+				uvPerPixel = pixelSize * density->second / scale;
+			}
+		}
+
+		for (size_t j = 0; j < instance.materials.size(); ++j)
+		{
+			std::map<std::string, std::vector<Texture> >::const_iterator mat = mMaterials.find(instance.materials[j]);
+			if (mat == mMaterials.end())
+			{
+				continue;
+			}
+			for (size_t t = 0; t < mat->second.size(); ++t)
+			{
+				const Texture& texture = mat->second[t];
+				const float footprint = uvPerPixel * texture.repeat;
+				const float texels = (footprint > 0.0f) ? ESS_FOOTPRINT_MARGIN / footprint : FLT_MAX;
+				float& current = needed[texture.source];
+				current = std::max(current, texels);
+			}
+		}
+	}
+
+	resolutions.clear();
+	for (std::map<std::string, float>::const_iterator iter = needed.begin(); iter != needed.end(); ++iter)
+	{
+		unsigned int resolution = 0;
+		if (iter->second < (float)(1u << 30))
+		{
+			resolution = ESS_FOOTPRINT_MIN_RESOLUTION;
+			while ((float)resolution < iter->second)
+			{
+				resolution <<= 1;
+			}
+		}
+		resolutions[iter->first] = resolution;
+	}
+}
@@ -0,0 +1,428 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#include "essformat.h"
+#include <string.h>
+
+/** Shortest round-trip float to decimal conversion.
+ * reference:
+ * Ulf Adams, "Ryu: fast float-to-string conversion", PLDI 2018
+ * https://github.com/ulfjack/ryu (f2s.c)
+ */
+
+typedef unsigned int ess_uint32;
+typedef unsigned long long ess_uint64;
+
+#define FLOAT_MANTISSA_BITS		23
+#define FLOAT_EXPONENT_BITS		8
+#define FLOAT_BIAS				127
+#define FLOAT_POW5_INV_BITCOUNT	59
+#define FLOAT_POW5_BITCOUNT		61
+
+// floor(2^(pow5bits(i) - 1 + FLOAT_POW5_INV_BITCOUNT) / 5^i) + 1
+static const ess_uint64 FLOAT_POW5_INV_SPLIT[31] = {
+	576460752303423489u, 461168601842738791u, 368934881474191033u, 295147905179352826u,
+	472236648286964522u, 377789318629571618u, 302231454903657294u, 483570327845851670u,
+	386856262276681336u, 309485009821345069u, 495176015714152110u, 396140812571321688u,
+	316912650057057351u, 507060240091291761u, 405648192073033409u, 324518553658426727u,
+	519229685853482763u, 415383748682786211u, 332306998946228969u, 531691198313966350u,
+	425352958651173080u, 340282366920938464u, 544451787073501542u, 435561429658801234u,
+	348449143727040987u, 557518629963265579u, 446014903970612463u, 356811923176489971u,
+	570899077082383953u, 456719261665907162u, 365375409332725730u,
+};
+
+// 5^i scaled to FLOAT_POW5_BITCOUNT bits
+static const ess_uint64 FLOAT_POW5_SPLIT[47] = {
+	1152921504606846976u, 1441151880758558720u, 1801439850948198400u, 2251799813685248000u,
+	1407374883553280000u, 1759218604441600000u, 2199023255552000000u, 1374389534720000000u,
+	1717986918400000000u, 2147483648000000000u, 1342177280000000000u, 1677721600000000000u,
+	2097152000000000000u, 1310720000000000000u, 1638400000000000000u, 2048000000000000000u,
+	1280000000000000000u, 1600000000000000000u, 2000000000000000000u, 1250000000000000000u,
+	1562500000000000000u, 1953125000000000000u, 1220703125000000000u, 1525878906250000000u,
+	1907348632812500000u, 1192092895507812500u, 1490116119384765625u, 1862645149230957031u,
+	1164153218269348144u, 1455191522836685180u, 1818989403545856475u, 2273736754432320594u,
+	1421085471520200371u, 1776356839400250464u, 2220446049250313080u, 1387778780781445675u,
+	1734723475976807094u, 2168404344971008868u, 1355252715606880542u, 1694065894508600678u,
+	2117582368135750847u, 1323488980084844279u, 1654361225106055349u, 2067951531382569187u,
+	1292469707114105741u, 1615587133892632177u, 2019483917365790221u,
+};
+
+static inline ess_uint32 pow5bits(const int e)
+{
+	return (ess_uint32)(((e * 1217359) >> 19) + 1);
+}
+
+static inline ess_uint32 log10Pow2(const int e)
+{
+	return (ess_uint32)((e * 78913) >> 18);
+}
+
+static inline ess_uint32 log10Pow5(const int e)
+{
+	return (ess_uint32)((e * 732923) >> 20);
+}
+
+static inline ess_uint32 pow5Factor(ess_uint32 value)
+{
+	ess_uint32 count = 0;
+	for (;;)
+	{
+		ess_uint32 q = value / 5;
+		ess_uint32 r = value - 5 * q;
+		if (r != 0)
+		{
+			break;
+		}
+		value = q;
+		++ count;
+	}
+	return count;
+}
+
+static inline bool multipleOfPowerOf5(const ess_uint32 value, const ess_uint32 p)
+{
+	return pow5Factor(value) >= p;
+}
+
+static inline bool multipleOfPowerOf2(const ess_uint32 value, const ess_uint32 p)
+{
+	return (value & ((1u << p) - 1)) == 0;
+}
+
+static inline ess_uint32 mulShift(const ess_uint32 m, const ess_uint64 factor, const int shift)
+{
+	const ess_uint32 factorLo = (ess_uint32)factor;
+	const ess_uint32 factorHi = (ess_uint32)(factor >> 32);
+	const ess_uint64 bits0 = (ess_uint64)m * factorLo;
+	const ess_uint64 bits1 = (ess_uint64)m * factorHi;
+	const ess_uint64 sum = (bits0 >> 32) + bits1;
+	return (ess_uint32)(sum >> (shift - 32));
+}
+
+static inline ess_uint32 mulPow5InvDivPow2(const ess_uint32 m, const ess_uint32 q, const int j)
+{
+	return mulShift(m, FLOAT_POW5_INV_SPLIT[q], j);
+}
+
+static inline ess_uint32 mulPow5divPow2(const ess_uint32 m, const ess_uint32 i, const int j)
+{
+	return mulShift(m, FLOAT_POW5_SPLIT[i], j);
+}
+
+/** Compute the shortest decimal output * 10^exponent of a finite,
+ * non-zero float given as IEEE mantissa and exponent bits.
+ */
+static void f2d(const ess_uint32 ieeeMantissa, const ess_uint32 ieeeExponent, ess_uint32 &output, int &exponent)
+{
+	int e2;
+	ess_uint32 m2;
+	if (ieeeExponent == 0)
+	{
+		e2 = 1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+		m2 = ieeeMantissa;
+	}
+	else
+	{
+		e2 = (int)ieeeExponent - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+		m2 = (1u << FLOAT_MANTISSA_BITS) | ieeeMantissa;
+	}
+	const bool even = (m2 & 1) == 0;
+	const bool acceptBounds = even;
+
+	// step 2: determine the interval of valid decimal representations
+	const ess_uint32 mv = 4 * m2;
+	const ess_uint32 mp = 4 * m2 + 2;
+	const ess_uint32 mmShift = (ieeeMantissa != 0 || ieeeExponent <= 1) ? 1 : 0;
+	const ess_uint32 mm = 4 * m2 - 1 - mmShift;
+
+	// step 3: convert to a decimal power base using 64-bit arithmetic
+	ess_uint32 vr, vp, vm;
+	int e10;
+	bool vmIsTrailingZeros = false;
+	bool vrIsTrailingZeros = false;
+	ess_uint32 lastRemovedDigit = 0;
+	if (e2 >= 0)
+	{
+		const ess_uint32 q = log10Pow2(e2);
+		e10 = (int)q;
+		const int k = FLOAT_POW5_INV_BITCOUNT + (int)pow5bits(q) - 1;
+		const int i = -e2 + (int)q + k;
+		vr = mulPow5InvDivPow2(mv, q, i);
+		vp = mulPow5InvDivPow2(mp, q, i);
+		vm = mulPow5InvDivPow2(mm, q, i);
+		if (q != 0 && (vp - 1) / 10 <= vm / 10)
+		{
+			// we need to know one removed digit even if we are not going
+			// to loop below
+			const int l = FLOAT_POW5_INV_BITCOUNT + (int)pow5bits(q - 1) - 1;
+			lastRemovedDigit = mulPow5InvDivPow2(mv, q - 1, -e2 + (int)q - 1 + l) % 10;
+		}
+		if (q <= 9)
+		{
+			// only one of mp, mv, and mm can be a multiple of 5, if any
+			if (mv % 5 == 0)
+			{
+				vrIsTrailingZeros = multipleOfPowerOf5(mv, q);
+			}
+			else if (acceptBounds)
+			{
+				vmIsTrailingZeros = multipleOfPowerOf5(mm, q);
+			}
+			else
+			{
+				vp -= multipleOfPowerOf5(mp, q) ? 1 : 0;
+			}
+		}
+	}
+	else
+	{
+		const ess_uint32 q = log10Pow5(-e2);
+		e10 = (int)q + e2;
+		const int i = -e2 - (int)q;
+		const int k = (int)pow5bits(i) - FLOAT_POW5_BITCOUNT;
+		int j = (int)q - k;
+		vr = mulPow5divPow2(mv, i, j);
+		vp = mulPow5divPow2(mp, i, j);
+		vm = mulPow5divPow2(mm, i, j);
+		if (q != 0 && (vp - 1) / 10 <= vm / 10)
+		{
+			j = (int)q - 1 - ((int)pow5bits(i + 1) - FLOAT_POW5_BITCOUNT);
+			lastRemovedDigit = mulPow5divPow2(mv, i + 1, j) % 10;
+		}
+		if (q <= 1)
+		{
+			// mv = 4 * m2 always has at least two trailing zero bits
+			vrIsTrailingZeros = true;
+			if (acceptBounds)
+			{
+				vmIsTrailingZeros = mmShift == 1;
+			}
+			else
+			{
+				-- vp;
+			}
+		}
+		else if (q < 31)
+		{
+			vrIsTrailingZeros = multipleOfPowerOf2(mv, q - 1);
+		}
+	}
+
+	// step 4: find the shortest decimal representation in the interval
+	int removed = 0;
+	if (vmIsTrailingZeros || vrIsTrailingZeros)
+	{
+		// general case, which happens rarely
+		while (vp / 10 > vm / 10)
+		{
+			vmIsTrailingZeros &= vm % 10 == 0;
+			vrIsTrailingZeros &= lastRemovedDigit == 0;
+			lastRemovedDigit = vr % 10;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			++ removed;
+		}
+		if (vmIsTrailingZeros)
+		{
+			while (vm % 10 == 0)
+			{
+				vrIsTrailingZeros &= lastRemovedDigit == 0;
+				lastRemovedDigit = vr % 10;
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+				++ removed;
+			}
+		}
+		if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0)
+		{
+			// round even if the exact number is .....50..0
+			lastRemovedDigit = 4;
+		}
+		output = vr + (((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) || lastRemovedDigit >= 5) ? 1 : 0);
+	}
+	else
+	{
+		// common case
+		while (vp / 10 > vm / 10)
+		{
+			lastRemovedDigit = vr % 10;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			++ removed;
+		}
+		output = vr + ((vr == vm || lastRemovedDigit >= 5) ? 1 : 0);
+	}
+	exponent = e10 + removed;
+}
+
+static inline int decimal_length(const ess_uint32 v)
+{
+	if (v >= 1000000000) { return 10; }
+	if (v >= 100000000) { return 9; }
+	if (v >= 10000000) { return 8; }
+	if (v >= 1000000) { return 7; }
+	if (v >= 100000) { return 6; }
+	if (v >= 10000) { return 5; }
+	if (v >= 1000) { return 4; }
+	if (v >= 100) { return 3; }
+	if (v >= 10) { return 2; }
+	return 1;
+}
+
+static inline void write_digits(ess_uint32 v, char *end)
+{
+	do
+	{
+		*(--end) = (char)('0' + v % 10);
+		v /= 10;
+	} while (v != 0);
+}
+
+size_t ess_format_float(float value, char *buffer)
+{
+	ess_uint32 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	const bool sign = (bits >> 31) != 0;
+	const ess_uint32 ieeeMantissa = bits & ((1u << FLOAT_MANTISSA_BITS) - 1);
+	const ess_uint32 ieeeExponent = (bits >> FLOAT_MANTISSA_BITS) & ((1u << FLOAT_EXPONENT_BITS) - 1);
+
+	char *p = buffer;
+	if (ieeeExponent == ((1u << FLOAT_EXPONENT_BITS) - 1))
+	{
+		if (ieeeMantissa != 0)
+		{
+			memcpy(p, "nan", 3);
+			return 3;
+		}
+		if (sign)
+		{
+			*p++ = '-';
+		}
+		memcpy(p, "inf", 3);
+		return (p - buffer) + 3;
+	}
+	if (sign)
+	{
+		*p++ = '-';
+	}
+	if (ieeeExponent == 0 && ieeeMantissa == 0)
+	{
+		*p++ = '0';
+		return p - buffer;
+	}
+
+	ess_uint32 output;
+	int exponent;
+	f2d(ieeeMantissa, ieeeExponent, output, exponent);
+
+	const int olength = decimal_length(output);
+	// exponent of the leading digit in scientific notation
+	const int sci = exponent + olength - 1;
+
+	if (sci >= -5 && sci < 9)
+	{
+		if (exponent >= 0)
+		{
+			// integral value, e.g. 12000
+			write_digits(output, p + olength);
+			p += olength;
+			memset(p, '0', exponent);
+			p += exponent;
+		}
+		else if (sci >= 0)
+		{
+			// e.g. 12.5
+			char digits[9];
+			write_digits(output, digits + olength);
+			memcpy(p, digits, sci + 1);
+			p += sci + 1;
+			*p++ = '.';
+			memcpy(p, digits + sci + 1, olength - sci - 1);
+			p += olength - sci - 1;
+		}
+		else
+		{
+			// e.g. 0.00125
+			*p++ = '0';
+			*p++ = '.';
+			memset(p, '0', -sci - 1);
+			p += -sci - 1;
+			write_digits(output, p + olength);
+			p += olength;
+		}
+	}
+	else
+	{
+		// e.g. 1.25e-07 or 3.4e+38
+		char digits[9];
+		write_digits(output, digits + olength);
+		*p++ = digits[0];
+		if (olength > 1)
+		{
+			*p++ = '.';
+			memcpy(p, digits + 1, olength - 1);
+			p += olength - 1;
+		}
+		*p++ = 'e';
+		int e = sci;
+		if (e < 0)
+		{
+			*p++ = '-';
+			e = -e;
+		}
+		else
+		{
+			*p++ = '+';
+		}
+		if (e < 10)
+		{
+			*p++ = '0';
+		}
+		p += ess_format_uint((unsigned int)e, p);
+	}
+
+	return p - buffer;
+}
+
+size_t ess_format_uint(unsigned int value, char *buffer)
+{
+	const int length = decimal_length(value);
+	write_digits(value, buffer + length);
+	return length;
+}
+
+size_t ess_format_float_rows(const float *values, size_t num_rows, size_t num_cols, char *buffer)
+{
+	char *p = buffer;
+	for (size_t row = 0; row < num_rows; ++row)
+	{
+		*p++ = '\t';
+		*p++ = '\t';
+		for (size_t col = 0; col < num_cols; ++col)
+		{
+			if (col > 0)
+			{
+				*p++ = ' ';
+			}
+			p += ess_format_float(*values++, p);
+		}
+		*p++ = '\n';
+	}
+	return p - buffer;
+}
@@ -0,0 +1,196 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#include "esshash.h"
+#include <string.h>
+
+static const unsigned long long PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const unsigned long long PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const unsigned long long PRIME64_3 = 0x165667B19E3779F9ULL;
+static const unsigned long long PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const unsigned long long PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline unsigned long long rotl64(unsigned long long x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+/* Little endian reads, the exporter only runs on x86 */
+static inline unsigned long long read64(const unsigned char* p)
+{
+	unsigned long long v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline unsigned int read32(const unsigned char* p)
+{
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline unsigned long long round64(unsigned long long acc, unsigned long long input)
+{
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline unsigned long long merge64(unsigned long long acc, unsigned long long val)
+{
+	acc ^= round64(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+EssHash::EssHash(unsigned long long seed)
+{
+	Reset(seed);
+}
+
+void EssHash::Reset(unsigned long long seed)
+{
+	mSeed = seed;
+	mAcc[0] = seed + PRIME64_1 + PRIME64_2;
+	mAcc[1] = seed + PRIME64_2;
+	mAcc[2] = seed;
+	mAcc[3] = seed - PRIME64_1;
+	mTotalSize = 0;
+	mStripeSize = 0;
+}
+
+void EssHash::Update(const void* data, size_t size)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	mTotalSize += size;
+
+	if (mStripeSize + size < 32)
+	{
+		memcpy(mStripe + mStripeSize, p, size);
+		mStripeSize += size;
+		return;
+	}
+
+	if (mStripeSize > 0)
+	{
+		const size_t fill = 32 - mStripeSize;
+		memcpy(mStripe + mStripeSize, p, fill);
+		mAcc[0] = round64(mAcc[0], read64(mStripe));
+		mAcc[1] = round64(mAcc[1], read64(mStripe + 8));
+		mAcc[2] = round64(mAcc[2], read64(mStripe + 16));
+		mAcc[3] = round64(mAcc[3], read64(mStripe + 24));
+		p += fill;
+		size -= fill;
+		mStripeSize = 0;
+	}
+
+	while (size >= 32)
+	{
+		mAcc[0] = round64(mAcc[0], read64(p));
+		mAcc[1] = round64(mAcc[1], read64(p + 8));
+		mAcc[2] = round64(mAcc[2], read64(p + 16));
+		mAcc[3] = round64(mAcc[3], read64(p + 24));
+		p += 32;
+		size -= 32;
+	}
+
+	if (size > 0)
+	{
+		memcpy(mStripe, p, size);
+		mStripeSize = size;
+	}
+}
+
+void EssHash::UpdateString(const char* str)
+{
+	if (str == NULL)
+	{
+		const unsigned int nullMarker = 0xFFFFFFFFu;
+		UpdateValue(nullMarker);
+		return;
+	}
+	const unsigned int len = (unsigned int)strlen(str);
+	UpdateValue(len);
+	Update(str, len);
+}
+
+unsigned long long EssHash::Digest() const
+{
+	unsigned long long h;
+	if (mTotalSize >= 32)
+	{
+		h = rotl64(mAcc[0], 1) + rotl64(mAcc[1], 7) + rotl64(mAcc[2], 12) + rotl64(mAcc[3], 18);
+		h = merge64(h, mAcc[0]);
+		h = merge64(h, mAcc[1]);
+		h = merge64(h, mAcc[2]);
+		h = merge64(h, mAcc[3]);
+	}
+	else
+	{
+		h = mSeed + PRIME64_5;
+	}
+	h += mTotalSize;
+
+	const unsigned char* p = mStripe;
+	size_t size = mStripeSize;
+	while (size >= 8)
+	{
+		h ^= round64(0, read64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+		size -= 8;
+	}
+	if (size >= 4)
+	{
+		h ^= (unsigned long long)read32(p) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+		size -= 4;
+	}
+	while (size > 0)
+	{
+		h ^= (*p) * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+		++ p;
+		-- size;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+unsigned long long ess_hash(const void* data, size_t size, unsigned long long seed)
+{
+	EssHash hash(seed);
+	hash.Update(data, size);
+	return hash.Digest();
+}
+
+std::string ess_hash_to_string(unsigned long long hash)
+{
+	static const char digits[] = "0123456789abcdef";
+	char buffer[16];
+	for (int i = 15; i >= 0; --i)
+	{
+		buffer[i] = digits[hash & 0xF];
+		hash >>= 4;
+	}
+	return std::string(buffer, 16);
+}
@@ -18,7 +18,12 @@
 //
 
 #include "esslib.h"
+#include "esshash.h"
+#include "essvalidate.h"
 #include <ei.h>
+#include <fstream>
+#include <memory>
+#include <sys/stat.h>
 
 const char* instanceExt = "_instance";
 const char* MAX_EXPORT_ESS_DEFAULT_INST_NAME = "mtoer_instgroup_00";
@@ -27,10 +32,17 @@ const char* g_inst_group_name = "GlobalInstGroupName";
 //left hand to right hand matrix
 const eiMatrix l2r = ei_matrix(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, -1, 0, 0, 0, 0, 1);
 
+/* Progress while nodes are added, the rest is for writing the end */
+#define ESS_PROGRESS_ADD_WEIGHT 0.95f
+/* Smallest progress change reported to the host */
+#define ESS_PROGRESS_STEP 0.001f
+/* Shards are written under this suffix and renamed once complete */
+#define ESS_PARTIAL_SUFFIX ".part"
+
 bool g_check_normal = false;
 bool g_gi_cache_show_samples = false;
 
-std::string AddTexture(EssWriter& writer, const EH_Texture &t, const std::string texName, const std::string rootPath);
+std::string AddTexture(EssWriter& writer, const EH_Texture &t, const std::string texName, const std::string rootPath, EssTextureCache *textures);
 std::string AddNormalBump(EssWriter& writer, const std::string &normalMap);
 
 std::string AddCameraData(EssWriter& writer, const EH_Camera &cam, std::string& NodeName, std::string& envName, bool panorama, int panorama_size, bool is_lefthand)
@@ -555,6 +567,182 @@ double TriangleArea(eiVector &p1, eiVector &p2, eiVector &p3)
 	return area;
 }
 
+/** Strip the .ess extension, scene.ess -> scene */
+static std::string StripEssExtension(const std::string &filename)
+{
+	size_t extPos = filename.rfind('.');
+	if (extPos != std::string::npos && filename.compare(extPos, std::string::npos, ".ess") == 0)
+	{
+		return filename.substr(0, extPos);
+	}
+	return filename;
+}
+
+static std::string GetFileName(const std::string &path)
+{
+	size_t slashPos = path.find_last_of("/\\");
+	return (slashPos == std::string::npos) ? path : path.substr(slashPos + 1);
+}
+
+static void HashTexture(EssHash &hash, const EH_Texture &tex)
+{
+	// the ESS only refers to the image file, its content doesn't matter here
+	hash.UpdateString(tex.filename);
+	hash.UpdateValue(tex.repeat_u);
+	hash.UpdateValue(tex.repeat_v);
+	hash.UpdateValue(tex.offset_u);
+	hash.UpdateValue(tex.offset_v);
+}
+
+static void HashMaterial(EssHash &hash, const EH_Material &mat)
+{
+	hash.UpdateValue(mat.backface_cull);
+	hash.UpdateValue(mat.diffuse_weight);
+	hash.UpdateValue(mat.diffuse_color);
+	HashTexture(hash, mat.diffuse_tex);
+	hash.UpdateValue(mat.roughness);
+	hash.UpdateValue(mat.backlight);
+	hash.UpdateValue(mat.specular_weight);
+	hash.UpdateValue(mat.specular_color);
+	HashTexture(hash, mat.specular_tex);
+	hash.UpdateValue(mat.glossiness);
+	hash.UpdateValue(mat.specular_fresnel);
+	hash.UpdateValue(mat.anisotropy);
+	hash.UpdateValue(mat.rotation);
+	hash.UpdateValue(mat.transp_weight);
+	hash.UpdateValue(mat.transp_invert_weight);
+	HashTexture(hash, mat.transp_tex);
+	hash.UpdateValue(mat.bump_weight);
+	HashTexture(hash, mat.bump_tex);
+	hash.UpdateValue(mat.normal_bump);
+	hash.UpdateValue(mat.mirror_weight);
+	hash.UpdateValue(mat.mirror_color);
+	hash.UpdateValue(mat.mirror_fresnel);
+	hash.UpdateValue(mat.refract_weight);
+	hash.UpdateValue(mat.refract_invert_weight);
+	hash.UpdateValue(mat.refract_color);
+	HashTexture(hash, mat.refract_tex);
+	hash.UpdateValue(mat.ior);
+	hash.UpdateValue(mat.refract_glossiness);
+	hash.UpdateValue(mat.emission_weight);
+	hash.UpdateValue(mat.emission_color);
+	HashTexture(hash, mat.emission_tex);
+	hash.UpdateValue(mat.displace_weight);
+	HashTexture(hash, mat.displace_tex);
+}
+
+static bool HasTexture(const EH_Texture &tex)
+{
+	return tex.filename && strlen(tex.filename) > 0;
+}
+
+/** Bit mask of the shader nodes AddMaterial chains for the material */
+static unsigned int MaterialTopology(const EH_Material &mat)
+{
+	const EH_Texture *texs[] = { &mat.diffuse_tex, &mat.specular_tex, &mat.transp_tex, &mat.bump_tex,
+		&mat.refract_tex, &mat.emission_tex, &mat.displace_tex };
+	unsigned int topology = 0;
+	for (size_t i = 0; i < sizeof(texs) / sizeof(texs[0]); ++i)
+	{
+		if (HasTexture(*texs[i]))
+		{
+			topology |= 1u << i;
+		}
+	}
+	if (HasTexture(mat.bump_tex) && mat.normal_bump)
+	{
+		topology |= 1u << 7;
+	}
+	if (mat.backface_cull)
+	{
+		topology |= 1u << 8;
+	}
+	if (g_check_normal)
+	{
+		topology |= 1u << 9;
+	}
+	return topology;
+}
+
+/** The cached file of a texture changes with the image content */
+static void HashCachedTextures(EssHash &hash, const EH_Material &mat, const std::string &rootPath, EssTextureCache &textures)
+{
+	const EH_Texture *texs[] = { &mat.diffuse_tex, &mat.specular_tex, &mat.transp_tex, &mat.bump_tex,
+		&mat.refract_tex, &mat.emission_tex, &mat.displace_tex };
+	for (size_t i = 0; i < sizeof(texs) / sizeof(texs[0]); ++i)
+	{
+		if (texs[i]->filename && strlen(texs[i]->filename) > 0)
+		{
+			EssTextureAtlas::Region region;
+			if (textures.ResolveRegion(rootPath + texs[i]->filename, region))
+			{
+				hash.UpdateString(region.filename.c_str());
+				hash.UpdateValue(region.u);
+				hash.UpdateValue(region.v);
+				hash.UpdateValue(region.w);
+				hash.UpdateValue(region.h);
+			}
+			else
+			{
+				hash.UpdateString(textures.Resolve(rootPath + texs[i]->filename).c_str());
+			}
+		}
+	}
+}
+
+static void HashLight(EssHash &hash, const EH_Light &light)
+{
+	hash.UpdateValue(light.type);
+	hash.UpdateString(light.ies_filename);
+	if (light.ies_filename)
+	{
+		// the IES profile is translated into the ESS
+		struct stat st;
+		if (stat(light.ies_filename, &st) == 0)
+		{
+			long long size = (long long)st.st_size;
+			long long mtime = (long long)st.st_mtime;
+			hash.UpdateValue(size);
+			hash.UpdateValue(mtime);
+		}
+	}
+	hash.UpdateValue(light.intensity);
+	hash.UpdateValue(light.size);
+	hash.UpdateValue(light.light_to_world);
+	hash.UpdateValue(light.sample_num_coefficient);
+	hash.UpdateValue(light.light_color);
+}
+
+/** Input bytes of a mesh, the weight of its progress */
+static unsigned long long GetMeshBytes(const EH_Mesh &model)
+{
+	unsigned long long bytes = (unsigned long long)model.num_verts * sizeof(EH_Vec) + (unsigned long long)model.num_faces * 3 * sizeof(uint_t);
+	if (model.normals) bytes += (unsigned long long)model.num_verts * sizeof(EH_Vec);
+	if (model.uvs) bytes += (unsigned long long)model.num_verts * sizeof(EH_Vec2);
+	if (model.n_indices) bytes += (unsigned long long)model.num_faces * 3 * sizeof(uint_t);
+	if (model.uv_indices) bytes += (unsigned long long)model.num_faces * 3 * sizeof(uint_t);
+	if (model.mtl_indices) bytes += (unsigned long long)model.num_faces * sizeof(uint_t);
+	return bytes;
+}
+
+static unsigned long long HashMesh(const EH_Mesh &model, const std::string &modelName)
+{
+	EssHash hash;
+	hash.UpdateString(modelName.c_str());
+	hash.UpdateValue(model.num_verts);
+	hash.UpdateValue(model.num_faces);
+	const bool hasArrays[] = { model.normals != NULL, model.uvs != NULL, model.n_indices != NULL, model.uv_indices != NULL, model.mtl_indices != NULL };
+	hash.Update(hasArrays, sizeof(hasArrays));
+	hash.Update(model.verts, model.num_verts * sizeof(EH_Vec));
+	hash.Update(model.face_indices, model.num_faces * 3 * sizeof(uint_t));
+	if (model.normals) hash.Update(model.normals, model.num_verts * sizeof(EH_Vec));
+	if (model.uvs) hash.Update(model.uvs, model.num_verts * sizeof(EH_Vec2));
+	if (model.n_indices) hash.Update(model.n_indices, model.num_faces * 3 * sizeof(uint_t));
+	if (model.uv_indices) hash.Update(model.uv_indices, model.num_faces * 3 * sizeof(uint_t));
+	if (model.mtl_indices) hash.Update(model.mtl_indices, model.num_faces * sizeof(uint_t));
+	return hash.Digest();
+}
+
 EssExporter::EssExporter(void) :
 	display_callback(NULL),
 	progress_callback(NULL),
@@ -562,6 +750,16 @@ EssExporter::EssExporter(void) :
 	mIsLeftHand(false),
 	mUseDisplacement(false),
 	mIsNeedEmitGI(true),
+	mNumMeshes(0),
+	mShardMeshes(0),
+	mNumShards(0),
+	mBase85Encoding(true),
+	mIncremental(false),
+	mCapTextures(false),
+	mExpectedBytes(0),
+	mSubmittedMeshBytes(0),
+	mLastProgress(-1.0f),
+	mCancelled(false),
 	mOptionName(std::string(""))
 {
 	mLightSamples = 16;
@@ -579,12 +777,144 @@ EssExporter::~EssExporter()
 	log_callback = NULL;
 }
 
-bool EssExporter::BeginExport(std::string &filename, const EH_ExportOptions &option, const bool check_normal)
+bool EssExporter::BeginExport(std::string &filename, const EH_ExportOptions2 &option, const bool check_normal)
+{
+	if (!mFileSink.Open(filename.c_str(), EssFileSinkOptions()))
+	{
+		return false;
+	}
+	if (!BeginExport(&mFileSink, option, check_normal, filename))
+	{
+		mFileSink.Close();
+		return false;
+	}
+	return true;
+}
+
+bool EssExporter::BeginExport(EssOutputSink *sink, const EH_ExportOptions2 &option, const bool check_normal)
 {
-	printf("BeginExport\n");
+	// shards and the cache need a file name to be placed next to
+	return BeginExport(sink, option, check_normal, std::string());
+}
+
+bool EssExporter::BeginExport(EssOutputSink *sink, const EH_ExportOptions2 &option, const bool check_normal, const std::string &filename)
+{
+	ess_log(log_callback, EH_INFO, "BeginExport\n");
 	mCheckNormal = check_normal;
 	mIsLeftHand = option.left_handed;
-	return mWriter.Initialize(filename.c_str(), option.base85_encoding);
+	ResetProgress(option);
+	mWriter.SetLogCallback(log_callback);
+	if (!mWriter.Initialize(sink, option.base85_encoding))
+	{
+		return false;
+	}
+	mExportStart = std::chrono::steady_clock::now();
+	mNumMeshes = 0;
+
+	mIncremental = option.incremental && !filename.empty();
+	if (option.binary_sidecar && mIncremental)
+	{
+		ess_log(log_callback, EH_WARNING, "The sidecar is not used by incremental exports\n");
+	}
+	if (option.binary_sidecar && !mIncremental && !filename.empty())
+	{
+		// scene.ess -> scene.essbin, referenced relative to the ESS
+		std::string sidecarFile = StripEssExtension(filename) + ".essbin";
+		std::string sidecarName = GetFileName(sidecarFile);
+		if (!mWriter.OpenSidecar(sidecarFile.c_str(), sidecarName.c_str()))
+		{
+			ess_log(log_callback, EH_WARNING, "Can't create %s, mesh arrays are written to the ESS\n", sidecarFile.c_str());
+		}
+		else if (option.sidecar_compression != EH_COMPRESSION_NONE)
+		{
+			unsigned int codec = (option.sidecar_compression == EH_COMPRESSION_ZSTD) ? ESSBIN_CODEC_ZSTD : ESSBIN_CODEC_ZLIB;
+			if (!mWriter.SetSidecarCompression(codec, option.compression_level))
+			{
+				ess_log(log_callback, EH_WARNING, "zstd is not available, using zlib\n");
+				mWriter.SetSidecarCompression(ESSBIN_CODEC_ZLIB, option.compression_level);
+			}
+		}
+	}
+	mShardMeshes = 0;
+	if (mIncremental)
+	{
+		// unchanged meshes are reused as whole shards
+		mShardMeshes = option.shard_meshes > 0 ? option.shard_meshes : 1;
+		mShardBase = StripEssExtension(filename);
+		mCache.Load(mShardBase);
+	}
+	else if (option.shard_meshes > 0 && !filename.empty())
+	{
+		if (mWriter.HasSidecar())
+		{
+			ess_log(log_callback, EH_WARNING, "Sharding is disabled, mesh arrays go to the sidecar\n");
+		}
+		else
+		{
+			mShardMeshes = option.shard_meshes;
+			mShardBase = StripEssExtension(filename);
+		}
+	}
+	mNumShards = 0;
+	mBase85Encoding = option.base85_encoding;
+	mDedup.Reset(option.mesh_dedup);
+	mMaterialDedup.Reset(option.material_dedup);
+	mPruner.Reset(option.prune_mode, option.prune_margin, option.prune_distance);
+	mLightPlanner.Reset(option.light_cluster_error, option.light_sample_budget);
+	mDisplace.Reset(option.displace_per_object, option.displace_edge_length, option.displace_triangle_budget);
+	mMeshSettings.weld_tolerance = option.weld_tolerance;
+	mMeshSettings.reorder_triangles = option.reorder_triangles;
+	mMeshSettings.split_triangles = option.split_triangles;
+	mMeshSettings.validate_policy = option.validate_policy;
+	mMeshSettings.max_coordinate = option.max_coordinate;
+	mMeshSettings.log_callback = log_callback;
+	mMeshStats.Reset();
+	mLibraryStats = EssMaterialLibrary::Stats();
+	OpenTextureCache(option, filename);
+	mBounds.Reset(mCapTextures || mPruner.IsEnabled() || mLightPlanner.IsEnabled() || mDisplace.IsEnabled());
+
+	if (option.num_threads != 1)
+	{
+		mWriter.StartPipeline(option.num_threads);
+	}
+	return true;
+}
+
+void EssExporter::OpenTextureCache(const EH_ExportOptions2 &option, const std::string &sceneName)
+{
+	mCapTextures = false;
+	mFootprint.Reset();
+	mTextures.SetLogCallback(log_callback);
+	if (option.texture_cache_dir == NULL)
+	{
+		if (option.cap_texture_resolution)
+		{
+			ess_log(log_callback, EH_WARNING, "Texture resolution capping needs the texture cache\n");
+		}
+		return;
+	}
+	if (!EssTextureCache::IsAvailable())
+	{
+		ess_log(log_callback, EH_WARNING, "Texture conversion is not available, textures are referenced as they are\n");
+	}
+	else if (!mTextures.Open(option.texture_cache_dir, option.num_threads, &mStats))
+	{
+		ess_log(log_callback, EH_WARNING, "Can't use texture cache %s\n", option.texture_cache_dir);
+	}
+	else
+	{
+		// files which depend on the scene are named for it
+		const std::string tag = sceneName.empty() ? std::string("stream") : ess_hash_to_string(ess_hash(sceneName.data(), sceneName.size())).substr(0, 8);
+		if (option.cap_texture_resolution)
+		{
+			mCapTextures = true;
+			mTextures.EnableResolutionCap(tag);
+		}
+		if (option.atlas_texture_size > 0)
+		{
+			mTextures.EnableAtlas(option.atlas_texture_size, tag);
+		}
+	}
 }
 
 void EssExporter::SetTexPath(std::string &path)
@@ -612,15 +942,25 @@ void EssExporter::AddAssemblyInstance(const char *name, const EH_AssemblyInstanc
 
 void EssExporter::AddMaterialFromEss(const EH_Material &mat, std::string matName, const char *essName)
 {
+	if (mCancelled)
+	{
+		return;
+	}
+	EssStatTimer timer(&mStats, ESS_STAT_MATERIALS, sizeof(EH_Material), 1);
+	mPruner.AddMaterial(matName, mat);
+	if (mCapTextures)
+	{
+		mFootprint.AddMaterial(matName, mat, mRootPath);
+	}
 	float eps = 0.0000001;
 	std::string transparent_tex_node, diffuse_tex_node, normal_map_tex_node, specular_tex_node, emission_tex_node;
 	if(mat.diffuse_tex.filename && strlen(mat.diffuse_tex.filename) > 0)
 	{
-		diffuse_tex_node = AddTexture(mWriter, mat.diffuse_tex, matName + "_d", mRootPath);
+		diffuse_tex_node = AddTexture(mWriter, mat.diffuse_tex, matName + "_d", mRootPath, &mTextures);
 	}	
 	if(mat.bump_tex.filename && strlen(mat.bump_tex.filename) > 0)
 	{
-		normal_map_tex_node = AddTexture(mWriter, mat.bump_tex, matName + "_n", mRootPath);
+		normal_map_tex_node = AddTexture(mWriter, mat.bump_tex, matName + "_n", mRootPath, &mTextures);
 		if(mat.normal_bump)
 		{
 			normal_map_tex_node = AddNormalBump(mWriter, normal_map_tex_node);
@@ -628,15 +968,15 @@ void EssExporter::AddMaterialFromEss(const EH_Material &mat, std::string matName
 	}
 	if(mat.specular_tex.filename && strlen(mat.specular_tex.filename) > 0)
 	{
-		specular_tex_node = AddTexture(mWriter, mat.specular_tex, matName + "_s", mRootPath);
+		specular_tex_node = AddTexture(mWriter, mat.specular_tex, matName + "_s", mRootPath, &mTextures);
 	}
 	if(mat.transp_tex.filename && strlen(mat.transp_tex.filename) > 0)
 	{
-		transparent_tex_node = AddTexture(mWriter, mat.transp_tex, matName + "_t", mRootPath);
+		transparent_tex_node = AddTexture(mWriter, mat.transp_tex, matName + "_t", mRootPath, &mTextures);
 	}
 	if(mat.emission_tex.filename && strlen(mat.emission_tex.filename) > 0)
 	{
-		emission_tex_node = AddTexture(mWriter, mat.emission_tex, matName + "_e", mRootPath);
+		emission_tex_node = AddTexture(mWriter, mat.emission_tex, matName + "_e", mRootPath, &mTextures);
 	}
 
 	std::string ei_standard_node = matName + "_ei_stn";
@@ -677,24 +1017,15 @@ void EssExporter::AddMaterialFromEss(const EH_Material &mat, std::string matName
 		mWriter.AddColor("emission_color", color);
 	}
 
-	const int MTL_BUF_SIZE = 2048;
-	char *mtl_buf = NULL;
-	std::streampos size;
-	std::ifstream file((wchar_t*)essName, std::ios::in|std::ios::binary|std::ios::ate);
-	if (file.is_open())
+	std::shared_ptr<const std::string> mtl_text = EssMaterialLibrary::Get().Read(essName, mLibraryStats);
+	if (mtl_text)
 	{
-		size = file.tellg();
-		int int_size = size;
-		mtl_buf = new char [int_size + 2];
-		file.seekg (0, std::ios::beg);
-		file.read (mtl_buf, size);
-		file.close();
-
-		mtl_buf[int_size] = '\n';
-		mtl_buf[int_size + 1] = '\0';
+		mWriter.AddCustomString(mtl_text->c_str());
+	}
+	else
+	{
+		ess_log(log_callback, EH_WARNING, "Can't read the material library of %s\n", matName.c_str());
 	}
-
-	mWriter.AddCustomString(mtl_buf);
 
 	std::string max_input_mtl_name;
 	if (mat.backface_cull)
@@ -733,6 +1064,7 @@ void EssExporter::AddMaterialFromEss(const EH_Material &mat, std::string matName
 	mWriter.EndNode();
 
 	mElMaterials.push_back(matName);
+	UpdateProgress();
 }
 
 void TranslateLight(EssWriter& writer, const char *pTypeName, const EH_Light &light, const std::string &lightName, const std::string &envName, const int samples){
@@ -854,10 +1186,19 @@ std::string AddLight(EssWriter& writer, const EH_Light& light, std::string &ligh
 	return instanceName;
 }
 
-std::string AddTexture(EssWriter& writer, const EH_Texture &t, const std::string texName, const std::string rootPath){
+std::string AddTexture(EssWriter& writer, const EH_Texture &t, const std::string texName, const std::string rootPath, EssTextureCache *textures){
 	std::string texPath = t.filename;
 	if(texPath.empty())return "";
 
+	// weighted by the size of the image the renderer will load
+	unsigned long long texBytes = texPath.size();
+	struct stat st;
+	if (stat((rootPath + texPath).c_str(), &st) == 0)
+	{
+		texBytes = (unsigned long long)st.st_size;
+	}
+	EssStatTimer timer(writer.GetStats(), ESS_STAT_TEXTURES, texBytes, 1);
+
 	std::string uvgenName = texName + "_uvgen";
 	writer.BeginNode("max_stduv", uvgenName);
 	writer.AddToken("mapChannel", "uv0");
@@ -872,7 +1213,22 @@ std::string AddTexture(EssWriter& writer, const EH_Texture &t, const std::string
 	std::string bitmapName = texName + "_bitmap";
 	writer.BeginNode("max_bitmap", bitmapName);
 	writer.LinkParam("tex_coords", uvgenName, "result");
-	writer.AddToken("tex_fileName", rootPath + texPath);
+	EssTextureAtlas::Region region;
+	if (textures && textures->ResolveRegion(rootPath + texPath, region))
+	{
+		// crop the image from the atlas, the UVs still wrap over the image
+		writer.AddToken("tex_fileName", region.filename);
+		writer.AddBool("tex_apply", true);
+		writer.AddInt("tex_cropPlace", 0);
+		writer.AddScalar("tex_clipu", region.u);
+		writer.AddScalar("tex_clipv", region.v);
+		writer.AddScalar("tex_clipw", region.w);
+		writer.AddScalar("tex_cliph", region.h);
+	}
+	else
+	{
+		writer.AddToken("tex_fileName", textures ? textures->Resolve(rootPath + texPath) : rootPath + texPath);
+	}
 	writer.EndNode();
 
 	std::string stdoutName = texName + "_stdout";
@@ -926,17 +1282,17 @@ std::string AddNormalBump(EssWriter& writer, const std::string &normalMap){
 	return normalName;
 }
 
-std::string AddMaterial(EssWriter& writer, const EH_Material& mat, std::string &matName, const std::string &rootPath, bool &use_displace)
+std::string AddMaterial(EssWriter& writer, const EH_Material& mat, std::string &matName, const std::string &rootPath, EssTextureCache *textures, bool &use_displace)
 {
 	float eps = 0.0000001;
 	std::string transparent_tex_node, diffuse_tex_node, normal_map_tex_node, specular_tex_node, emission_tex_node, displace_tex_node, refract_tex_node;
 	if(mat.diffuse_tex.filename && strlen(mat.diffuse_tex.filename) > 0)
 	{
-		diffuse_tex_node = AddTexture(writer, mat.diffuse_tex, matName + "_d", rootPath);
+		diffuse_tex_node = AddTexture(writer, mat.diffuse_tex, matName + "_d", rootPath, textures);
 	}	
 	if(mat.bump_tex.filename && strlen(mat.bump_tex.filename) > 0)
 	{
-		normal_map_tex_node = AddTexture(writer, mat.bump_tex, matName + "_n", rootPath);
+		normal_map_tex_node = AddTexture(writer, mat.bump_tex, matName + "_n", rootPath, textures);
 		if(mat.normal_bump)
 		{
 			normal_map_tex_node = AddNormalBump(writer, normal_map_tex_node);
@@ -944,23 +1300,23 @@ std::string AddMaterial(EssWriter& writer, const EH_Material& mat, std::string &
 	}
 	if(mat.specular_tex.filename && strlen(mat.specular_tex.filename) > 0)
 	{
-		specular_tex_node = AddTexture(writer, mat.specular_tex, matName + "_s", rootPath);
+		specular_tex_node = AddTexture(writer, mat.specular_tex, matName + "_s", rootPath, textures);
 	}
 	if(mat.transp_tex.filename && strlen(mat.transp_tex.filename) > 0)
 	{
-		transparent_tex_node = AddTexture(writer, mat.transp_tex, matName + "_t", rootPath);
+		transparent_tex_node = AddTexture(writer, mat.transp_tex, matName + "_t", rootPath, textures);
 	}
 	if(mat.emission_tex.filename && strlen(mat.emission_tex.filename) > 0)
 	{
-		emission_tex_node = AddTexture(writer, mat.emission_tex, matName + "_e", rootPath);
+		emission_tex_node = AddTexture(writer, mat.emission_tex, matName + "_e", rootPath, textures);
 	}
 	if(mat.displace_tex.filename && strlen(mat.displace_tex.filename) > 0)
 	{
-		displace_tex_node = AddTexture(writer, mat.displace_tex, matName + "_disp", rootPath);
+		displace_tex_node = AddTexture(writer, mat.displace_tex, matName + "_disp", rootPath, textures);
 	}
 	if(mat.refract_tex.filename && strlen(mat.refract_tex.filename) > 0)
 	{
-		refract_tex_node = AddTexture(writer, mat.refract_tex, matName + "_refract", rootPath);
+		refract_tex_node = AddTexture(writer, mat.refract_tex, matName + "_refract", rootPath, textures);
 	}
 
 	std::string ei_standard_node = matName + "_ei_stn";
@@ -1100,6 +1456,8 @@ bool EssExporter::AddCamera(const EH_Camera &cam, bool panorama, int panorama_si
 {
 	std::string instanceName = AddCameraData(mWriter, cam, NodeName, mEnvName, panorama, panorama_size, mIsLeftHand);
 	mCamName = instanceName;
+	mBounds.AddCamera(cam, panorama, panorama_size, mIsLeftHand);
+	mPruner.AddCamera(cam, panorama, mIsLeftHand);
 	if (instanceName != "")
 	{
 		mElInstances.push_back(instanceName);
@@ -1176,15 +1534,95 @@ bool EssExporter::AddSun(const EH_Sun &sun, eiMatrix &mat)
 	return true;
 }
 
+void EssExporter::EmitNode(const char *kind, const std::string &name, unsigned long long hash, std::string &result, bool &flag, const NodeGenerator &generate)
+{
+	if (!mIncremental)
+	{
+		generate(mWriter, result, flag);
+		return;
+	}
+
+	const EssExportCache::Node *cached = mCache.FindNode(kind, name, hash);
+	if (cached != NULL)
+	{
+		if (!cached->bytes.empty())
+		{
+			mWriter.AddRawNodes(&cached->bytes[0], cached->bytes.size());
+		}
+		result = cached->result;
+		flag = cached->flag;
+		mCache.AddNode(*cached, true);
+		return;
+	}
+
+	EssExportCache::Node node;
+	node.kind = kind;
+	node.name = name;
+	node.hash = hash;
+	node.flag = flag;
+	{
+		EssMemorySink sink;
+		EssWriter writer;
+		writer.SetStats(mWriter.GetStats());
+		writer.InitializeFragment(&sink, mBase85Encoding, ESS_SINK_BUFFER_ALIGNMENT);
+		generate(writer, node.result, node.flag);
+		writer.Close();
+		sink.Release(node.bytes);
+	}
+	if (!node.bytes.empty())
+	{
+		mWriter.AddRawNodes(&node.bytes[0], node.bytes.size());
+	}
+	result = node.result;
+	flag = node.flag;
+	mCache.AddNode(node, false);
+}
+
 bool EssExporter::AddMaterial(const EH_Material& mat, std::string &matName)
 {
+	if (mCancelled)
+	{
+		return false;
+	}
+	EssStatTimer timer(&mStats, ESS_STAT_MATERIALS, sizeof(EH_Material), 1);
+	mPruner.AddMaterial(matName, mat);
+	if (mCapTextures)
+	{
+		mFootprint.AddMaterial(matName, mat, mRootPath);
+	}
 	bool use_displace = false;
-	std::string materialName = ::AddMaterial(mWriter, mat, matName, mRootPath, use_displace);
+	std::string materialName;
+	unsigned long long hash = 0;
+	{
+		EssHash hasher;
+		HashMaterial(hasher, mat);
+		hasher.UpdateString(mRootPath.c_str());
+		if (mMaterialDedup.Add(matName, hasher.Digest(), MaterialTopology(mat)))
+		{
+			UpdateProgress();
+			mElMaterials.push_back(mMaterialDedup.Find(matName));
+			return true;
+		}
+		if (mIncremental)
+		{
+			if (mTextures.IsOpen())
+			{
+				HashCachedTextures(hasher, mat, mRootPath, mTextures);
+			}
+			hash = hasher.Digest();
+		}
+	}
+	EmitNode("material", matName, hash, materialName, use_displace, [&](EssWriter& writer, std::string& result, bool& flag)
+	{
+		result = ::AddMaterial(writer, mat, matName, mRootPath, &mTextures, flag);
+	});
 
 	if (use_displace)
 	{
 		mUseDisplacement = true;
+		mDisplace.AddDisplacedMaterial(materialName);
 	}
+	UpdateProgress();
 
 	if (materialName != "")
 	{
@@ -1244,12 +1682,50 @@ void EssExporter::SetGamma(const EH_Gamma &gamma)
 
 bool EssExporter::AddLight(const EH_Light& light, std::string &lightName, bool is_show_area)
 {
+	if (mCancelled)
+	{
+		return false;
+	}
+	EssStatTimer timer(&mStats, ESS_STAT_LIGHTS, sizeof(EH_Light), 1);
 	if(light.type == EH_LIGHT_PORTAL)
 	{
 		mIsNeedEmitGI = false;
 	}
 
-	std::string instanceName = ::AddLight(mWriter, light, lightName, mEnvName, mRootPath, light.sample_num_coefficient * mLightSamples, is_show_area);
+	const int samples = light.sample_num_coefficient * mLightSamples;
+	if (mLightPlanner.IsEnabled())
+	{
+		// written at the end, when all lights and cameras are known
+		mLightPlanner.AddLight(light, lightName, mEnvName, is_show_area, samples);
+		UpdateProgress();
+		return true;
+	}
+	const bool added = EmitLight(light, lightName, mEnvName, is_show_area, samples);
+	UpdateProgress();
+	return added;
+}
+
+bool EssExporter::EmitLight(const EH_Light& light, const std::string &lightName, const std::string &envName, bool is_show_area, int samples)
+{
+	std::string instanceName;
+	bool unused = false;
+	unsigned long long hash = 0;
+	if (mIncremental)
+	{
+		EssHash hasher;
+		HashLight(hasher, light);
+		hasher.UpdateString(envName.c_str());
+		hasher.UpdateString(mRootPath.c_str());
+		hasher.UpdateValue(samples);
+		hasher.UpdateValue(is_show_area);
+		hash = hasher.Digest();
+	}
+	EmitNode("light", lightName, hash, instanceName, unused, [&](EssWriter& writer, std::string& result, bool& flag)
+	{
+		std::string name = lightName;
+		std::string env = envName;
+		result = ::AddLight(writer, light, name, env, mRootPath, samples, is_show_area);
+	});
 	if (instanceName != "")
 	{
 		mElInstances.push_back(instanceName);
@@ -1259,24 +1735,143 @@ bool EssExporter::AddLight(const EH_Light& light, std::string &lightName, bool i
 	}
 }
 
-void EssExporter::AddMesh(const EH_Mesh& model, const std::string &modelName) 
+void EssExporter::FlushLights()
 {
-	mWriter.BeginNode("poly", modelName.c_str());
-	mWriter.AddPointArray("pos_list", (eiVector*)model.verts, model.num_verts);
+	if (!mLightPlanner.IsEnabled())
+	{
+		return;
+	}
+	EssStatTimer timer(&mStats, ESS_STAT_LIGHTS);
+	std::vector<EssLightPlanner::Light>& lights = mLightPlanner.Plan(mBounds);
+	for (size_t i = 0; i < lights.size(); ++i)
+	{
+		EmitLight(lights[i].light, lights[i].name, lights[i].env_name, lights[i].show_area, lights[i].samples);
+	}
+}
+
+/** Write the arrays of a mesh, or of one of its clusters, as a poly. */
+static void WriteMeshArrays(EssWriter& writer, const EH_Mesh& model, EssMeshArrays& mesh, const std::string &modelName, const EssMeshSettings &settings, EssMeshStats &stats, EssMeshReport &report)
+{
+	if (settings.reorder_triangles)
+	{
+		ess_reorder_triangles(model, mesh);
+	}
+	// drop the vertices of the filtered triangles, weld if asked to
+	ess_compact_mesh(model, mesh, settings.weld_tolerance);
+	stats.output_verts += mesh.verts.size();
+	if (settings.validate_policy != EH_VALIDATE_OFF)
+	{
+		ess_sanitize_mesh(mesh, settings.max_coordinate, settings.validate_policy == EH_VALIDATE_FIX, report);
+	}
+
+	// with a sidecar the arrays are stored raw and the essbin_loader
+	// procedural builds the poly when the renderer needs it
+	const bool useSidecar = writer.HasSidecar();
+	if (useSidecar)
+	{
+		writer.BeginSidecarNode(modelName.c_str());
+	}
+	else
+	{
+		writer.BeginNode("poly", modelName.c_str());
+	}
+	writer.AddPointArray("pos_list", mesh.verts.data(), mesh.verts.size());
+	writer.AddIndexArray("triangle_list", mesh.vert_indices.data(), mesh.vert_indices.size(), false);
 
-	std::vector<uint_t> filter_vert_index;	
-	std::vector<uint_t> filter_mtl_index;
-	std::vector<uint_t> filter_n_index;
-	std::vector<uint_t> filter_uv_index;
-	filter_vert_index.reserve(model.num_faces * 3);
-	filter_n_index.reserve(model.num_faces * 3);
-	filter_uv_index.reserve(model.num_faces * 3);
+	if (model.normals)
+	{
+		if (model.n_indices == NULL)
+		{
+			writer.AddDeclare("vector[]", "N", "varying");
+			writer.AddPointArray("N", mesh.normals.data(), mesh.normals.size());
+		}
+		else
+		{
+			writer.AddDeclare("vector[]", "N", "facevarying");
+			writer.AddPointArray("N", mesh.normals.data(), mesh.normals.size());
+			writer.AddDeclare("index[]", "N_idx", "facevarying");
+			writer.AddIndexArray("N_idx", mesh.n_indices.data(), mesh.n_indices.size(), false);
+		}
+	}
+
+	if(model.uvs)
+	{
+		if (model.uv_indices == NULL)
+		{
+			writer.AddDeclare("vector2[]", "uv0", "varying");
+			writer.AddVector2Array("uv0", mesh.uvs.data(), mesh.uvs.size());
+		}
+		else
+		{
+			writer.AddDeclare("vector2[]", "uv0", "facevarying");
+			writer.AddVector2Array("uv0", mesh.uvs.data(), mesh.uvs.size());
+			writer.AddDeclare("index[]", "uv0_idx", "facevarying");
+			writer.AddIndexArray("uv0_idx", mesh.uv_indices.data(), mesh.uv_indices.size(), false);
+		}
+	}	
+
+	if (model.mtl_indices)
+	{
+		writer.AddDeclare("index[]", "mtl_index", "uniform");
+		writer.AddIndexArray("mtl_index", mesh.mtl_indices.data(), mesh.mtl_indices.size(), false);
+	}
+
+	if (useSidecar)
+	{
+		writer.EndSidecarNode();
+
+		std::string loaderName = modelName + "_essbin_loader";
+		writer.BeginNode("essbin_loader", loaderName);
+		writer.AddToken("filename", writer.GetSidecarName());
+		writer.AddToken("mesh_name", modelName);
+		writer.EndNode();
+
+		// instances reference the procedural under the mesh name
+		writer.BeginNode("procedural", modelName);
+		writer.AddRef("geometry_shader", loaderName);
+		writer.EndNode();
+	}
+	else
+	{
+		writer.EndNode();
+	}
+}
+
+void AddMeshData(EssWriter& writer, const EH_Mesh& model, const std::string &modelName, const EssMeshSettings &settings, EssMeshStats &stats)
+{
+	EssStatTimer timer(writer.GetStats(), ESS_STAT_MESHES, GetMeshBytes(model));
+
+	// the host arrays are checked before any triangle is read
+	EssMeshReport report;
+	EssMeshValidator validator;
+	const bool validate = settings.validate_policy != EH_VALIDATE_OFF;
+	const bool fix = settings.validate_policy == EH_VALIDATE_FIX;
+	if (validate)
+	{
+		validator.Check(model, report);
+	}
+
+	EssMeshArrays mesh;
+	mesh.vert_indices.reserve(model.num_faces * 3);
+	if (model.n_indices)
+	{
+		mesh.n_indices.reserve(model.num_faces * 3);
+	}
+	if (model.uv_indices)
+	{
+		mesh.uv_indices.reserve(model.num_faces * 3);
+	}
 	if (model.mtl_indices)
 	{		
-		filter_mtl_index.reserve(model.num_faces);
+		mesh.mtl_indices.reserve(model.num_faces);
 	}	
 	for (int i = 0; i < model.num_faces; ++i)
 	{
+		if (validate && !validator.IsTriangleValid(i, fix))
+		{
+			++ report.dropped_triangles;
+			continue;
+		}
 		uint_t *p_index = (uint_t*)model.face_indices + (i * 3);
 		uint_t *n_index = (uint_t*)model.n_indices + (i * 3);
 		uint_t *uv_index = (uint_t*)model.uv_indices + (i * 3);
@@ -1289,94 +1884,441 @@ void EssExporter::AddMesh(const EH_Mesh& model, const std::string &modelName)
 
 		if (TriangleArea(*p0, *p1, *p2) > ER_TRIANGLE_AREA_EPS)
 		{
-			filter_vert_index.push_back(index0);
-			filter_vert_index.push_back(index1);
-			filter_vert_index.push_back(index2);
+			mesh.vert_indices.push_back(index0);
+			mesh.vert_indices.push_back(index1);
+			mesh.vert_indices.push_back(index2);
 			if (model.n_indices != NULL)
 			{
-				filter_n_index.push_back(*n_index);
-				filter_n_index.push_back(*(n_index + 1));
-				filter_n_index.push_back(*(n_index + 2));
+				mesh.n_indices.push_back(*n_index);
+				mesh.n_indices.push_back(*(n_index + 1));
+				mesh.n_indices.push_back(*(n_index + 2));
 			}
 			if (model.uv_indices != NULL)
 			{
-				filter_uv_index.push_back(*uv_index);
-				filter_uv_index.push_back(*(uv_index + 1));
-				filter_uv_index.push_back(*(uv_index + 2));
+				mesh.uv_indices.push_back(*uv_index);
+				mesh.uv_indices.push_back(*(uv_index + 1));
+				mesh.uv_indices.push_back(*(uv_index + 2));
 			}
 
 			if (model.mtl_indices)
 			{
-				filter_mtl_index.push_back(*(model.mtl_indices + i));
+				mesh.mtl_indices.push_back(*(model.mtl_indices + i));
 			}
 		}		
 	}
-	mWriter.AddIndexArray("triangle_list", &filter_vert_index[0], filter_vert_index.size(), false);
 
-	if (model.normals)
+	if (mesh.vert_indices.empty())
 	{
-		if (model.n_indices == NULL)
+		// nothing to render, an empty group keeps the instances valid
+		ess_log(settings.log_callback, EH_WARNING, "Mesh %s has no valid triangles\n", modelName.c_str());
+		writer.BeginNode("instgroup", modelName);
+		writer.AddRefGroup("instance_list", std::vector<std::string>());
+		writer.EndNode();
+	}
+	else if (settings.split_triangles > 0 && mesh.vert_indices.size() / 3 > settings.split_triangles)
+	{
+		// the clusters are instanced by an instgroup which takes the
+		// mesh name, their instances inherit the materials of its instances
+		std::vector<EssMeshArrays> clusters;
+		ess_split_triangles(model, mesh, settings.split_triangles, clusters);
+		mesh = EssMeshArrays();
+
+		std::vector<std::string> clusterInstances;
+		for (size_t i = 0; i < clusters.size(); ++i)
 		{
-			mWriter.AddDeclare("vector[]", "N", "varying");
-			mWriter.AddPointArray("N", (eiVector*)model.normals, model.num_verts);
+			char clusterId[16];
+			sprintf(clusterId, "_cluster%04u", (unsigned int)i);
+			const std::string clusterName = modelName + clusterId;
+			WriteMeshArrays(writer, model, clusters[i], clusterName, settings, stats, report);
+			clusters[i] = EssMeshArrays();
+
+			const std::string instanceName = clusterName + "_inst";
+			writer.BeginNode("instance", instanceName);
+			writer.AddRef("element", clusterName);
+			writer.EndNode();
+			clusterInstances.push_back(instanceName);
 		}
-		else
+		writer.BeginNode("instgroup", modelName);
+		writer.AddRefGroup("instance_list", clusterInstances);
+		writer.EndNode();
+
+		++ stats.split_meshes;
+		stats.split_clusters += (unsigned int)clusters.size();
+	}
+	else
+	{
+		WriteMeshArrays(writer, model, mesh, modelName, settings, stats, report);
+	}
+	stats.input_verts += model.num_verts;
+	if (report.HasIssues())
+	{
+		report.Print(modelName, fix, settings.log_callback);
+		++ stats.invalid_meshes;
+	}
+}
+
+/** Mesh data copied for a pipeline job, the caller may free
+ * its arrays as soon as AddMesh returns.
+ */
+struct EssMeshCopy
+{
+	std::string name;
+	EH_Mesh mesh;
+	unsigned long long hash;		/**< Content hash for incremental exports */
+	std::vector<float> verts;
+	std::vector<float> normals;
+	std::vector<float> uvs;
+	std::vector<uint_t> face_indices;
+	std::vector<uint_t> n_indices;
+	std::vector<uint_t> uv_indices;
+	std::vector<uint_t> mtl_indices;
+
+	EssMeshCopy(const EH_Mesh& model, const std::string &modelName) :
+		name(modelName),
+		mesh(model),
+		hash(0)
+	{
+		mesh.verts = (EH_Vec*)CopyArray(verts, (const float*)model.verts, model.num_verts * 3);
+		mesh.normals = (EH_Vec*)CopyArray(normals, (const float*)model.normals, model.num_verts * 3);
+		mesh.uvs = (EH_Vec2*)CopyArray(uvs, (const float*)model.uvs, model.num_verts * 2);
+		mesh.face_indices = CopyArray(face_indices, model.face_indices, model.num_faces * 3);
+		mesh.n_indices = CopyArray(n_indices, model.n_indices, model.num_faces * 3);
+		mesh.uv_indices = CopyArray(uv_indices, model.uv_indices, model.num_faces * 3);
+		mesh.mtl_indices = CopyArray(mtl_indices, model.mtl_indices, model.num_faces);
+	}
+
+	template <typename T>
+	static T* CopyArray(std::vector<T>& dst, const T* src, size_t count)
+	{
+		if (src == NULL)
 		{
-			mWriter.AddDeclare("vector[]", "N", "facevarying");
-			mWriter.AddPointArray("N", (eiVector*)model.normals, model.num_verts);
-			mWriter.AddDeclare("index[]", "N_idx", "facevarying");
-			mWriter.AddIndexArray("N_idx", &filter_n_index[0], filter_n_index.size(), false);
+			return NULL;
 		}
+		dst.assign(src, src + count);
+		return dst.empty() ? NULL : &dst[0];
 	}
+};
 
-	if(model.uvs)
+void EssExporter::ResetProgress(const EH_ExportOptions2 &option)
+{
+	mStats.Reset();
+	mWriter.SetStats(&mStats);
+	mStatsFile = option.stats_filename ? option.stats_filename : "";
+	mExpectedBytes = option.expected_bytes;
+	mSubmittedMeshBytes = 0;
+	mLastProgress = -1.0f;
+	mCancelled = false;
+}
+
+void EssExporter::UpdateProgress(float fraction)
+{
+	if (fraction < 0.0f)
 	{
-		if (model.uv_indices == NULL)
+		// meshes still encoding on workers are known but not done yet
+		const unsigned long long meshBytes = mStats.GetBytes(ESS_STAT_MESHES);
+		const unsigned long long doneBytes = meshBytes + mStats.GetBytes(ESS_STAT_MATERIALS) +
+			mStats.GetBytes(ESS_STAT_LIGHTS) + mStats.GetBytes(ESS_STAT_TEXTURES);
+		const unsigned long long knownBytes = doneBytes - meshBytes + std::max(mSubmittedMeshBytes, meshBytes);
+		const unsigned long long totalBytes = std::max(mExpectedBytes, knownBytes);
+		fraction = (totalBytes > 0) ? ESS_PROGRESS_ADD_WEIGHT * (float)((double)doneBytes / (double)totalBytes) : 0.0f;
+	}
+	if (progress_callback == NULL || mCancelled || (fraction < 1.0f && fraction - mLastProgress < ESS_PROGRESS_STEP))
+	{
+		return;
+	}
+	mLastProgress = fraction;
+	if (!progress_callback(fraction))
+	{
+		ess_log(log_callback, EH_WARNING, "Export cancelled\n");
+		mCancelled = true;
+	}
+}
+
+void EssExporter::AddMesh(const EH_Mesh& model, const std::string &modelName) 
+{
+	if (mCancelled)
+	{
+		return;
+	}
+	if (model.num_verts == 0 || model.num_faces == 0 || model.verts == NULL || model.face_indices == NULL)
+	{
+		ess_log(log_callback, EH_WARNING, "Mesh %s is empty, it and its instances are skipped\n", modelName.c_str());
+		mEmptyMeshes.insert(modelName);
+		return;
+	}
+	++ mNumMeshes;
+	const unsigned long long meshBytes = GetMeshBytes(model);
+	mSubmittedMeshBytes += meshBytes;
+	if (mCapTextures)
+	{
+		mFootprint.AddMesh(modelName, model);
+	}
+	mBounds.AddMesh(modelName, model);
+	mDisplace.AddMesh(modelName, model);
+
+	{
+		// time on this thread, the bytes count once the mesh is written
+		EssStatTimer timer(&mStats, ESS_STAT_MESHES, 0, 1);
+		AddMeshCopy(model, modelName, meshBytes);
+	}
+	UpdateProgress();
+}
+
+void EssExporter::AddMeshCopy(const EH_Mesh& model, const std::string &modelName, unsigned long long meshBytes)
+{
+	// a duplicate is written as instances of the mesh it repeats
+	if (mDedup.Add(model, modelName))
+	{
+		mStats.Add(ESS_STAT_MESHES, 0, meshBytes, 0);
+		return;
+	}
+
+	// sidecar arrays all go to one file, they're written on this thread,
+	// as are meshes of a serial export
+	if (mWriter.HasSidecar() || (mShardMeshes == 0 && !mWriter.HasPipeline()))
+	{
+		AddMeshData(mWriter, model, modelName, mMeshSettings, mMeshStats);
+		return;
+	}
+
+	std::shared_ptr<EssMeshCopy> meshCopy = std::make_shared<EssMeshCopy>(model, modelName);
+	if (mIncremental)
+	{
+		meshCopy->hash = HashMesh(meshCopy->mesh, modelName);
+	}
+	if (mShardMeshes > 0)
+	{
+		mShardMeshList.push_back(meshCopy);
+		if (mShardMeshList.size() >= mShardMeshes)
 		{
-			mWriter.AddDeclare("vector2[]", "uv0", "varying");
-			mWriter.AddVector2Array("uv0", (eiVector2*)model.uvs, model.num_verts);
+			FlushShard();
 		}
-		else
+		return;
+	}
+
+	const EssMeshSettings settings = mMeshSettings;
+	EssMeshStats *stats = &mMeshStats;
+	mWriter.SubmitNodes([meshCopy, settings, stats](EssWriter& writer)
+	{
+		AddMeshData(writer, meshCopy->mesh, meshCopy->name, settings, *stats);
+		return true;
+	});
+}
+
+void EssExporter::FlushShard()
+{
+	if (mShardMeshList.empty())
+	{
+		return;
+	}
+
+	std::string spaceName;
+	unsigned long long shardHash = 0;
+	if (mIncremental)
+	{
+		// content addressed, an unchanged shard keeps its file and namespace
+		EssHash hasher;
+		hasher.UpdateValue(mBase85Encoding);
+		hasher.UpdateValue(mMeshSettings.weld_tolerance);
+		hasher.UpdateValue(mMeshSettings.reorder_triangles);
+		hasher.UpdateValue(mMeshSettings.split_triangles);
+		hasher.UpdateValue(mMeshSettings.validate_policy);
+		hasher.UpdateValue(mMeshSettings.max_coordinate);
+		for (size_t i = 0; i < mShardMeshList.size(); ++i)
 		{
-			mWriter.AddDeclare("vector2[]", "uv0", "facevarying");
-			mWriter.AddVector2Array("uv0", (eiVector2*)model.uvs, model.num_verts);
-			mWriter.AddDeclare("index[]", "uv0_idx", "facevarying");
-			mWriter.AddIndexArray("uv0_idx", &filter_uv_index[0], filter_uv_index.size(), false);
+			hasher.UpdateValue(mShardMeshList[i]->hash);
 		}
-	}	
+		shardHash = hasher.Digest();
+		spaceName = "shard_" + ess_hash_to_string(shardHash);
+	}
+	else
+	{
+		char shardId[16];
+		sprintf(shardId, "shard%04u", mNumShards);
+		spaceName = shardId;
+	}
+	++ mNumShards;
+	const std::string shardFile = mShardBase + "." + spaceName + ".ess";
+	const std::string shardName = GetFileName(shardFile);
+	for (size_t i = 0; i < mShardMeshList.size(); ++i)
+	{
+		mShardElements[mShardMeshList[i]->name] = spaceName + "::" + mShardMeshList[i]->name;
+	}
 
-	if (model.mtl_indices)
+	if (mIncremental)
 	{
-		mWriter.AddDeclare("index[]", "mtl_index", "uniform");
-		mWriter.AddIndexArray("mtl_index", &filter_mtl_index[0], filter_mtl_index.size(), false);
+		if (mCache.FindShard(shardHash, shardName))
+		{
+			mCache.AddShard(shardHash, shardName, (unsigned int)mShardMeshList.size(), true);
+			mShardMeshList.clear();
+			mWriter.BeginNameSpace(spaceName.c_str());
+			mWriter.AddParseEss(shardName.c_str());
+			mWriter.EndNameSpace();
+			return;
+		}
 	}
 
-	mWriter.EndNode();
+	// the shard file is written on a worker, the master gets the
+	// include in submission order. It's written under a temporary
+	// name and recorded for reuse only once it's complete.
+	std::vector<std::shared_ptr<EssMeshCopy> > meshes;
+	meshes.swap(mShardMeshList);
+	const bool encoding = mBase85Encoding;
+	const EssMeshSettings settings = mMeshSettings;
+	EssMeshStats *stats = &mMeshStats;
+	const EH_LogCallback logCallback = log_callback;
+	EssExportCache *cache = mIncremental ? &mCache : NULL;
+	mWriter.SubmitNodes([meshes, encoding, settings, stats, logCallback, cache, shardHash, spaceName, shardFile, shardName](EssWriter& writer)
+	{
+		const std::string partial = shardFile + ESS_PARTIAL_SUFFIX;
+		EssFileSink sink;
+		if (!sink.Open(partial.c_str(), EssFileSinkOptions()))
+		{
+			ess_log(logCallback, EH_ERROR, "Can't create shard %s\n", shardFile.c_str());
+			return false;
+		}
+		EssTimedSink timedSink;
+		timedSink.Attach(&sink, writer.GetStats());
+		EssWriter shardWriter;
+		shardWriter.SetStats(writer.GetStats());
+		shardWriter.InitializeFragment(&timedSink, encoding, ESS_SINK_DEFAULT_BUFFER_SIZE);
+		for (size_t i = 0; i < meshes.size(); ++i)
+		{
+			AddMeshData(shardWriter, meshes[i]->mesh, meshes[i]->name, settings, *stats);
+		}
+		bool ok = shardWriter.Close();
+		ok = timedSink.Close() && ok;
+		if (ok)
+		{
+			remove(shardFile.c_str());
+			ok = rename(partial.c_str(), shardFile.c_str()) == 0;
+		}
+		if (!ok)
+		{
+			remove(partial.c_str());
+			ess_log(logCallback, EH_ERROR, "Failed to write shard %s\n", shardFile.c_str());
+		}
+		else if (cache != NULL)
+		{
+			cache->AddShard(shardHash, shardName, (unsigned int)meshes.size(), false);
+		}
+
+		writer.BeginNameSpace(spaceName.c_str());
+		writer.AddParseEss(shardName.c_str());
+		writer.EndNameSpace();
+		return ok;
+	});
+}
+
+static void WriteMeshInstance(EssWriter& writer, const std::string &instName, const std::vector<std::string> &mtl_list,
+	const std::string &elementName, const eiMatrix &transform, const std::string &approx)
+{
+	writer.BeginNode("instance", instName);
+	writer.AddRefGroup("mtl_list", mtl_list);
+	writer.AddRef("element", elementName);
+	writer.AddMatrix("transform", transform);
+	writer.AddMatrix("motion_transform", transform);
+	if (!approx.empty())
+	{
+		writer.AddRef("approx", approx);
+	}
+	writer.EndNode();
+}
+
+void EssExporter::WriteDisplacedInstances()
+{
+	if (!mDisplace.IsEnabled())
+	{
+		return;
+	}
+	std::vector<EssDisplaceBudget::Instance>& instances = mDisplace.Plan();
+	// instances subdivided alike share an approximation
+	std::map<unsigned int, std::string> approxNames;
+	for (size_t i = 0; i < instances.size(); ++i)
+	{
+		std::string &approx = approxNames[instances[i].level];
+		if (approx.empty())
+		{
+			char name[64];
+			sprintf(name, "ApproxDisplace%u", instances[i].level);
+			approx = name;
+			mWriter.BeginNode("approx", approx);
+			mWriter.AddInt("method", 1);
+			mWriter.AddBool("view_dep", true);
+			mWriter.AddScalar("edge_length", mDisplace.GetEdgeLength());
+			mWriter.AddScalar("motion_factor", 16.0f);
+			mWriter.AddInt("max_subdiv", (int)instances[i].level);
+			mWriter.EndNode();
+		}
+		WriteMeshInstance(mWriter, instances[i].name, instances[i].materials, instances[i].element, instances[i].transform, approx);
+	}
 }
 
 void EssExporter::AddMeshInstance(const char *instName, const EH_MeshInstance &meshInst)
 {
+	eiMatrix transform = *((eiMatrix*)meshInst.mesh_to_world);
+	std::string elementName = meshInst.mesh_name;
+	if (mEmptyMeshes.find(elementName) != mEmptyMeshes.end())
+	{
+		return;
+	}
+	if (!mPruner.Keep(instName, meshInst, mBounds))
+	{
+		return;
+	}
+	mLightPlanner.AddInstance(meshInst.mesh_name, transform, mBounds);
+	const EssMeshDedup::Match *match = mDedup.Find(elementName);
+	if (match != NULL)
+	{
+		elementName = match->mesh_name;
+		if (match->has_transform)
+		{
+			transform = match->transform * transform;
+		}
+	}
+
+	// the shard has to be included before its meshes are referenced
+	for (size_t i = 0; i < mShardMeshList.size(); ++i)
+	{
+		if (mShardMeshList[i]->name == elementName)
+		{
+			FlushShard();
+			break;
+		}
+	}
+	std::map<std::string, std::string>::const_iterator shardIter = mShardElements.find(elementName);
+	if (shardIter != mShardElements.end())
+	{
+		elementName = shardIter->second;
+	}
+
 	std::vector<std::string> mtl_list;
 	for(int i = 0; i < MAX_NUM_MTLS; ++i)
 	{
 		if (meshInst.mtl_names[i])
 		{
-			mtl_list.push_back(meshInst.mtl_names[i]);
+			mtl_list.push_back(mMaterialDedup.Find(meshInst.mtl_names[i]));
 		}		
 	}
-	mWriter.BeginNode("instance", instName);
-	mWriter.AddRefGroup("mtl_list", mtl_list);
-	mWriter.AddRef("element", meshInst.mesh_name);
-	mWriter.AddMatrix("transform", *((eiMatrix*)meshInst.mesh_to_world));
-	mWriter.AddMatrix("motion_transform", *((eiMatrix*)meshInst.mesh_to_world));
-	mWriter.EndNode();
+	// displaced instances are written at the end, with their subdivision
+	if (!mDisplace.AddInstance(instName, meshInst.mesh_name, *((eiMatrix*)meshInst.mesh_to_world), elementName, transform, mtl_list, mBounds))
+	{
+		WriteMeshInstance(mWriter, instName, mtl_list, elementName, transform, std::string());
+	}
 
+	if (mCapTextures)
+	{
+		mFootprint.AddInstance(meshInst);
+	}
 	mElInstances.push_back(instName);
 }
 
-void EssExporter::EndExport()
+bool EssExporter::EndExport()
 {
-	printf("EndExport\n");
+	ess_log(log_callback, EH_INFO, "EndExport\n");
+	FlushShard();
+	FlushLights();
+	UpdateProgress();
 	if (mOptionName.empty())
 	{
 		AddMediumOptions(mWriter, mOptionName);
@@ -1402,6 +2344,7 @@ void EssExporter::EndExport()
 
 		mUseDisplacement = false;
 	}
+	WriteDisplacedInstances();
 
 	if(!mEnvName.empty())
 	{
@@ -1415,9 +2358,94 @@ void EssExporter::EndExport()
 	mWriter.EndNode();
 	
 	mWriter.AddRenderCommand(g_inst_group_name, mCamName.c_str(), optName);
-	mWriter.Close();		
+	const unsigned int numThreads = mWriter.GetPipelineThreads();
+	mWriter.WaitPipeline();
+	const bool texturesCached = mTextures.IsOpen();
+	if (mCapTextures)
+	{
+		std::map<std::string, unsigned int> resolutions;
+		mFootprint.GetResolutions(mBounds, resolutions);
+		for (std::map<std::string, unsigned int>::const_iterator iter = resolutions.begin(); iter != resolutions.end(); ++iter)
+		{
+			mTextures.SetMaxResolution(iter->first, iter->second);
+		}
+		mFootprint.Reset();
+		mCapTextures = false;
+	}
+	if (texturesCached && !mTextures.Close())
+	{
+		ess_log(log_callback, EH_ERROR, "Failed to write the texture cache index\n");
+	}
+	UpdateProgress();
+	const unsigned long long outputBytes = mWriter.GetBytesWritten();
+	bool ok = mWriter.Close();
+	if (mFileSink.IsOpen() && !mFileSink.Close())
+	{
+		ok = false;
+	}
+	if (!ok)
+	{
+		ess_log(log_callback, EH_ERROR, "Failed to write the ESS, the output is incomplete\n");
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mExportStart).count();
+	if (!mStatsFile.empty() && !mStats.WriteJson(mStatsFile.c_str(), seconds, outputBytes, numThreads))
+	{
+		ess_log(log_callback, EH_WARNING, "Can't write export statistics to %s\n", mStatsFile.c_str());
+	}
+	ess_log(log_callback, EH_INFO, "Exported %u meshes in %.2f s on %u threads\n", mNumMeshes, seconds, numThreads);
+	if (mNumShards > 0)
+	{
+		ess_log(log_callback, EH_INFO, "Meshes are written to %u shards\n", mNumShards);
+	}
+	mShardElements.clear();
+	mEmptyMeshes.clear();
+	mDedup.PrintReport(log_callback);
+	mMaterialDedup.PrintReport(log_callback);
+	mPruner.PrintReport(log_callback);
+	mLightPlanner.PrintReport(log_callback);
+	mDisplace.PrintReport(log_callback);
+	if (mLibraryStats.hits > 0)
+	{
+		ess_log(log_callback, EH_INFO, "Material libraries: %llu read, %llu reused from memory, %llu bytes not read again\n",
+			mLibraryStats.reads, mLibraryStats.hits, mLibraryStats.bytes_avoided);
+	}
+	if (mMeshStats.input_verts > 0)
+	{
+		ess_log(log_callback, EH_INFO, "Mesh vertices: %llu before compaction, %llu after\n",
+			(unsigned long long)mMeshStats.input_verts, (unsigned long long)mMeshStats.output_verts);
+	}
+	if (mMeshStats.invalid_meshes > 0)
+	{
+		ess_log(log_callback, EH_WARNING, "%u meshes had invalid geometry\n", (unsigned int)mMeshStats.invalid_meshes);
+	}
+	if (mMeshStats.split_meshes > 0)
+	{
+		ess_log(log_callback, EH_INFO, "Split %u meshes into %u clusters\n", (unsigned int)mMeshStats.split_meshes, (unsigned int)mMeshStats.split_clusters);
+	}
+	if (texturesCached)
+	{
+		mTextures.PrintReport(log_callback);
+	}
+	mDedup.Reset(EH_DEDUP_NONE);
+	mMaterialDedup.Reset(false);
+	mPruner.Reset(EH_PRUNE_OFF, 0.0f, 0.0f);
+	mLightPlanner.Reset(0.0f, 0);
+	mDisplace.Reset(false, 1.0f, 0);
+	mBounds.Reset(false);
+	if (mIncremental)
+	{
+		if (!mCache.Save())
+		{
+			ess_log(log_callback, EH_ERROR, "Failed to write the export manifest\n");
+		}
+		mCache.PrintReport(log_callback);
+	}
 
 	mElInstances.clear();
+	mWriter.SetStats(NULL);
+	UpdateProgress(1.0f);
+	return ok;
 }
 
 void EssExporter::SetLightSamples( const int samples )
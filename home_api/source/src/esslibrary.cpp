@@ -0,0 +1,144 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "esslibrary.h"
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <sys/stat.h>
+#include <wchar.h>
+
+/* The library path as a cache key and the file status behind it */
+static bool stat_library(const char* filename, std::string& key, long long& mtime, unsigned long long& size)
+{
+#ifdef _WIN32
+	const wchar_t* path = (const wchar_t*)filename;
+	key.assign(filename, wcslen(path) * sizeof(wchar_t));
+	struct _stat64 st;
+	if (_wstat64(path, &st) != 0)
+	{
+		return false;
+	}
+#else
+	key = filename;
+	struct stat st;
+	if (stat(filename, &st) != 0)
+	{
+		return false;
+	}
+#endif
+	mtime = (long long)st.st_mtime;
+	size = (unsigned long long)st.st_size;
+	return true;
+}
+
+static bool read_library(const char* filename, std::string& text)
+{
+#ifdef _WIN32
+	std::ifstream file((const wchar_t*)filename, std::ios::in | std::ios::binary);
+#else
+	std::ifstream file(filename, std::ios::in | std::ios::binary);
+#endif
+	if (!file.is_open())
+	{
+		return false;
+	}
+	std::ostringstream stream;
+	stream << file.rdbuf();
+	text = stream.str();
+	text += '\n';
+	return true;
+}
+
+EssMaterialLibrary::EssMaterialLibrary() :
+	mBytes(0),
+	mUseCount(0)
+{
+}
+
+EssMaterialLibrary& EssMaterialLibrary::Get()
+{
+	static EssMaterialLibrary library;
+	return library;
+}
+
+std::shared_ptr<const std::string> EssMaterialLibrary::Read(const char* filename, Stats& stats)
+{
+	std::string key;
+	long long mtime = 0;
+	unsigned long long size = 0;
+	if (filename == NULL || !stat_library(filename, key, mtime, size))
+	{
+		return std::shared_ptr<const std::string>();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		std::map<std::string, Entry>::iterator iter = mEntries.find(key);
+		if (iter != mEntries.end() && iter->second.mtime == mtime && iter->second.size == size)
+		{
+			iter->second.last_use = ++ mUseCount;
+			++ stats.hits;
+			stats.bytes_avoided += size;
+			return iter->second.text;
+		}
+	}
+
+	// read outside the lock, other libraries can be served meanwhile
+	std::shared_ptr<std::string> text = std::make_shared<std::string>();
+	if (!read_library(filename, *text))
+	{
+		return std::shared_ptr<const std::string>();
+	}
+
+	++ stats.reads;
+	std::lock_guard<std::mutex> lock(mMutex);
+	Entry& entry = mEntries[key];
+	if (entry.text)
+	{
+		mBytes -= entry.text->size();
+	}
+	entry.mtime = mtime;
+	entry.size = size;
+	entry.text = text;
+	entry.last_use = ++ mUseCount;
+	mBytes += text->size();
+	EvictLocked(key);
+	return text;
+}
+
+void EssMaterialLibrary::EvictLocked(const std::string& keep)
+{
+	// exports still using a dropped library hold their own reference
+	while (mBytes > ESS_LIBRARY_MAX_BYTES)
+	{
+		std::map<std::string, Entry>::iterator oldest = mEntries.end();
+		for (std::map<std::string, Entry>::iterator iter = mEntries.begin(); iter != mEntries.end(); ++iter)
+		{
+			if (iter->first != keep && (oldest == mEntries.end() || iter->second.last_use < oldest->second.last_use))
+			{
+				oldest = iter;
+			}
+		}
+		if (oldest == mEntries.end())
+		{
+			return;
+		}
+		mBytes -= oldest->second.text->size();
+		mEntries.erase(oldest);
+	}
+}
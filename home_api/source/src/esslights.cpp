@@ -0,0 +1,336 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "esslights.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+
+/* Oriented lights are merged within about 10 degrees */
+#define ESS_LIGHT_CLUSTER_COS 0.985f
+#define ESS_LIGHT_MIN_SAMPLES 1
+
+static inline eiVector MatrixRow(const EH_Mat m, int row)
+{
+	return ei_vector(m[row * 4], m[row * 4 + 1], m[row * 4 + 2]);
+}
+
+static inline float Dot(const eiVector& a, const eiVector& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline float Distance(const eiVector& a, const eiVector& b)
+{
+	const eiVector d = ei_vector(a.x - b.x, a.y - b.y, a.z - b.z);
+	return sqrtf(Dot(d, d));
+}
+
+static bool SameDirection(const EH_Mat a, const EH_Mat b, int row)
+{
+	const eiVector da = MatrixRow(a, row);
+	const eiVector db = MatrixRow(b, row);
+	const float la = sqrtf(Dot(da, da));
+	const float lb = sqrtf(Dot(db, db));
+	return la > 0.0f && lb > 0.0f && Dot(da, db) >= ESS_LIGHT_CLUSTER_COS * la * lb;
+}
+
+/* Could the lights be replaced by one at a point between them? */
+static bool CanMerge(const EssLightPlanner::Light& a, const EssLightPlanner::Light& b)
+{
+	if (a.light.type != b.light.type || a.ies_filename != b.ies_filename || a.env_name != b.env_name ||
+		a.samples != b.samples ||
+		a.light.size[0] != b.light.size[0] || a.light.size[1] != b.light.size[1] ||
+		a.light.light_color[0] != b.light.light_color[0] ||
+		a.light.light_color[1] != b.light.light_color[1] ||
+		a.light.light_color[2] != b.light.light_color[2])
+	{
+		return false;
+	}
+	if (a.light.type == EH_LIGHT_SPOT || a.light.type == EH_LIGHT_IES)
+	{
+		// IES profiles needn't be symmetric around the axis
+		return SameDirection(a.light.light_to_world, b.light.light_to_world, 2) &&
+			(a.light.type != EH_LIGHT_IES || SameDirection(a.light.light_to_world, b.light.light_to_world, 0));
+	}
+	return true;
+}
+
+EssLightPlanner::EssLightPlanner() :
+	mClusterError(0.0f),
+	mSampleBudget(0),
+	mNumInput(0),
+	mNumOutput(0),
+	mMinSamples(0),
+	mMaxSamples(0),
+	mTotalSamples(0)
+{
+}
+
+void EssLightPlanner::Reset(float clusterError, unsigned int sampleBudget)
+{
+	mClusterError = std::max(clusterError, 0.0f);
+	mSampleBudget = sampleBudget;
+	mLights.clear();
+	mReceivers.clear();
+	mNumInput = 0;
+	mNumOutput = 0;
+	mMinSamples = 0;
+	mMaxSamples = 0;
+	mTotalSamples = 0;
+}
+
+void EssLightPlanner::AddInstance(const std::string& meshName, const eiMatrix& transform, const EssSceneBounds& bounds)
+{
+	EssSceneBounds::Box box;
+	if (mClusterError > 0.0f && bounds.GetWorldBounds(meshName, transform, box))
+	{
+		mReceivers.push_back(box);
+	}
+}
+
+float EssLightPlanner::ReceiverDistance(const eiVector& p) const
+{
+	float nearest = FLT_MAX;
+	for (size_t i = 0; i < mReceivers.size(); ++i)
+	{
+		const EssSceneBounds::Box& box = mReceivers[i];
+		float distance = EssSceneBounds::Distance(p, box);
+		if (distance == 0.0f)
+		{
+			// inside, rooms enclose their lights, the walls are the nearest
+			distance = std::min(std::min(std::min(p.x - box.lo.x, box.hi.x - p.x), std::min(p.y - box.lo.y, box.hi.y - p.y)),
+				std::min(p.z - box.lo.z, box.hi.z - p.z));
+		}
+		nearest = std::min(nearest, distance);
+	}
+	return nearest;
+}
+
+void EssLightPlanner::AddLight(const EH_Light& light, const std::string& name, const std::string& envName, bool showArea, int samples)
+{
+	Light entry;
+	entry.light = light;
+	entry.has_ies = (light.ies_filename != NULL);
+	entry.ies_filename = entry.has_ies ? light.ies_filename : "";
+	entry.name = name;
+	entry.env_name = envName;
+	entry.show_area = showArea;
+	entry.samples = samples;
+	entry.num_merged = 1;
+	mLights.push_back(entry);
+	++ mNumInput;
+}
+
+void EssLightPlanner::Cluster()
+{
+	if (mClusterError <= 0.0f || mReceivers.empty())
+	{
+		return;
+	}
+	// moving a light by less than this share of its distance to the nearest
+	// geometry changes the falloff anywhere on it by less than the error
+	const float reach = 1.0f - 1.0f / sqrtf(1.0f + mClusterError);
+
+	struct Group
+	{
+		std::vector<size_t> members;
+		eiVector centroid;
+		float weight;
+	};
+	std::vector<Group> groups;
+	std::vector<int> groupOf(mLights.size(), -1);
+	std::vector<eiVector> positions(mLights.size());
+	std::vector<float> tolerances(mLights.size());
+	for (size_t i = 0; i < mLights.size(); ++i)
+	{
+		const Light& light = mLights[i];
+		positions[i] = MatrixRow(light.light.light_to_world, 3);
+		tolerances[i] = ReceiverDistance(positions[i]) * reach;
+
+		// portals and quads are shaped by their size, visible lights are seen
+		if (light.light.type == EH_LIGHT_PORTAL || light.light.type == EH_LIGHT_QUAD || light.show_area ||
+			!(light.light.intensity > 0.0f) || !_finite(tolerances[i]))
+		{
+			continue;
+		}
+		const float weight = light.light.intensity;
+		for (size_t g = 0; g < groups.size(); ++g)
+		{
+			Group& group = groups[g];
+			if (!CanMerge(mLights[group.members[0]], light))
+			{
+				continue;
+			}
+			const float total = group.weight + weight;
+			const eiVector centroid = ei_vector(
+				(group.centroid.x * group.weight + positions[i].x * weight) / total,
+				(group.centroid.y * group.weight + positions[i].y * weight) / total,
+				(group.centroid.z * group.weight + positions[i].z * weight) / total);
+			bool fits = Distance(positions[i], centroid) <= tolerances[i];
+			for (size_t m = 0; m < group.members.size() && fits; ++m)
+			{
+				fits = Distance(positions[group.members[m]], centroid) <= tolerances[group.members[m]];
+			}
+			if (fits)
+			{
+				group.members.push_back(i);
+				group.centroid = centroid;
+				group.weight = total;
+				groupOf[i] = (int)g;
+				break;
+			}
+		}
+		if (groupOf[i] < 0)
+		{
+			Group group;
+			group.members.push_back(i);
+			group.centroid = positions[i];
+			group.weight = weight;
+			groupOf[i] = (int)groups.size();
+			groups.push_back(group);
+		}
+	}
+
+	// the first light of a group stands for it, at the weighted centre
+	std::vector<Light> lights;
+	lights.reserve(mLights.size());
+	for (size_t i = 0; i < mLights.size(); ++i)
+	{
+		if (groupOf[i] < 0)
+		{
+			lights.push_back(mLights[i]);
+			continue;
+		}
+		const Group& group = groups[groupOf[i]];
+		if (group.members[0] != i)
+		{
+			continue;
+		}
+		Light light = mLights[i];
+		light.light.intensity = group.weight;
+		light.light.light_to_world[12] = group.centroid.x;
+		light.light.light_to_world[13] = group.centroid.y;
+		light.light.light_to_world[14] = group.centroid.z;
+		light.num_merged = (unsigned int)group.members.size();
+		lights.push_back(light);
+	}
+	mLights.swap(lights);
+}
+
+void EssLightPlanner::Budget(const EssSceneBounds& bounds)
+{
+	if (mSampleBudget == 0)
+	{
+		return;
+	}
+	// light reaching the cameras, falling off with the square distance
+	std::vector<double> contributions(mLights.size(), 0.0);
+	double total = 0.0;
+	for (size_t i = 0; i < mLights.size(); ++i)
+	{
+		const Light& light = mLights[i];
+		if (light.light.type == EH_LIGHT_PORTAL)
+		{
+			continue;
+		}
+		const EH_Vec& color = light.light.light_color;
+		double power = fabs(light.light.intensity) * (0.2126 * color[0] + 0.7152 * color[1] + 0.0722 * color[2]) *
+			std::max(light.light.sample_num_coefficient, 1);
+		const std::vector<EssSceneBounds::Camera>& cameras = bounds.GetCameras();
+		if (!cameras.empty())
+		{
+			const eiVector position = MatrixRow(light.light.light_to_world, 3);
+			double distance = DBL_MAX;
+			for (size_t k = 0; k < cameras.size(); ++k)
+			{
+				distance = std::min(distance, (double)Distance(cameras[k].position, position));
+			}
+			power /= std::max(distance * distance, (double)FLT_MIN);
+		}
+		if (power > 0.0 && power < DBL_MAX)
+		{
+			contributions[i] = power;
+			total += power;
+		}
+	}
+	if (!(total > 0.0))
+	{
+		return;
+	}
+	// every light keeps the minimum, the rest of the budget is shared
+	unsigned int numLights = 0;
+	for (size_t i = 0; i < mLights.size(); ++i)
+	{
+		numLights += (mLights[i].light.type != EH_LIGHT_PORTAL) ? 1 : 0;
+	}
+	const unsigned long long reserved = (unsigned long long)numLights * ESS_LIGHT_MIN_SAMPLES;
+	const double spare = (mSampleBudget > reserved) ? (double)(mSampleBudget - reserved) : 0.0;
+	for (size_t i = 0; i < mLights.size(); ++i)
+	{
+		if (mLights[i].light.type == EH_LIGHT_PORTAL)
+		{
+			continue;
+		}
+		mLights[i].samples = ESS_LIGHT_MIN_SAMPLES + (int)floor(spare * contributions[i] / total);
+	}
+}
+
+std::vector<EssLightPlanner::Light>& EssLightPlanner::Plan(const EssSceneBounds& bounds)
+{
+	Cluster();
+	Budget(bounds);
+	mNumOutput = (unsigned int)mLights.size();
+	mMinSamples = 0;
+	mMaxSamples = 0;
+	mTotalSamples = 0;
+	for (size_t i = 0; i < mLights.size(); ++i)
+	{
+		Light& light = mLights[i];
+		light.light.ies_filename = light.has_ies ? light.ies_filename.c_str() : NULL;
+		const unsigned int samples = (unsigned int)std::max(light.samples, 0);
+		mMinSamples = (i == 0) ? samples : std::min(mMinSamples, samples);
+		mMaxSamples = std::max(mMaxSamples, samples);
+		mTotalSamples += (light.light.type != EH_LIGHT_PORTAL) ? samples : 0;
+	}
+	return mLights;
+}
+
+void EssLightPlanner::PrintReport(EH_LogCallback callback) const
+{
+	if (!IsEnabled() || mNumInput == 0)
+	{
+		return;
+	}
+	if (mClusterError > 0.0f)
+	{
+		if (mReceivers.empty())
+		{
+			ess_log(callback, EH_WARNING, "Lights aren't clustered without meshes to light\n");
+		}
+		ess_log(callback, EH_INFO, "Clustered %u lights into %u\n", mNumInput, mNumOutput);
+	}
+	if (mSampleBudget > 0)
+	{
+		ess_log(callback, EH_INFO, "Shared %u light samples of a budget of %u, %u to %u per light\n", mTotalSamples, mSampleBudget, mMinSamples, mMaxSamples);
+		if (mTotalSamples > mSampleBudget)
+		{
+			ess_log(callback, EH_WARNING, "  the budget is less than %u sample per light\n", ESS_LIGHT_MIN_SAMPLES);
+		}
+	}
+}
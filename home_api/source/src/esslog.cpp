@@ -0,0 +1,54 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "esslog.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <vector>
+
+void ess_log(EH_LogCallback callback, EH_Severity severity, const char* format, ...)
+{
+	va_list args;
+	if (callback == NULL)
+	{
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+		return;
+	}
+
+	char text[1024];
+	va_start(args, format);
+	int size = vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	if (size < 0)
+	{
+		return;
+	}
+	if ((size_t)size < sizeof(text))
+	{
+		callback(severity, text);
+		return;
+	}
+
+	// long mesh or texture names
+	std::vector<char> buffer((size_t)size + 1);
+	va_start(args, format);
+	vsnprintf(&buffer[0], buffer.size(), format, args);
+	va_end(args);
+	callback(severity, &buffer[0]);
+}
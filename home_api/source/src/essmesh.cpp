@@ -0,0 +1,348 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#include "essmesh.h"
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#define ESS_INVALID_INDEX 0xFFFFFFFFu
+/* Welded normals and UVs must match within these */
+#define ESS_WELD_NORMAL_TOLERANCE 1e-3f
+#define ESS_WELD_UV_TOLERANCE 1e-5f
+
+static inline bool NearlyEqual(const eiVector& a, const eiVector& b, float tolerance)
+{
+	return fabsf(a.x - b.x) <= tolerance && fabsf(a.y - b.y) <= tolerance && fabsf(a.z - b.z) <= tolerance;
+}
+
+static inline bool NearlyEqual(const eiVector2& a, const eiVector2& b, float tolerance)
+{
+	return fabsf(a.x - b.x) <= tolerance && fabsf(a.y - b.y) <= tolerance;
+}
+
+static inline unsigned long long CellKey(long long x, long long y, long long z)
+{
+	// 21 bits per axis, collisions only cost a comparison
+	return ((unsigned long long)(x & 0x1FFFFF) << 42) | ((unsigned long long)(y & 0x1FFFFF) << 21) | (unsigned long long)(z & 0x1FFFFF);
+}
+
+/** Compact a facevarying array to the values its indices reference,
+ * bitwise identical values are merged when welding.
+ */
+template <typename T>
+static void CompactFaceVarying(const T* src, uint_t count, std::vector<uint_t>& indices, std::vector<T>& dst, bool weld)
+{
+	std::vector<uint_t> remap(count, ESS_INVALID_INDEX);
+	std::unordered_map<std::string, uint_t> values;
+	dst.clear();
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		const uint_t index = indices[i];
+		if (remap[index] == ESS_INVALID_INDEX)
+		{
+			if (weld)
+			{
+				std::pair<std::unordered_map<std::string, uint_t>::iterator, bool> inserted =
+					values.insert(std::make_pair(std::string((const char*)&src[index], sizeof(T)), (uint_t)dst.size()));
+				if (inserted.second)
+				{
+					dst.push_back(src[index]);
+				}
+				remap[index] = inserted.first->second;
+			}
+			else
+			{
+				remap[index] = (uint_t)dst.size();
+				dst.push_back(src[index]);
+			}
+		}
+		indices[i] = remap[index];
+	}
+}
+
+/* Spread the low 21 bits of x to every third bit */
+static inline unsigned long long SpreadBits(unsigned long long x)
+{
+	x &= 0x1FFFFF;
+	x = (x | (x << 32)) & 0x1F00000000FFFFULL;
+	x = (x | (x << 16)) & 0x1F0000FF0000FFULL;
+	x = (x | (x << 8)) & 0x100F00F00F00F00FULL;
+	x = (x | (x << 4)) & 0x10C30C30C30C30C3ULL;
+	x = (x | (x << 2)) & 0x1249249249249249ULL;
+	return x;
+}
+
+template <typename T>
+static void PermuteTriangles(std::vector<T>& values, const std::vector<uint_t>& order, size_t stride)
+{
+	if (values.empty())
+	{
+		return;
+	}
+	std::vector<T> permuted(values.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		for (size_t k = 0; k < stride; ++k)
+		{
+			permuted[i * stride + k] = values[order[i] * stride + k];
+		}
+	}
+	values.swap(permuted);
+}
+
+void ess_reorder_triangles(const EH_Mesh& model, EssMeshArrays& mesh)
+{
+	const size_t numTris = mesh.vert_indices.size() / 3;
+	if (numTris < 2)
+	{
+		return;
+	}
+
+	const eiVector* verts = (const eiVector*)model.verts;
+	std::vector<eiVector> centroids(numTris);
+	eiVector bmin = ei_vector(FLT_MAX, FLT_MAX, FLT_MAX);
+	eiVector bmax = ei_vector(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (size_t i = 0; i < numTris; ++i)
+	{
+		const eiVector& p0 = verts[mesh.vert_indices[i * 3]];
+		const eiVector& p1 = verts[mesh.vert_indices[i * 3 + 1]];
+		const eiVector& p2 = verts[mesh.vert_indices[i * 3 + 2]];
+		eiVector& c = centroids[i];
+		c.x = (p0.x + p1.x + p2.x) / 3.0f;
+		c.y = (p0.y + p1.y + p2.y) / 3.0f;
+		c.z = (p0.z + p1.z + p2.z) / 3.0f;
+		bmin.x = std::min(bmin.x, c.x); bmax.x = std::max(bmax.x, c.x);
+		bmin.y = std::min(bmin.y, c.y); bmax.y = std::max(bmax.y, c.y);
+		bmin.z = std::min(bmin.z, c.z); bmax.z = std::max(bmax.z, c.z);
+	}
+
+	// quantize to 21 bits per axis, ties keep the host order
+	const float extent = std::max(bmax.x - bmin.x, std::max(bmax.y - bmin.y, bmax.z - bmin.z));
+	const float scale = (extent > 0.0f) ? (float)0x1FFFFF / extent : 0.0f;
+	std::vector<std::pair<unsigned long long, uint_t> > keys(numTris);
+	for (size_t i = 0; i < numTris; ++i)
+	{
+		const eiVector& c = centroids[i];
+		const unsigned long long x = (unsigned long long)((c.x - bmin.x) * scale);
+		const unsigned long long y = (unsigned long long)((c.y - bmin.y) * scale);
+		const unsigned long long z = (unsigned long long)((c.z - bmin.z) * scale);
+		keys[i].first = SpreadBits(x) | (SpreadBits(y) << 1) | (SpreadBits(z) << 2);
+		keys[i].second = (uint_t)i;
+	}
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<uint_t> order(numTris);
+	for (size_t i = 0; i < numTris; ++i)
+	{
+		order[i] = keys[i].second;
+	}
+	PermuteTriangles(mesh.vert_indices, order, 3);
+	PermuteTriangles(mesh.n_indices, order, 3);
+	PermuteTriangles(mesh.uv_indices, order, 3);
+	PermuteTriangles(mesh.mtl_indices, order, 1);
+}
+
+template <typename T>
+static void GatherTriangles(const std::vector<T>& values, const uint_t* triangles, size_t count, size_t stride, std::vector<T>& dst)
+{
+	if (values.empty())
+	{
+		return;
+	}
+	dst.resize(count * stride);
+	for (size_t i = 0; i < count; ++i)
+	{
+		for (size_t k = 0; k < stride; ++k)
+		{
+			dst[i * stride + k] = values[triangles[i] * stride + k];
+		}
+	}
+}
+
+void ess_split_triangles(const EH_Mesh& model, const EssMeshArrays& mesh, size_t maxTriangles, std::vector<EssMeshArrays>& clusters)
+{
+	clusters.clear();
+	const size_t numTris = mesh.vert_indices.size() / 3;
+	if (maxTriangles == 0 || numTris == 0)
+	{
+		return;
+	}
+
+	const eiVector* verts = (const eiVector*)model.verts;
+	std::vector<eiVector> centroids(numTris);
+	std::vector<uint_t> triangles(numTris);
+	for (size_t i = 0; i < numTris; ++i)
+	{
+		const eiVector& p0 = verts[mesh.vert_indices[i * 3]];
+		const eiVector& p1 = verts[mesh.vert_indices[i * 3 + 1]];
+		const eiVector& p2 = verts[mesh.vert_indices[i * 3 + 2]];
+		centroids[i] = ei_vector((p0.x + p1.x + p2.x) / 3.0f, (p0.y + p1.y + p2.y) / 3.0f, (p0.z + p1.z + p2.z) / 3.0f);
+		triangles[i] = (uint_t)i;
+	}
+
+	// k-d tree build, the leaves become the clusters
+	std::vector<std::pair<size_t, size_t> > stack;
+	stack.push_back(std::make_pair((size_t)0, numTris));
+	while (!stack.empty())
+	{
+		const size_t begin = stack.back().first;
+		const size_t end = stack.back().second;
+		stack.pop_back();
+
+		if (end - begin <= maxTriangles)
+		{
+			// triangles keep their host order inside a cluster
+			std::sort(triangles.begin() + begin, triangles.begin() + end);
+			clusters.push_back(EssMeshArrays());
+			EssMeshArrays& cluster = clusters.back();
+			const uint_t* first = &triangles[begin];
+			GatherTriangles(mesh.vert_indices, first, end - begin, 3, cluster.vert_indices);
+			GatherTriangles(mesh.n_indices, first, end - begin, 3, cluster.n_indices);
+			GatherTriangles(mesh.uv_indices, first, end - begin, 3, cluster.uv_indices);
+			GatherTriangles(mesh.mtl_indices, first, end - begin, 1, cluster.mtl_indices);
+			continue;
+		}
+
+		eiVector bmin = centroids[triangles[begin]];
+		eiVector bmax = bmin;
+		for (size_t i = begin + 1; i < end; ++i)
+		{
+			const eiVector& c = centroids[triangles[i]];
+			bmin.x = std::min(bmin.x, c.x); bmax.x = std::max(bmax.x, c.x);
+			bmin.y = std::min(bmin.y, c.y); bmax.y = std::max(bmax.y, c.y);
+			bmin.z = std::min(bmin.z, c.z); bmax.z = std::max(bmax.z, c.z);
+		}
+		const eiVector size = ei_vector(bmax.x - bmin.x, bmax.y - bmin.y, bmax.z - bmin.z);
+		const int axis = (size.x >= size.y && size.x >= size.z) ? 0 : ((size.y >= size.z) ? 1 : 2);
+
+		const size_t middle = begin + (end - begin) / 2;
+		std::nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end,
+			[&centroids, axis](uint_t a, uint_t b)
+		{
+			return (&centroids[a].x)[axis] < (&centroids[b].x)[axis];
+		});
+		stack.push_back(std::make_pair(middle, end));
+		stack.push_back(std::make_pair(begin, middle));
+	}
+}
+
+void ess_compact_mesh(const EH_Mesh& model, EssMeshArrays& mesh, float weldTolerance)
+{
+	const eiVector* verts = (const eiVector*)model.verts;
+	const eiVector* normals = (const eiVector*)model.normals;
+	const eiVector2* uvs = (const eiVector2*)model.uvs;
+	const bool varyingNormals = normals != NULL && model.n_indices == NULL;
+	const bool varyingUVs = uvs != NULL && model.uv_indices == NULL;
+
+	mesh.verts.clear();
+	mesh.normals.clear();
+	mesh.uvs.clear();
+
+	float tolerance = 0.0f;
+	if (weldTolerance > 0.0f && !mesh.vert_indices.empty())
+	{
+		eiVector bmin = verts[mesh.vert_indices[0]];
+		eiVector bmax = bmin;
+		for (size_t i = 1; i < mesh.vert_indices.size(); ++i)
+		{
+			const eiVector& p = verts[mesh.vert_indices[i]];
+			bmin.x = std::min(bmin.x, p.x); bmax.x = std::max(bmax.x, p.x);
+			bmin.y = std::min(bmin.y, p.y); bmax.y = std::max(bmax.y, p.y);
+			bmin.z = std::min(bmin.z, p.z); bmax.z = std::max(bmax.z, p.z);
+		}
+		const float dx = bmax.x - bmin.x, dy = bmax.y - bmin.y, dz = bmax.z - bmin.z;
+		tolerance = weldTolerance * sqrtf(dx * dx + dy * dy + dz * dz);
+	}
+	const bool weld = tolerance > 0.0f;
+	const float cellSize = weld ? tolerance : 1.0f;
+
+	// vertices are numbered in the order of first use
+	std::vector<uint_t> remap(model.num_verts, ESS_INVALID_INDEX);
+	std::unordered_map<unsigned long long, std::vector<uint_t> > grid;
+	for (size_t i = 0; i < mesh.vert_indices.size(); ++i)
+	{
+		const uint_t index = mesh.vert_indices[i];
+		if (remap[index] == ESS_INVALID_INDEX)
+		{
+			const eiVector& p = verts[index];
+			uint_t welded = ESS_INVALID_INDEX;
+			long long cx = 0, cy = 0, cz = 0;
+			if (weld)
+			{
+				cx = (long long)floorf(p.x / cellSize);
+				cy = (long long)floorf(p.y / cellSize);
+				cz = (long long)floorf(p.z / cellSize);
+				for (int dx = -1; dx <= 1 && welded == ESS_INVALID_INDEX; ++dx)
+				{
+					for (int dy = -1; dy <= 1 && welded == ESS_INVALID_INDEX; ++dy)
+					{
+						for (int dz = -1; dz <= 1 && welded == ESS_INVALID_INDEX; ++dz)
+						{
+							std::unordered_map<unsigned long long, std::vector<uint_t> >::const_iterator cell = grid.find(CellKey(cx + dx, cy + dy, cz + dz));
+							if (cell == grid.end())
+							{
+								continue;
+							}
+							for (size_t j = 0; j < cell->second.size(); ++j)
+							{
+								const uint_t other = cell->second[j];
+								if (NearlyEqual(mesh.verts[other], p, tolerance) &&
+									(!varyingNormals || NearlyEqual(mesh.normals[other], normals[index], ESS_WELD_NORMAL_TOLERANCE)) &&
+									(!varyingUVs || NearlyEqual(mesh.uvs[other], uvs[index], ESS_WELD_UV_TOLERANCE)))
+								{
+									welded = other;
+									break;
+								}
+							}
+						}
+					}
+				}
+			}
+			if (welded == ESS_INVALID_INDEX)
+			{
+				welded = (uint_t)mesh.verts.size();
+				mesh.verts.push_back(p);
+				if (varyingNormals)
+				{
+					mesh.normals.push_back(normals[index]);
+				}
+				if (varyingUVs)
+				{
+					mesh.uvs.push_back(uvs[index]);
+				}
+				if (weld)
+				{
+					grid[CellKey(cx, cy, cz)].push_back(welded);
+				}
+			}
+			remap[index] = welded;
+		}
+		mesh.vert_indices[i] = remap[index];
+	}
+
+	if (normals != NULL && !varyingNormals)
+	{
+		CompactFaceVarying(normals, model.num_verts, mesh.n_indices, mesh.normals, weld);
+	}
+	if (uvs != NULL && !varyingUVs)
+	{
+		CompactFaceVarying(uvs, model.num_verts, mesh.uv_indices, mesh.uvs, weld);
+	}
+}
@@ -0,0 +1,193 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#include "esspipeline.h"
+#include "esswriter.h"
+
+/* Buffer size of the private writer of a job */
+#define ESS_PIPELINE_JOB_BUFFER_SIZE (64 * 1024)
+
+EssPipeline::EssPipeline() :
+	mOutput(NULL),
+	mStats(NULL),
+	mEncoding(false),
+	mMaxPending(0),
+	mNumPending(0),
+	mJobBytes(0),
+	mStop(false),
+	mFailed(false)
+{
+}
+
+EssPipeline::~EssPipeline()
+{
+	Stop();
+}
+
+void EssPipeline::Start(EssOutputSink* output, bool encoding, unsigned int numThreads, size_t maxPending, EssExportStats* stats)
+{
+	Stop();
+
+	if (numThreads == 0)
+	{
+		numThreads = std::thread::hardware_concurrency();
+		if (numThreads == 0)
+		{
+			numThreads = 1;
+		}
+	}
+	mOutput = output;
+	mStats = stats;
+	mEncoding = encoding;
+	mMaxPending = maxPending > 0 ? maxPending : 1;
+	mNumPending = 0;
+	mJobBytes = 0;
+	mStop = false;
+	mFailed = false;
+	for (unsigned int i = 0; i < numThreads; ++i)
+	{
+		mThreads.push_back(std::thread(&EssPipeline::WorkerLoop, this));
+	}
+}
+
+void EssPipeline::WorkerLoop()
+{
+	EssWriter writer;
+	writer.SetStats(mStats);
+	for (;;)
+	{
+		std::pair<Job, Segment*> job;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			while (mJobs.empty() && !mStop)
+			{
+				mJobReady.wait(lock);
+			}
+			if (mJobs.empty())
+			{
+				return;
+			}
+			job = mJobs.front();
+			mJobs.pop_front();
+		}
+
+		EssMemorySink sink(ESS_PIPELINE_JOB_BUFFER_SIZE);
+		writer.InitializeFragment(&sink, mEncoding, ESS_PIPELINE_JOB_BUFFER_SIZE);
+		bool ok = job.first(writer);
+		ok = writer.Close() && ok;
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!ok)
+		{
+			mFailed = true;
+		}
+		sink.Release(job.second->data);
+		mJobBytes += job.second->data.size();
+		job.second->done = true;
+		-- mNumPending;
+		DrainLocked();
+		mJobDone.notify_all();
+	}
+}
+
+void EssPipeline::DrainLocked()
+{
+	while (!mSegments.empty() && mSegments.front()->done)
+	{
+		Segment* segment = mSegments.front();
+		if (!segment->data.empty() && !mOutput->Write(&segment->data[0], segment->data.size()))
+		{
+			mFailed = true;
+		}
+		mSegments.pop_front();
+		delete segment;
+	}
+}
+
+void EssPipeline::Submit(const Job& job)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (mNumPending >= mMaxPending)
+	{
+		mJobDone.wait(lock);
+	}
+	Segment* segment = new Segment();
+	segment->done = false;
+	mSegments.push_back(segment);
+	mJobs.push_back(std::make_pair(job, segment));
+	++ mNumPending;
+	mJobReady.notify_one();
+}
+
+bool EssPipeline::Wait()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (mNumPending > 0)
+	{
+		mJobDone.wait(lock);
+	}
+	DrainLocked();
+	return !mFailed;
+}
+
+void EssPipeline::Stop()
+{
+	if (mThreads.empty())
+	{
+		return;
+	}
+	Wait();
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mJobReady.notify_all();
+	for (size_t i = 0; i < mThreads.size(); ++i)
+	{
+		mThreads[i].join();
+	}
+	mThreads.clear();
+}
+
+bool EssPipeline::Write(const char* data, size_t size)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mSegments.empty())
+	{
+		return mOutput->Write(data, size) && !mFailed;
+	}
+	// hold the bytes behind the jobs still in flight
+	if (!mSegments.back()->done)
+	{
+		Segment* segment = new Segment();
+		segment->done = true;
+		mSegments.push_back(segment);
+	}
+	std::vector<char>& tail = mSegments.back()->data;
+	tail.insert(tail.end(), data, data + size);
+	return !mFailed;
+}
+
+bool EssPipeline::Flush()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!mSegments.empty())
+	{
+		// the output is flushed once the pending jobs are written
+		return !mFailed;
+	}
+	return mOutput->Flush() && !mFailed;
+}
@@ -0,0 +1,230 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "essprune.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+
+/* Instances this large relative to the prune distance enclose rooms,
+ * aggressive pruning keeps them for their shadows */
+#define ESS_PRUNE_OCCLUDER_SIZE 0.25f
+/* Names of pruned instances listed in the report */
+#define ESS_PRUNE_REPORT_NAMES 10
+
+static inline float Dot(const eiVector& a, const eiVector& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+EssInstancePruner::EssInstancePruner() :
+	mMode(EH_PRUNE_OFF),
+	mMargin(0.0f),
+	mDistance(0.0f),
+	mNumKept(0),
+	mNumPruned(0),
+	mNumOccluders(0),
+	mNumLighting(0)
+{
+}
+
+void EssInstancePruner::Reset(EH_PruneMode mode, float margin, float distance)
+{
+	mMode = mode;
+	mMargin = std::max(margin, 0.0f);
+	mDistance = std::max(distance, 0.0f);
+	mCameras.clear();
+	mLightingMaterials.clear();
+	mNumKept = 0;
+	mNumPruned = 0;
+	mNumOccluders = 0;
+	mNumLighting = 0;
+	mPruned.clear();
+	mLighting.clear();
+}
+
+void EssInstancePruner::AddCamera(const EH_Camera& cam, bool panorama, bool leftHanded)
+{
+	if (mMode == EH_PRUNE_OFF)
+	{
+		return;
+	}
+	// the same transform and film as AddCameraData writes
+	const eiMatrix& m = *((const eiMatrix*)cam.view_to_world);
+	const float flip = leftHanded ? -1.0f : 1.0f;
+	Camera camera;
+	camera.position = ei_vector(m.m[3][0], m.m[3][1], m.m[3][2] * flip);
+	for (int i = 0; i < 3; ++i)
+	{
+		eiVector axis = ei_vector(m.m[i][0], m.m[i][1], m.m[i][2] * flip);
+		const float length = sqrtf(Dot(axis, axis));
+		camera.axes[i] = (length > 0.0f) ? ei_vector(axis.x / length, axis.y / length, axis.z / length) : axis;
+	}
+	const float aspect = (cam.aspect <= 0.0f) ? (float)cam.image_width / (float)cam.image_height : cam.aspect;
+	camera.tan_y = tanf(cam.fov / 2.0f) * (1.0f + mMargin);
+	camera.tan_x = camera.tan_y * aspect;
+	camera.far_clip = (cam.far_clip > 0.0f) ? cam.far_clip * (1.0f + mMargin) : 0.0f;
+	// tilt correction bends the view, don't guess at it
+	camera.all_around = panorama || cam.cubemap_render || cam.spherical_render || cam.vertical_tilt_correction ||
+		!(camera.tan_x > 0.0f) || !_finite(camera.tan_x) || !(camera.tan_y > 0.0f) || !_finite(camera.tan_y);
+	mCameras.push_back(camera);
+}
+
+void EssInstancePruner::AddMaterial(const std::string& name, const EH_Material& mat)
+{
+	if (mMode == EH_PRUNE_OFF)
+	{
+		return;
+	}
+	const bool emissive = mat.emission_weight > 0.0f &&
+		((mat.emission_tex.filename != NULL && mat.emission_tex.filename[0] != '\0') ||
+		mat.emission_color[0] > 0.0f || mat.emission_color[1] > 0.0f || mat.emission_color[2] > 0.0f);
+	const bool reflective = mat.mirror_weight > 0.0f;
+	const float refraction = mat.refract_invert_weight ? 1.0f - mat.refract_weight : mat.refract_weight;
+	const bool refractive = refraction > 0.0f || (mat.refract_tex.filename != NULL && mat.refract_tex.filename[0] != '\0');
+	if (emissive || reflective || refractive)
+	{
+		mLightingMaterials.insert(name);
+	}
+	else
+	{
+		mLightingMaterials.erase(name);
+	}
+}
+
+bool EssInstancePruner::HasLightingMaterial(const EH_MeshInstance& meshInst) const
+{
+	for (uint_t i = 0; i < MAX_NUM_MTLS; ++i)
+	{
+		if (meshInst.mtl_names[i] != NULL && mLightingMaterials.find(meshInst.mtl_names[i]) != mLightingMaterials.end())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool EssInstancePruner::IsInView(const Camera& camera, const EssSceneBounds::Box& box) const
+{
+	if (camera.all_around)
+	{
+		return true;
+	}
+	// the box is outside when all its corners are outside one plane of the view
+	unsigned int outside = 0x3f;
+	for (int c = 0; c < 8 && outside != 0; ++c)
+	{
+		const eiVector corner = ei_vector((c & 1) ? box.hi.x : box.lo.x, (c & 2) ? box.hi.y : box.lo.y, (c & 4) ? box.hi.z : box.lo.z);
+		const eiVector d = ei_vector(corner.x - camera.position.x, corner.y - camera.position.y, corner.z - camera.position.z);
+		const float x = Dot(d, camera.axes[0]);
+		const float y = Dot(d, camera.axes[1]);
+		const float depth = -Dot(d, camera.axes[2]);
+		unsigned int flags = 0;
+		flags |= (depth <= 0.0f) ? 0x01 : 0;
+		flags |= (camera.far_clip > 0.0f && depth > camera.far_clip) ? 0x02 : 0;
+		flags |= (x > camera.tan_x * depth) ? 0x04 : 0;
+		flags |= (-x > camera.tan_x * depth) ? 0x08 : 0;
+		flags |= (y > camera.tan_y * depth) ? 0x10 : 0;
+		flags |= (-y > camera.tan_y * depth) ? 0x20 : 0;
+		outside &= flags;
+	}
+	return outside == 0;
+}
+
+bool EssInstancePruner::Keep(const std::string& instName, const EH_MeshInstance& meshInst, const EssSceneBounds& bounds)
+{
+	if (mMode == EH_PRUNE_OFF)
+	{
+		return true;
+	}
+	EssSceneBounds::Box box;
+	if (mCameras.empty() || !bounds.GetWorldBounds(meshInst.mesh_name, *((const eiMatrix*)meshInst.mesh_to_world), box))
+	{
+		++ mNumKept;
+		return true;
+	}
+
+	float nearest = FLT_MAX;
+	for (size_t i = 0; i < mCameras.size(); ++i)
+	{
+		if (IsInView(mCameras[i], box))
+		{
+			++ mNumKept;
+			return true;
+		}
+		nearest = std::min(nearest, EssSceneBounds::Distance(mCameras[i].position, box));
+	}
+
+	// unseen instances close by may still shadow or enclose what is seen
+	if (nearest <= mDistance)
+	{
+		const float size = std::max(box.hi.x - box.lo.x, std::max(box.hi.y - box.lo.y, box.hi.z - box.lo.z));
+		if (mMode == EH_PRUNE_CONSERVATIVE || size >= ESS_PRUNE_OCCLUDER_SIZE * mDistance)
+		{
+			++ mNumKept;
+			++ mNumOccluders;
+			return true;
+		}
+	}
+	if (HasLightingMaterial(meshInst))
+	{
+		++ mNumKept;
+		++ mNumLighting;
+		if (mLighting.size() < ESS_PRUNE_REPORT_NAMES)
+		{
+			mLighting.push_back(instName);
+		}
+		return true;
+	}
+	++ mNumPruned;
+	if (mPruned.size() < ESS_PRUNE_REPORT_NAMES)
+	{
+		mPruned.push_back(instName);
+	}
+	return false;
+}
+
+void EssInstancePruner::PrintReport(EH_LogCallback callback) const
+{
+	if (mMode == EH_PRUNE_OFF)
+	{
+		return;
+	}
+	ess_log(callback, EH_INFO, "Pruned %u of %u instances out of view, kept %u unseen nearby for shadows\n",
+		mNumPruned, mNumPruned + mNumKept, mNumOccluders);
+	for (size_t i = 0; i < mPruned.size(); ++i)
+	{
+		ess_log(callback, EH_INFO, "  pruned %s\n", mPruned[i].c_str());
+	}
+	if (mNumPruned > mPruned.size())
+	{
+		ess_log(callback, EH_INFO, "  and %u more\n", mNumPruned - (unsigned int)mPruned.size());
+	}
+	if (mNumLighting > 0)
+	{
+		ess_log(callback, EH_INFO, "Kept %u instances out of view for their emissive, reflective or refractive materials\n", mNumLighting);
+		for (size_t i = 0; i < mLighting.size(); ++i)
+		{
+			ess_log(callback, EH_INFO, "  kept %s\n", mLighting[i].c_str());
+		}
+		if (mNumLighting > mLighting.size())
+		{
+			ess_log(callback, EH_INFO, "  and %u more\n", mNumLighting - (unsigned int)mLighting.size());
+		}
+	}
+}
@@ -0,0 +1,503 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#ifndef _GNU_SOURCE
+#	define _GNU_SOURCE	/* O_DIRECT */
+#endif
+
+#include "esssink.h"
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#	include <Windows.h>
+#	include <io.h>
+#	include <malloc.h>
+#else
+#	include <unistd.h>
+#	include <fcntl.h>
+#	include <errno.h>
+#endif
+
+static void *aligned_alloc_buffer(size_t size)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, ESS_SINK_BUFFER_ALIGNMENT);
+#else
+	void *ptr = NULL;
+	if (posix_memalign(&ptr, ESS_SINK_BUFFER_ALIGNMENT, size) != 0)
+	{
+		return NULL;
+	}
+	return ptr;
+#endif
+}
+
+static void aligned_free_buffer(void *ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+EssFileSink::EssFileSink() :
+#ifdef _WIN32
+	mHandle(INVALID_HANDLE_VALUE),
+#else
+	mFd(-1),
+#endif
+	mDirect(false),
+	mBounce(NULL)
+{
+}
+
+EssFileSink::~EssFileSink()
+{
+	Close();
+	if (mBounce)
+	{
+		aligned_free_buffer(mBounce);
+	}
+}
+
+bool EssFileSink::Open(const char* filename, const EssFileSinkOptions& options)
+{
+	Close();
+	mOptions = options;
+	mFilename = filename;
+	mDirect = options.direct_io;
+
+#ifdef _WIN32
+	DWORD flags = FILE_ATTRIBUTE_NORMAL;
+	if (options.sequential)
+	{
+		flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+	}
+	if (mDirect)
+	{
+		flags |= FILE_FLAG_NO_BUFFERING;
+	}
+	mHandle = CreateFileA(filename, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, flags, NULL);
+	if (mHandle == INVALID_HANDLE_VALUE && mDirect)
+	{
+		mDirect = false;
+		flags &= ~FILE_FLAG_NO_BUFFERING;
+		mHandle = CreateFileA(filename, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, flags, NULL);
+	}
+	return mHandle != INVALID_HANDLE_VALUE;
+#else
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+	if (mDirect)
+	{
+		mFd = open(filename, flags | O_DIRECT, 0644);
+	}
+#endif
+	if (mFd < 0)
+	{
+		// the file system may not support direct I/O
+		mDirect = false;
+		mFd = open(filename, flags, 0644);
+	}
+	if (mFd < 0)
+	{
+		return false;
+	}
+#ifdef POSIX_FADV_SEQUENTIAL
+	if (options.sequential)
+	{
+		posix_fadvise(mFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+#endif
+	return true;
+#endif
+}
+
+bool EssFileSink::IsOpen() const
+{
+#ifdef _WIN32
+	return mHandle != INVALID_HANDLE_VALUE;
+#else
+	return mFd >= 0;
+#endif
+}
+
+void EssFileSink::DisableDirectIO()
+{
+	if (!mDirect)
+	{
+		return;
+	}
+	mDirect = false;
+#ifdef _WIN32
+	// unbuffered handles can't write partial sectors, reopen for the tail
+	CloseHandle(mHandle);
+	DWORD flags = FILE_ATTRIBUTE_NORMAL;
+	if (mOptions.sequential)
+	{
+		flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+	}
+	mHandle = CreateFileA(mFilename.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+	if (mHandle != INVALID_HANDLE_VALUE)
+	{
+		SetFilePointer(mHandle, 0, NULL, FILE_END);
+	}
+#elif defined(O_DIRECT)
+	fcntl(mFd, F_SETFL, fcntl(mFd, F_GETFL) & ~O_DIRECT);
+#endif
+}
+
+bool EssFileSink::Write(const char* data, size_t size)
+{
+	if (!IsOpen())
+	{
+		return false;
+	}
+	if (mDirect && (size % ESS_SINK_BUFFER_ALIGNMENT) != 0)
+	{
+		DisableDirectIO();
+		if (!IsOpen())
+		{
+			return false;
+		}
+	}
+	if (!mDirect || ((size_t)data % ESS_SINK_BUFFER_ALIGNMENT) == 0)
+	{
+		return WriteAll(data, size);
+	}
+
+	// pipeline segments are aligned in size only, copy them to aligned memory
+	if (mBounce == NULL)
+	{
+		mBounce = (char *)aligned_alloc_buffer(ESS_SINK_BOUNCE_SIZE);
+		if (mBounce == NULL)
+		{
+			DisableDirectIO();
+			return IsOpen() && WriteAll(data, size);
+		}
+	}
+	while (size > 0)
+	{
+		const size_t chunk = size < ESS_SINK_BOUNCE_SIZE ? size : ESS_SINK_BOUNCE_SIZE;
+		memcpy(mBounce, data, chunk);
+		if (!WriteAll(mBounce, chunk))
+		{
+			return false;
+		}
+		data += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+bool EssFileSink::WriteAll(const char* data, size_t size)
+{
+	while (size > 0)
+	{
+#ifdef _WIN32
+		DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+		DWORD written = 0;
+		if (!WriteFile(mHandle, data, chunk, &written, NULL))
+		{
+			return false;
+		}
+#else
+		ssize_t written = write(mFd, data, size);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+#endif
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+bool EssFileSink::Flush()
+{
+	return IsOpen();
+}
+
+bool EssFileSink::Close()
+{
+	bool ok = true;
+#ifdef _WIN32
+	if (mHandle != INVALID_HANDLE_VALUE)
+	{
+		ok = CloseHandle(mHandle) != 0;
+		mHandle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (mFd >= 0)
+	{
+#ifdef POSIX_FADV_DONTNEED
+		if (mOptions.drop_cache)
+		{
+			fdatasync(mFd);
+			posix_fadvise(mFd, 0, 0, POSIX_FADV_DONTNEED);
+		}
+#endif
+		// NFS and quota errors may only be reported here
+		ok = close(mFd) == 0;
+		mFd = -1;
+	}
+#endif
+	return ok;
+}
+
+EssMemorySink::EssMemorySink(size_t reserve) :
+	mSize(0)
+{
+	mData.reserve(reserve);
+}
+
+bool EssMemorySink::Write(const char* data, size_t size)
+{
+	if (mSize + size > mData.size())
+	{
+		size_t capacity = mData.size() * 2;
+		if (capacity < mSize + size)
+		{
+			capacity = mSize + size;
+		}
+		mData.resize(capacity);
+	}
+	memcpy(&mData[mSize], data, size);
+	mSize += size;
+	return true;
+}
+
+void EssMemorySink::Release(std::vector<char>& data)
+{
+	mData.resize(mSize);
+	data.swap(mData);
+	mData.clear();
+	mSize = 0;
+}
+
+EssFdSink::EssFdSink(int fd, bool ownsFd) :
+	mFd(fd),
+	mOwnsFd(ownsFd)
+{
+}
+
+EssFdSink::~EssFdSink()
+{
+	Close();
+}
+
+bool EssFdSink::Write(const char* data, size_t size)
+{
+	if (mFd < 0)
+	{
+		return false;
+	}
+	while (size > 0)
+	{
+#ifdef _WIN32
+		unsigned int chunk = size > 0x40000000 ? 0x40000000 : (unsigned int)size;
+		int written = _write(mFd, data, chunk);
+		if (written < 0)
+		{
+			return false;
+		}
+#else
+		ssize_t written = write(mFd, data, size);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+#endif
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+bool EssFdSink::Close()
+{
+	bool ok = true;
+	if (mFd >= 0 && mOwnsFd)
+	{
+#ifdef _WIN32
+		ok = _close(mFd) == 0;
+#else
+		ok = close(mFd) == 0;
+#endif
+	}
+	mFd = -1;
+	return ok;
+}
+
+EssSinkBuffer::EssSinkBuffer() :
+	mSink(NULL),
+	mBuffer(NULL),
+	mBufferSize(0),
+	mBytesWritten(0),
+	mWriteCalls(0),
+	mFailed(false)
+{
+}
+
+EssSinkBuffer::~EssSinkBuffer()
+{
+	Detach();
+	if (mBuffer)
+	{
+		aligned_free_buffer(mBuffer);
+		mBuffer = NULL;
+	}
+}
+
+bool EssSinkBuffer::Attach(EssOutputSink *sink, size_t bufferSize)
+{
+	Detach();
+
+	// keep the buffer a multiple of the alignment for direct I/O
+	bufferSize = (bufferSize + ESS_SINK_BUFFER_ALIGNMENT - 1) & ~(size_t)(ESS_SINK_BUFFER_ALIGNMENT - 1);
+	if (bufferSize == 0)
+	{
+		bufferSize = ESS_SINK_BUFFER_ALIGNMENT;
+	}
+	if (mBuffer == NULL || mBufferSize != bufferSize)
+	{
+		if (mBuffer)
+		{
+			aligned_free_buffer(mBuffer);
+		}
+		mBuffer = (char *)aligned_alloc_buffer(bufferSize);
+		mBufferSize = mBuffer != NULL ? bufferSize : 0;
+	}
+
+	mBytesWritten = 0;
+	mWriteCalls = 0;
+	if (mBuffer == NULL)
+	{
+		// stay detached, the stream goes bad on the first write
+		mFailed = true;
+		setp(NULL, NULL);
+		return false;
+	}
+	mSink = sink;
+	mFailed = false;
+	setp(mBuffer, mBuffer + mBufferSize);
+	return true;
+}
+
+bool EssSinkBuffer::Detach()
+{
+	if (mSink == NULL)
+	{
+		return !mFailed;
+	}
+	FlushBuffer();
+	if (!mSink->Flush())
+	{
+		mFailed = true;
+	}
+	mSink = NULL;
+	setp(NULL, NULL);
+	return !mFailed;
+}
+
+void EssSinkBuffer::Redirect(EssOutputSink *sink)
+{
+	if (mSink == NULL)
+	{
+		return;
+	}
+	FlushBuffer();
+	mSink = sink;
+}
+
+bool EssSinkBuffer::FlushBuffer()
+{
+	size_t size = pptr() - pbase();
+	if (size > 0 && mSink != NULL)
+	{
+		if (!mSink->Write(pbase(), size))
+		{
+			mFailed = true;
+		}
+		mBytesWritten += size;
+		++ mWriteCalls;
+	}
+	setp(mBuffer, mBuffer + mBufferSize);
+	return !mFailed;
+}
+
+EssSinkBuffer::int_type EssSinkBuffer::overflow(int_type ch)
+{
+	if (mSink == NULL)
+	{
+		return traits_type::eof();
+	}
+	FlushBuffer();
+	if (!traits_type::eq_int_type(ch, traits_type::eof()))
+	{
+		*pptr() = traits_type::to_char_type(ch);
+		pbump(1);
+	}
+	return mFailed ? traits_type::eof() : traits_type::not_eof(ch);
+}
+
+std::streamsize EssSinkBuffer::xsputn(const char* s, std::streamsize n)
+{
+	if (mSink == NULL)
+	{
+		return 0;
+	}
+	std::streamsize remaining = n;
+	while (remaining > 0)
+	{
+		std::streamsize space = epptr() - pptr();
+		if (space == 0)
+		{
+			FlushBuffer();
+			space = epptr() - pptr();
+		}
+		std::streamsize count = remaining < space ? remaining : space;
+		memcpy(pptr(), s, (size_t)count);
+		pbump((int)count);
+		s += count;
+		remaining -= count;
+	}
+	return mFailed ? 0 : n;
+}
+
+int EssSinkBuffer::sync()
+{
+	if (mSink == NULL)
+	{
+		return 0;
+	}
+	if (!FlushBuffer() || !mSink->Flush())
+	{
+		return -1;
+	}
+	return 0;
+}
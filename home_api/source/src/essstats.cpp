@@ -0,0 +1,70 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#include "essstats.h"
+#include <stdio.h>
+
+EssExportStats::EssExportStats()
+{
+	Reset();
+}
+
+void EssExportStats::Reset()
+{
+	for (int i = 0; i < ESS_STAT_COUNT; ++i)
+	{
+		mNanoseconds[i] = 0;
+		mBytes[i] = 0;
+		mItems[i] = 0;
+	}
+}
+
+void EssExportStats::Add(EssStatCategory category, unsigned long long nanoseconds, unsigned long long bytes, unsigned long long items)
+{
+	mNanoseconds[category] += nanoseconds;
+	mBytes[category] += bytes;
+	mItems[category] += items;
+}
+
+const char* EssExportStats::GetCategoryName(EssStatCategory category)
+{
+	static const char* names[ESS_STAT_COUNT] = { "meshes", "materials", "lights", "textures", "encoding", "io" };
+	return names[category];
+}
+
+bool EssExportStats::WriteJson(const char* filename, double totalSeconds, unsigned long long outputBytes, unsigned int numThreads) const
+{
+	FILE* file = fopen(filename, "w");
+	if (file == NULL)
+	{
+		return false;
+	}
+	fprintf(file, "{\n");
+	fprintf(file, "\t\"total_seconds\": %.6f,\n", totalSeconds);
+	fprintf(file, "\t\"output_bytes\": %llu,\n", outputBytes);
+	fprintf(file, "\t\"threads\": %u,\n", numThreads);
+	fprintf(file, "\t\"categories\": {\n");
+	for (int i = 0; i < ESS_STAT_COUNT; ++i)
+	{
+		const EssStatCategory category = (EssStatCategory)i;
+		fprintf(file, "\t\t\"%s\": { \"seconds\": %.6f, \"bytes\": %llu, \"items\": %llu }%s\n",
+			GetCategoryName(category), GetSeconds(category), GetBytes(category), GetItems(category),
+			(i + 1 < ESS_STAT_COUNT) ? "," : "");
+	}
+	fprintf(file, "\t}\n");
+	fprintf(file, "}\n");
+	return fclose(file) == 0;
+}
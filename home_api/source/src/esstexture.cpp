@@ -0,0 +1,699 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "esstexture.h"
+#include "esshash.h"
+#include "essstats.h"
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef ESS_USE_OIIO
+#	include <OpenImageIO/imageio.h>
+#	include <OpenImageIO/imagebufalgo.h>
+#	if OIIO_VERSION < 20000
+#		error "The texture cache needs OpenImageIO 2.0 or newer"
+#	endif
+#endif
+
+#define ESS_TEXTURE_INDEX_NAME "index.esstex"
+#define ESS_TEXTURE_INDEX_VERSION 1
+#define ESS_TEXTURE_TILE_SIZE 64
+#define ESS_TEXTURE_READ_SIZE (1 << 20)
+#define ESS_ATLAS_PAGE_SIZE 2048
+/* Wide enough for the first mip levels to filter within each image */
+#define ESS_ATLAS_GUTTER 4
+
+static bool get_file_info(const std::string& filename, unsigned long long& mtime, unsigned long long& size)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+	{
+		return false;
+	}
+	mtime = (unsigned long long)st.st_mtime;
+	size = (unsigned long long)st.st_size;
+	return true;
+}
+
+static bool hash_file(const std::string& filename, unsigned long long& hash)
+{
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (file == NULL)
+	{
+		return false;
+	}
+	EssHash hasher;
+	std::vector<char> buffer(ESS_TEXTURE_READ_SIZE);
+	size_t count;
+	while ((count = fread(&buffer[0], 1, buffer.size(), file)) > 0)
+	{
+		hasher.Update(&buffer[0], count);
+	}
+	const bool ok = ferror(file) == 0;
+	fclose(file);
+	hash = hasher.Digest();
+	return ok;
+}
+
+/** Can the source be decoded at all? Only reads the header. */
+static bool can_convert(const std::string& source)
+{
+#ifdef ESS_USE_OIIO
+	auto input = OIIO::ImageInput::open(source);
+	return input != NULL;
+#else
+	(void)source;
+	return false;
+#endif
+}
+
+/** The size of an image with 8 bit channels, false for others. */
+static bool get_image_size(const std::string& source, int& width, int& height)
+{
+#ifdef ESS_USE_OIIO
+	auto input = OIIO::ImageInput::open(source);
+	if (input == NULL)
+	{
+		return false;
+	}
+	const OIIO::ImageSpec& spec = input->spec();
+	width = spec.width;
+	height = spec.height;
+	return spec.format == OIIO::TypeDesc::UINT8 && spec.nchannels >= 1 && spec.nchannels <= 4;
+#else
+	(void)source;
+	(void)width;
+	(void)height;
+	return false;
+#endif
+}
+
+/** Decode an image into RGBA8, gray is replicated and alpha is opaque if missing. */
+static bool read_rgba(const std::string& source, int width, int height, std::vector<unsigned char>& pixels)
+{
+#ifdef ESS_USE_OIIO
+	auto input = OIIO::ImageInput::open(source);
+	if (input == NULL)
+	{
+		return false;
+	}
+	const OIIO::ImageSpec& spec = input->spec();
+	const int channels = spec.nchannels;
+	bool ok = spec.width == width && spec.height == height && channels >= 1 && channels <= 4;
+	std::vector<unsigned char> data;
+	if (ok)
+	{
+		data.resize((size_t)width * height * channels);
+		ok = input->read_image(OIIO::TypeDesc::UINT8, &data[0]);
+	}
+	input.reset();
+	if (!ok)
+	{
+		return false;
+	}
+	const size_t numPixels = (size_t)width * height;
+	pixels.resize(numPixels * 4);
+	for (size_t i = 0; i < numPixels; ++i)
+	{
+		const unsigned char* src = &data[i * channels];
+		unsigned char* dst = &pixels[i * 4];
+		const bool gray = channels <= 2;
+		dst[0] = src[0];
+		dst[1] = gray ? src[0] : src[1];
+		dst[2] = gray ? src[0] : src[2];
+		dst[3] = (channels == 2) ? src[1] : ((channels == 4) ? src[3] : 255);
+	}
+	return true;
+#else
+	(void)source;
+	(void)width;
+	(void)height;
+	(void)pixels;
+	return false;
+#endif
+}
+
+/** Write a tiled, mip-mapped TIFF the way maketx does, downsampled so
+ * that no side exceeds maxResolution unless it's 0.
+ */
+static bool make_texture(const std::string& source, const std::string& target, unsigned int maxResolution,
+	unsigned long long& sourceTexels, unsigned long long& texels)
+{
+#ifdef ESS_USE_OIIO
+	OIIO::ImageSpec config;
+	config.tile_width = ESS_TEXTURE_TILE_SIZE;
+	config.tile_height = ESS_TEXTURE_TILE_SIZE;
+	config.tile_depth = 1;
+	config.attribute("compression", "zip");
+	config.attribute("maketx:filtername", "lanczos3");
+
+	OIIO::ImageBuf input(source);
+	if (!input.init_spec(source, 0, 0))
+	{
+		return false;
+	}
+	const OIIO::ImageSpec& spec = input.spec();
+	sourceTexels = (unsigned long long)spec.width * spec.height;
+	texels = sourceTexels;
+	const int size = std::max(spec.width, spec.height);
+	if (maxResolution == 0 || size <= (int)maxResolution)
+	{
+		return OIIO::ImageBufAlgo::make_texture(OIIO::ImageBufAlgo::MakeTxTexture, source, target, config);
+	}
+
+	const float scale = (float)maxResolution / (float)size;
+	const int width = std::max(1, (int)(spec.width * scale + 0.5f));
+	const int height = std::max(1, (int)(spec.height * scale + 0.5f));
+	OIIO::ImageBuf resized;
+	OIIO::ROI roi(0, width, 0, height, 0, 1, 0, spec.nchannels);
+	if (!OIIO::ImageBufAlgo::resize(resized, input, "lanczos3", 0.0f, roi))
+	{
+		return false;
+	}
+	texels = (unsigned long long)width * height;
+	return OIIO::ImageBufAlgo::make_texture(OIIO::ImageBufAlgo::MakeTxTexture, resized, target, config);
+#else
+	(void)source;
+	(void)target;
+	(void)maxResolution;
+	(void)sourceTexels;
+	(void)texels;
+	return false;
+#endif
+}
+
+static bool make_atlas_texture(const std::vector<unsigned char>& pixels, int size, const std::string& target)
+{
+#ifdef ESS_USE_OIIO
+	OIIO::ImageSpec config;
+	config.tile_width = ESS_TEXTURE_TILE_SIZE;
+	config.tile_height = ESS_TEXTURE_TILE_SIZE;
+	config.tile_depth = 1;
+	config.attribute("compression", "zip");
+	config.attribute("maketx:filtername", "lanczos3");
+	OIIO::ImageBuf page(OIIO::ImageSpec(size, size, 4, OIIO::TypeDesc::UINT8), (void*)&pixels[0]);
+	return OIIO::ImageBufAlgo::make_texture(OIIO::ImageBufAlgo::MakeTxTexture, page, target, config);
+#else
+	(void)pixels;
+	(void)size;
+	(void)target;
+	return false;
+#endif
+}
+
+EssTextureCache::EssTextureCache() :
+	mOpen(false),
+	mNumThreads(0),
+	mStats(NULL),
+	mAtlasSize(0),
+	mNumRunning(0),
+	mStop(false),
+	mReused(0),
+	mConverted(0),
+	mFailed(0),
+	mDownsampled(0),
+	mSourceTexels(0),
+	mCachedTexels(0),
+	mLogCallback(NULL)
+{
+}
+
+EssTextureCache::~EssTextureCache()
+{
+	Close();
+}
+
+bool EssTextureCache::IsAvailable()
+{
+#ifdef ESS_USE_OIIO
+	return true;
+#else
+	return false;
+#endif
+}
+
+std::string EssTextureCache::GetCachedName(unsigned long long hash) const
+{
+	return mDirectory + ess_hash_to_string(hash) + ".tx";
+}
+
+bool EssTextureCache::Open(const std::string& directory, unsigned int numThreads, EssExportStats* stats)
+{
+	Close();
+	if (!IsAvailable() || directory.empty())
+	{
+		return false;
+	}
+	mDirectory = directory;
+	const char last = mDirectory[mDirectory.size() - 1];
+	if (last != '/' && last != '\\')
+	{
+		mDirectory += '/';
+	}
+	mNumThreads = numThreads > 0 ? numThreads : std::thread::hardware_concurrency();
+	if (mNumThreads == 0)
+	{
+		mNumThreads = 1;
+	}
+	mStats = stats;
+	mPrevSources.clear();
+	mSources.clear();
+	mResolved.clear();
+	mQueued.clear();
+	mCapTag.clear();
+	mPrevCaps.clear();
+	mCaps.clear();
+	mDeferred.clear();
+	mMaxResolutions.clear();
+	mAtlasSize = 0;
+	mAtlas.Reset(ESS_ATLAS_PAGE_SIZE, ESS_ATLAS_GUTTER, std::string());
+	mNotAtlased.clear();
+	mPrevAtlases.clear();
+	mAtlases.clear();
+	mStop = false;
+	mReused = 0;
+	mConverted = 0;
+	mFailed = 0;
+	mDownsampled = 0;
+	mSourceTexels = 0;
+	mCachedTexels = 0;
+	mOpen = true;
+
+	std::ifstream index((mDirectory + ESS_TEXTURE_INDEX_NAME).c_str());
+	std::string line;
+	bool versionOk = false;
+	while (std::getline(index, line))
+	{
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+		// texture <mtime> <size> <hash> <source>, the source last as it may contain anything
+		// capped <resolution> <cached file>
+		// atlas <hash> <page file>
+		int version = 0;
+		unsigned long long mtime, size, hash;
+		unsigned int resolution;
+		int offset = 0;
+		if (sscanf(line.c_str(), "version\t%d", &version) == 1)
+		{
+			versionOk = version == ESS_TEXTURE_INDEX_VERSION;
+		}
+		else if (!versionOk)
+		{
+			// written by another version, convert everything
+			break;
+		}
+		else if (sscanf(line.c_str(), "texture\t%llu\t%llu\t%llx\t%n", &mtime, &size, &hash, &offset) == 3 && offset > 0)
+		{
+			Source& source = mPrevSources[line.substr(offset)];
+			source.mtime = mtime;
+			source.size = size;
+			source.hash = hash;
+		}
+		else if (sscanf(line.c_str(), "capped\t%u\t%n", &resolution, &offset) == 1 && offset > 0)
+		{
+			mPrevCaps[line.substr(offset)] = resolution;
+		}
+		else if (sscanf(line.c_str(), "atlas\t%llx\t%n", &hash, &offset) == 1 && offset > 0)
+		{
+			mPrevAtlases[line.substr(offset)] = hash;
+		}
+	}
+	return true;
+}
+
+std::string EssTextureCache::Resolve(const std::string& source)
+{
+	if (!mOpen)
+	{
+		return source;
+	}
+	std::map<std::string, std::string>::const_iterator resolved = mResolved.find(source);
+	if (resolved != mResolved.end())
+	{
+		return resolved->second;
+	}
+	std::string& result = mResolved[source];
+	result = source;
+
+	Source info;
+	if (!get_file_info(source, info.mtime, info.size))
+	{
+		return result;
+	}
+	// only read the source if it changed since it was last seen
+	std::map<std::string, Source>::const_iterator prev = mPrevSources.find(source);
+	if (prev != mPrevSources.end() && prev->second.mtime == info.mtime && prev->second.size == info.size)
+	{
+		info.hash = prev->second.hash;
+	}
+	else if (!hash_file(source, info.hash))
+	{
+		return result;
+	}
+
+	Job job;
+	job.source = source;
+	job.size = info.size;
+	job.max_resolution = 0;
+	job.page = NULL;
+	if (HasResolutionCap())
+	{
+		// converted in Close, once the cap is known
+		if (!can_convert(source))
+		{
+			ess_log(mLogCallback, EH_WARNING, "Can't read texture %s, it isn't cached\n", source.c_str());
+			return result;
+		}
+		mSources[source] = info;
+		job.target = mDirectory + ess_hash_to_string(info.hash) + "_" + mCapTag + ".tx";
+		mDeferred[source] = job;
+		result = job.target;
+		return result;
+	}
+
+	const std::string target = GetCachedName(info.hash);
+	unsigned long long mtime, size;
+	if (get_file_info(target, mtime, size))
+	{
+		mSources[source] = info;
+		++ mReused;
+		result = target;
+		return result;
+	}
+	if (!can_convert(source))
+	{
+		ess_log(mLogCallback, EH_WARNING, "Can't read texture %s, it isn't cached\n", source.c_str());
+		return result;
+	}
+	mSources[source] = info;
+	result = target;
+	if (mQueued.find(info.hash) != mQueued.end())
+	{
+		return result;
+	}
+	mQueued[info.hash] = true;
+	job.target = target;
+	QueueJob(job);
+	return result;
+}
+
+void EssTextureCache::EnableAtlas(unsigned int maxSize, const std::string& tag)
+{
+	mAtlasSize = maxSize;
+	mAtlas.Reset(ESS_ATLAS_PAGE_SIZE, ESS_ATLAS_GUTTER, mDirectory + "atlas_" + tag);
+}
+
+bool EssTextureCache::ResolveRegion(const std::string& source, EssTextureAtlas::Region& region)
+{
+	if (!mOpen || mAtlasSize == 0 || mNotAtlased.find(source) != mNotAtlased.end())
+	{
+		return false;
+	}
+	if (mAtlas.Find(source, region))
+	{
+		return true;
+	}
+	int width = 0, height = 0;
+	if (get_image_size(source, width, height) && width <= (int)mAtlasSize && height <= (int)mAtlasSize &&
+		mAtlas.Add(source, width, height, region))
+	{
+		return true;
+	}
+	mNotAtlased[source] = true;
+	return false;
+}
+
+void EssTextureCache::QueueAtlasPages()
+{
+	const std::vector<EssTextureAtlas::Page>& pages = mAtlas.GetPages();
+	for (size_t i = 0; i < pages.size(); ++i)
+	{
+		// a page is rebuilt when its layout or a source changes
+		const EssTextureAtlas::Page& page = pages[i];
+		EssHash hasher;
+		hasher.UpdateValue(mAtlas.GetPageSize());
+		for (size_t j = 0; j < page.entries.size(); ++j)
+		{
+			const EssTextureAtlas::Entry& entry = page.entries[j];
+			unsigned long long mtime = 0, size = 0;
+			get_file_info(entry.source, mtime, size);
+			hasher.UpdateString(entry.source.c_str());
+			hasher.UpdateValue(mtime);
+			hasher.UpdateValue(size);
+			hasher.UpdateValue(entry.x);
+			hasher.UpdateValue(entry.y);
+			hasher.UpdateValue(entry.width);
+			hasher.UpdateValue(entry.height);
+		}
+		const unsigned long long hash = hasher.Digest();
+		const std::string name = page.filename.substr(mDirectory.size());
+		mAtlases[name] = hash;
+		std::map<std::string, unsigned long long>::const_iterator prev = mPrevAtlases.find(name);
+		unsigned long long mtime, size;
+		if (prev != mPrevAtlases.end() && prev->second == hash && get_file_info(page.filename, mtime, size))
+		{
+			++ mReused;
+			continue;
+		}
+		Job job;
+		job.target = page.filename;
+		job.size = 0;
+		job.max_resolution = 0;
+		job.page = &page;
+		QueueJob(job);
+	}
+}
+
+void EssTextureCache::QueueJob(const Job& job)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mThreads.size() < mNumThreads)
+	{
+		mThreads.push_back(std::thread(&EssTextureCache::WorkerLoop, this));
+	}
+	mJobs.push_back(job);
+	mJobReady.notify_one();
+}
+
+void EssTextureCache::QueueDeferred()
+{
+	// sources with the same content share a file, which gets the largest cap
+	std::map<std::string, Job> targets;
+	for (std::map<std::string, Job>::const_iterator iter = mDeferred.begin(); iter != mDeferred.end(); ++iter)
+	{
+		std::map<std::string, unsigned int>::const_iterator cap = mMaxResolutions.find(iter->first);
+		const unsigned int resolution = (cap != mMaxResolutions.end()) ? cap->second : 0;
+		std::pair<std::map<std::string, Job>::iterator, bool> inserted = targets.insert(std::make_pair(iter->second.target, iter->second));
+		Job& job = inserted.first->second;
+		job.page = NULL;
+		if (inserted.second)
+		{
+			job.max_resolution = resolution;
+		}
+		else if (job.max_resolution != 0)
+		{
+			job.max_resolution = (resolution == 0) ? 0 : std::max(job.max_resolution, resolution);
+		}
+	}
+	mDeferred.clear();
+
+	for (std::map<std::string, Job>::const_iterator iter = targets.begin(); iter != targets.end(); ++iter)
+	{
+		const Job& job = iter->second;
+		const std::string name = job.target.substr(mDirectory.size());
+		mCaps[name] = job.max_resolution;
+		std::map<std::string, unsigned int>::const_iterator prev = mPrevCaps.find(name);
+		unsigned long long mtime, size;
+		if (prev != mPrevCaps.end() && prev->second == job.max_resolution && get_file_info(job.target, mtime, size))
+		{
+			++ mReused;
+			continue;
+		}
+		QueueJob(job);
+	}
+}
+
+void EssTextureCache::WorkerLoop()
+{
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			while (mJobs.empty() && !mStop)
+			{
+				mJobReady.wait(lock);
+			}
+			if (mJobs.empty())
+			{
+				return;
+			}
+			job = mJobs.front();
+			mJobs.pop_front();
+			++ mNumRunning;
+		}
+
+		// converted under a temporary name, so a cached file is always complete
+		bool ok;
+		unsigned long long sourceTexels = 0, texels = 0;
+		{
+			EssStatTimer timer(mStats, ESS_STAT_TEXTURES, job.size);
+			const std::string partial = job.target.substr(0, job.target.size() - 3) + ".part.tx";
+			remove(job.target.c_str());
+			if (job.page != NULL)
+			{
+				std::vector<unsigned char> pixels;
+				ok = mAtlas.ComposePage(*job.page, read_rgba, pixels, mLogCallback) &&
+					make_atlas_texture(pixels, mAtlas.GetPageSize(), partial);
+			}
+			else
+			{
+				ok = make_texture(job.source, partial, job.max_resolution, sourceTexels, texels);
+			}
+			ok = ok && rename(partial.c_str(), job.target.c_str()) == 0;
+			if (!ok)
+			{
+				remove(partial.c_str());
+				ess_log(mLogCallback, EH_WARNING, "Failed to convert texture %s\n", job.page ? job.target.c_str() : job.source.c_str());
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		-- mNumRunning;
+		if (ok)
+		{
+			++ mConverted;
+			mSourceTexels += sourceTexels;
+			mCachedTexels += texels;
+			if (texels < sourceTexels)
+			{
+				++ mDownsampled;
+			}
+		}
+		else
+		{
+			++ mFailed;
+		}
+		mJobDone.notify_all();
+	}
+}
+
+bool EssTextureCache::Close()
+{
+	if (!mOpen)
+	{
+		return true;
+	}
+	QueueDeferred();
+	QueueAtlasPages();
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		while (!mJobs.empty() || mNumRunning > 0)
+		{
+			mJobDone.wait(lock);
+		}
+		mStop = true;
+		mJobReady.notify_all();
+	}
+	for (size_t i = 0; i < mThreads.size(); ++i)
+	{
+		mThreads[i].join();
+	}
+	mThreads.clear();
+	mOpen = false;
+
+	// sources seen by earlier exports stay indexed while their file is cached
+	std::map<std::string, Source> sources;
+	for (std::map<std::string, Source>::const_iterator iter = mPrevSources.begin(); iter != mPrevSources.end(); ++iter)
+	{
+		unsigned long long mtime, size;
+		if (get_file_info(GetCachedName(iter->second.hash), mtime, size))
+		{
+			sources[iter->first] = iter->second;
+		}
+	}
+	for (std::map<std::string, Source>::const_iterator iter = mSources.begin(); iter != mSources.end(); ++iter)
+	{
+		sources[iter->first] = iter->second;
+	}
+	std::ofstream index((mDirectory + ESS_TEXTURE_INDEX_NAME).c_str(), std::ios::trunc);
+	if (!index)
+	{
+		return false;
+	}
+	index << "# ESS texture cache\n";
+	index << "version\t" << ESS_TEXTURE_INDEX_VERSION << '\n';
+	for (std::map<std::string, Source>::const_iterator iter = sources.begin(); iter != sources.end(); ++iter)
+	{
+		index << "texture\t" << iter->second.mtime << '\t' << iter->second.size << '\t'
+			<< ess_hash_to_string(iter->second.hash) << '\t' << iter->first << '\n';
+	}
+	// caps of other scenes stay valid for them
+	std::map<std::string, unsigned int> caps = mPrevCaps;
+	for (std::map<std::string, unsigned int>::const_iterator iter = mCaps.begin(); iter != mCaps.end(); ++iter)
+	{
+		caps[iter->first] = iter->second;
+	}
+	for (std::map<std::string, unsigned int>::const_iterator iter = caps.begin(); iter != caps.end(); ++iter)
+	{
+		unsigned long long mtime, size;
+		if (get_file_info(mDirectory + iter->first, mtime, size))
+		{
+			index << "capped\t" << iter->second << '\t' << iter->first << '\n';
+		}
+	}
+	std::map<std::string, unsigned long long> atlases = mPrevAtlases;
+	for (std::map<std::string, unsigned long long>::const_iterator iter = mAtlases.begin(); iter != mAtlases.end(); ++iter)
+	{
+		atlases[iter->first] = iter->second;
+	}
+	for (std::map<std::string, unsigned long long>::const_iterator iter = atlases.begin(); iter != atlases.end(); ++iter)
+	{
+		unsigned long long mtime, size;
+		if (get_file_info(mDirectory + iter->first, mtime, size))
+		{
+			index << "atlas\t" << ess_hash_to_string(iter->second) << '\t' << iter->first << '\n';
+		}
+	}
+	return index.good();
+}
+
+void EssTextureCache::PrintReport(EH_LogCallback callback) const
+{
+	ess_log(callback, EH_INFO, "Texture cache: reused %u textures, converted %u, %u failed\n", mReused, mConverted, mFailed);
+	if (mDownsampled > 0)
+	{
+		ess_log(callback, EH_INFO, "Downsampled %u textures to the camera footprint, %.1f%% of the converted texels are kept\n",
+			mDownsampled, 100.0 * (double)mCachedTexels / (double)mSourceTexels);
+	}
+	size_t numPacked = 0;
+	const std::vector<EssTextureAtlas::Page>& pages = mAtlas.GetPages();
+	for (size_t i = 0; i < pages.size(); ++i)
+	{
+		numPacked += pages[i].entries.size();
+	}
+	if (numPacked > 0)
+	{
+		ess_log(callback, EH_INFO, "Packed %u textures into %u atlas pages, %u fewer texture files\n",
+			(unsigned int)numPacked, (unsigned int)pages.size(), (unsigned int)(numPacked - pages.size()));
+	}
+}
@@ -0,0 +1,340 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#include "essvalidate.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ESS_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Normals further from unit length are renormalized */
+#define ESS_NORMAL_LENGTH_TOLERANCE 1e-3f
+/* Squared length below which a normal has no direction */
+#define ESS_NORMAL_ZERO_LENGTH2 1e-20f
+
+inline bool Checkei_vectorNan(const eiVector &val)
+{
+	if (!_finite(val.x))return true;
+	if (!_finite(val.y))return true;
+	if (!_finite(val.z))return true;
+	return false;
+}
+
+inline bool Checkei_vector2Nan(const eiVector2 &val)
+{
+	if (!_finite(val.x))return true;
+	if (!_finite(val.y))return true;
+	return false;
+}
+
+static inline unsigned int FloatBits(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+bool ess_check_floats(const float* data, size_t count, float limit)
+{
+	// the magnitude bits of floats order like integers, NaN and
+	// infinity are above any finite limit
+	const unsigned int limitBits = FloatBits(fabsf(limit));
+	size_t i = 0;
+#ifdef ESS_USE_SSE2
+	const __m128i absMask = _mm_set1_epi32(0x7FFFFFFF);
+	const __m128i limitVec = _mm_set1_epi32((int)limitBits);
+	__m128i bad = _mm_setzero_si128();
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(data + i)), absMask);
+		const __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(data + i + 4)), absMask);
+		const __m128i c = _mm_and_si128(_mm_loadu_si128((const __m128i*)(data + i + 8)), absMask);
+		const __m128i d = _mm_and_si128(_mm_loadu_si128((const __m128i*)(data + i + 12)), absMask);
+		bad = _mm_or_si128(bad, _mm_or_si128(
+			_mm_or_si128(_mm_cmpgt_epi32(a, limitVec), _mm_cmpgt_epi32(b, limitVec)),
+			_mm_or_si128(_mm_cmpgt_epi32(c, limitVec), _mm_cmpgt_epi32(d, limitVec))));
+	}
+	if (_mm_movemask_epi8(bad) != 0)
+	{
+		return false;
+	}
+#endif
+	unsigned int worst = 0;
+	for (; i < count; ++i)
+	{
+		const unsigned int bits = FloatBits(data[i]) & 0x7FFFFFFF;
+		worst = bits > worst ? bits : worst;
+	}
+	return worst <= limitBits;
+}
+
+bool ess_check_indices(const uint_t* data, size_t count, uint_t limit)
+{
+	if (limit == 0)
+	{
+		return count == 0;
+	}
+	size_t i = 0;
+#ifdef ESS_USE_SSE2
+	// SSE2 only compares signed, flip the sign bits for unsigned order
+	const __m128i sign = _mm_set1_epi32((int)0x80000000);
+	const __m128i maxVec = _mm_xor_si128(_mm_set1_epi32((int)(limit - 1)), sign);
+	__m128i bad = _mm_setzero_si128();
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + i)), sign);
+		const __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + i + 4)), sign);
+		const __m128i c = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + i + 8)), sign);
+		const __m128i d = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + i + 12)), sign);
+		bad = _mm_or_si128(bad, _mm_or_si128(
+			_mm_or_si128(_mm_cmpgt_epi32(a, maxVec), _mm_cmpgt_epi32(b, maxVec)),
+			_mm_or_si128(_mm_cmpgt_epi32(c, maxVec), _mm_cmpgt_epi32(d, maxVec))));
+	}
+	if (_mm_movemask_epi8(bad) != 0)
+	{
+		return false;
+	}
+#endif
+	uint_t worst = 0;
+	for (; i < count; ++i)
+	{
+		worst = data[i] > worst ? data[i] : worst;
+	}
+	return worst < limit;
+}
+
+EssMeshReport::EssMeshReport() :
+	bad_verts(0),
+	bad_indices(0),
+	huge_verts(0),
+	bad_normals(0),
+	scaled_normals(0),
+	bad_uvs(0),
+	dropped_triangles(0)
+{
+}
+
+bool EssMeshReport::HasIssues() const
+{
+	return bad_verts > 0 || bad_indices > 0 || huge_verts > 0 || bad_normals > 0 || scaled_normals > 0 || bad_uvs > 0;
+}
+
+void EssMeshReport::Print(const std::string& meshName, bool fixed, EH_LogCallback callback) const
+{
+	ess_log(callback, EH_WARNING, "Mesh %s: %u non-finite vertices, %u triangles with bad indices, %u huge coordinates, "
+		"%u invalid normals, %u unnormalized normals, %u non-finite UVs; %u triangles dropped%s\n",
+		meshName.c_str(), bad_verts, bad_indices, huge_verts, bad_normals, scaled_normals, bad_uvs,
+		dropped_triangles, fixed ? ", arrays fixed" : "");
+}
+
+EssMeshValidator::EssMeshValidator() :
+	mModel(NULL),
+	mCheckIndices(false)
+{
+}
+
+bool EssMeshValidator::Check(const EH_Mesh& model, EssMeshReport& report)
+{
+	mModel = &model;
+	mBadVerts.clear();
+	mCheckIndices = false;
+
+	const size_t numIndices = (size_t)model.num_faces * 3;
+	const uint_t* indexStreams[] = { model.face_indices, model.n_indices, model.uv_indices };
+	for (int s = 0; s < 3; ++s)
+	{
+		if (indexStreams[s] != NULL && !ess_check_indices(indexStreams[s], numIndices, model.num_verts))
+		{
+			mCheckIndices = true;
+		}
+	}
+
+	const float* verts = (const float*)model.verts;
+	if (!ess_check_floats(verts, (size_t)model.num_verts * 3, FLT_MAX))
+	{
+		mBadVerts.assign(model.num_verts, 0);
+		for (uint_t i = 0; i < model.num_verts; ++i)
+		{
+			if (Checkei_vectorNan(((const eiVector*)verts)[i]))
+			{
+				mBadVerts[i] = 1;
+				++ report.bad_verts;
+			}
+		}
+	}
+
+	if (mCheckIndices)
+	{
+		for (uint_t i = 0; i < model.num_faces; ++i)
+		{
+			for (int s = 0; s < 3; ++s)
+			{
+				const uint_t* index = indexStreams[s] ? indexStreams[s] + i * 3 : NULL;
+				if (index != NULL && (index[0] >= model.num_verts || index[1] >= model.num_verts || index[2] >= model.num_verts))
+				{
+					++ report.bad_indices;
+					break;
+				}
+			}
+		}
+	}
+	return !mCheckIndices && mBadVerts.empty();
+}
+
+bool EssMeshValidator::IsTriangleValidSlow(uint_t i, bool dropBadVerts) const
+{
+	const EH_Mesh& model = *mModel;
+	const uint_t* indexStreams[] = { model.face_indices, model.n_indices, model.uv_indices };
+	for (int s = 0; s < 3; ++s)
+	{
+		const uint_t* index = indexStreams[s] ? indexStreams[s] + i * 3 : NULL;
+		if (index != NULL && (index[0] >= model.num_verts || index[1] >= model.num_verts || index[2] >= model.num_verts))
+		{
+			return false;
+		}
+	}
+	if (dropBadVerts && !mBadVerts.empty())
+	{
+		const uint_t* index = model.face_indices + i * 3;
+		if (mBadVerts[index[0]] || mBadVerts[index[1]] || mBadVerts[index[2]])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void ess_sanitize_mesh(EssMeshArrays& mesh, float maxCoordinate, bool fix, EssMeshReport& report)
+{
+	if (!mesh.verts.empty() && !ess_check_floats(&mesh.verts[0].x, mesh.verts.size() * 3, maxCoordinate))
+	{
+		for (size_t i = 0; i < mesh.verts.size(); ++i)
+		{
+			eiVector& p = mesh.verts[i];
+			if (Checkei_vectorNan(p))
+			{
+				// only left with the report policy
+				continue;
+			}
+			if (fabsf(p.x) > maxCoordinate || fabsf(p.y) > maxCoordinate || fabsf(p.z) > maxCoordinate)
+			{
+				++ report.huge_verts;
+				if (fix)
+				{
+					p.x = std::max(-maxCoordinate, std::min(p.x, maxCoordinate));
+					p.y = std::max(-maxCoordinate, std::min(p.y, maxCoordinate));
+					p.z = std::max(-maxCoordinate, std::min(p.z, maxCoordinate));
+				}
+			}
+		}
+	}
+
+	if (!mesh.uvs.empty() && !ess_check_floats(&mesh.uvs[0].x, mesh.uvs.size() * 2, FLT_MAX))
+	{
+		for (size_t i = 0; i < mesh.uvs.size(); ++i)
+		{
+			if (Checkei_vector2Nan(mesh.uvs[i]))
+			{
+				++ report.bad_uvs;
+				if (fix)
+				{
+					mesh.uvs[i] = ei_vector2(0.0f, 0.0f);
+				}
+			}
+		}
+	}
+
+	if (mesh.normals.empty())
+	{
+		return;
+	}
+	// the common case is unit normals, tell them apart in one pass
+	std::vector<unsigned char> badNormals;
+	const float minLength2 = (1.0f - ESS_NORMAL_LENGTH_TOLERANCE) * (1.0f - ESS_NORMAL_LENGTH_TOLERANCE);
+	const float maxLength2 = (1.0f + ESS_NORMAL_LENGTH_TOLERANCE) * (1.0f + ESS_NORMAL_LENGTH_TOLERANCE);
+	for (size_t i = 0; i < mesh.normals.size(); ++i)
+	{
+		eiVector& n = mesh.normals[i];
+		const float length2 = n.x * n.x + n.y * n.y + n.z * n.z;
+		if (length2 >= minLength2 && length2 <= maxLength2)
+		{
+			continue;
+		}
+		if (!_finite(length2) || length2 < ESS_NORMAL_ZERO_LENGTH2)
+		{
+			++ report.bad_normals;
+			if (badNormals.empty())
+			{
+				badNormals.assign(mesh.normals.size(), 0);
+			}
+			badNormals[i] = 1;
+			continue;
+		}
+		++ report.scaled_normals;
+		if (fix)
+		{
+			const float scale = 1.0f / sqrtf(length2);
+			n.x *= scale;
+			n.y *= scale;
+			n.z *= scale;
+		}
+	}
+	if (!fix || badNormals.empty())
+	{
+		return;
+	}
+
+	// degenerate normals take the normal of a triangle using them
+	const std::vector<uint_t>& normalIndices = mesh.n_indices.empty() ? mesh.vert_indices : mesh.n_indices;
+	for (size_t i = 0; i + 2 < mesh.vert_indices.size(); i += 3)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			const uint_t n = normalIndices[i + k];
+			if (badNormals[n] != 1)
+			{
+				continue;
+			}
+			const eiVector& p0 = mesh.verts[mesh.vert_indices[i]];
+			const eiVector& p1 = mesh.verts[mesh.vert_indices[i + 1]];
+			const eiVector& p2 = mesh.verts[mesh.vert_indices[i + 2]];
+			const eiVector e1 = ei_vector(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+			const eiVector e2 = ei_vector(p2.x - p0.x, p2.y - p0.y, p2.z - p0.z);
+			eiVector face = ei_vector(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+			const float length2 = face.x * face.x + face.y * face.y + face.z * face.z;
+			if (!_finite(length2) || length2 < ESS_NORMAL_ZERO_LENGTH2)
+			{
+				continue;
+			}
+			const float scale = 1.0f / sqrtf(length2);
+			mesh.normals[n] = ei_vector(face.x * scale, face.y * scale, face.z * scale);
+			badNormals[n] = 2;
+		}
+	}
+	for (size_t i = 0; i < badNormals.size(); ++i)
+	{
+		if (badNormals[i] == 1)
+		{
+			mesh.normals[i] = ei_vector(0.0f, 0.0f, 1.0f);
+		}
+	}
+}
@@ -15,124 +15,42 @@
  *************************************************************************/
 
 #include "esswriter.h"
+#include "base85.h"
+#include "essformat.h"
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
 
 using namespace std;
 
-inline bool Checkei_vectorNan(eiVector &val)
-{
-	if (!_finite(val.x))return true;
-	if (!_finite(val.y))return true;
-	if (!_finite(val.z))return true;
-	return false;
-}
-
-inline bool Checkei_vector2Nan(eiVector2 &val)
-{
-	if (!_finite(val.x))return true;
-	if (!_finite(val.y))return true;
-	return false;
-}
-
-/** Standard conforming implementation of Base85 encoding
- * reference:
- * https://raw.githubusercontent.com/zeromq/rfc/master/src/spec_32.c
- */
-// Maps base 256 to base 85
-static const char encoder[85 + 1] = {
-    "0123456789" 
-    "abcdefghij" 
-    "klmnopqrst" 
-    "uvwxyzABCD"
-    "EFGHIJKLMN" 
-    "OPQRSTUVWX" 
-    "YZ.-:+=^!/" 
-    "*?&<>()[]{" 
-    "}@%$#"
-};
-
-size_t base85_calc_encode_bound(size_t input_length)
-{
-	size_t padding_size = 0;
-	size_t remainder = input_length % 4;
-	if (remainder > 0)
-	{
-		padding_size = 4 - remainder;
-	}
-	size_t padded_length = input_length + padding_size;
-	size_t output_length = (padded_length / 4) * 5 - padding_size;
-	return output_length + 1;
-}
-
-size_t base85_encode(const BYTE *data, size_t input_length, BYTE *encoded_data)
-{
-	unsigned int remainder = input_length % 4;
-	unsigned int padding_size = 0;
-	if (remainder > 0)
-	{
-		padding_size = 4 - remainder;
-	}
-	unsigned int padded_length = input_length + padding_size;
-	unsigned int output_length = (padded_length / 4) * 5 - padding_size;
-
-	unsigned int char_nbr = 0;
-	for (unsigned int byte_nbr = 0; byte_nbr < padded_length; byte_nbr += 4)
-	{
-		unsigned int value = 0;
-		if (byte_nbr + 0 < input_length)
-		{
-			value += (data[byte_nbr + 0] << 3 * 8);
-		}
-		if (byte_nbr + 1 < input_length)
-		{
-			value += (data[byte_nbr + 1] << 2 * 8);
-		}
-		if (byte_nbr + 2 < input_length)
-		{
-			value += (data[byte_nbr + 2] << 1 * 8);
-		}
-		if (byte_nbr + 3 < input_length)
-		{
-			value += data[byte_nbr + 3];
-		}
-		if (char_nbr < output_length)
-		{
-			encoded_data[char_nbr] = encoder[value / (85 * 85 * 85 * 85) % 85];
-			++ char_nbr;
-		}
-		if (char_nbr < output_length)
-		{
-			encoded_data[char_nbr] = encoder[value / (85 * 85 * 85) % 85];
-			++ char_nbr;
-		}
-		if (char_nbr < output_length)
-		{
-			encoded_data[char_nbr] = encoder[value / (85 * 85) % 85];
-			++ char_nbr;
-		}
-		if (char_nbr < output_length)
-		{
-			encoded_data[char_nbr] = encoder[value / 85 % 85];
-			++ char_nbr;
-		}
-		if (char_nbr < output_length)
-		{
-			encoded_data[char_nbr] = encoder[value % 85];
-			++ char_nbr;
-		}
-	}
+#define CHECK_STREAM() if(mSink == NULL) return;
+#define CHECK_EDIT_MODE() if(!mInNode) return;
 
-	encoded_data[char_nbr] = '\0';
+/* Arrays are encoded in chunks of this many input bytes, so the
+   encoding buffer stays small whatever the size of the array.
+   Must be a multiple of 4 to keep Base85 groups intact. */
+#define ESS_B85_CHUNK_SIZE (64 * 1024)
 
-	return char_nbr + 1;
-}
+/* Number of array rows formatted into the text buffer at once. */
+#define ESS_FORMAT_BATCH_ROWS 4096
 
-
-#define CHECK_STREAM() if(!mStream.is_open()) return;
-#define CHECK_EDIT_MODE() if(!mInNode) return;
+/* Max number of pipeline jobs queued or in flight, bounds the memory
+   held by encoded nodes waiting for their turn. */
+#define ESS_PIPELINE_MAX_PENDING 64
 
 EssWriter::EssWriter()
-	:mInNode(false)
+	:mStream(&mBuffer),
+	mSink(NULL),
+	mOutput(NULL),
+	mStats(NULL),
+	mOwnsSink(false),
+	mSwapLocale(false),
+	mPipeline(NULL),
+	mInNode(false),
+	mInSidecarNode(false),
+	mDeclareStorage(ESSBIN_STORAGE_PARAM),
+	mLogCallback(NULL),
+	mJobFailed(false)
 {
 
 }
@@ -142,13 +60,48 @@ EssWriter::~EssWriter()
 	Close();
 }
 
-void EssWriter::Close()
+bool EssWriter::Close()
 {
-	if (mStream.is_open())
+	bool ok = true;
+	if (mSink != NULL)
+	{
+		if (mPipeline != NULL)
+		{
+			// queue the buffered tail behind the pending jobs, then
+			// wait until everything reached the sink
+			mBuffer.Redirect(mOutput);
+			ok = mPipeline->Wait();
+			mPipeline->Stop();
+			delete mPipeline;
+			mPipeline = NULL;
+		}
+		ok = mBuffer.Detach() && ok;
+		if (mOwnsSink)
+		{
+			ok = mOutput->Close() && ok;
+			delete mSink;
+		}
+		mSink = NULL;
+		mOutput = NULL;
+		mOwnsSink = false;
+	}
+	if (mSidecar.IsOpen() && !mSidecar.Close())
+	{
+		ess_log(mLogCallback, EH_ERROR, "Failed to write sidecar %s\n", mSidecarName.c_str());
+		ok = false;
+	}
+	if (mJobFailed)
+	{
+		ok = false;
+		mJobFailed = false;
+	}
+	mInSidecarNode = false;
+	if (mSwapLocale)
 	{
-		mStream.close();
+		std::locale::global(mPreviousLocale);
+		mSwapLocale = false;
 	}
-	std::locale::global(mPreviousLocale);
+	return ok;
 }
 
 void EssWriter::BeginNode(const char* type, const string& name)
@@ -160,30 +113,30 @@ void EssWriter::BeginNode(const char* type, const char* name)
 {
 	if (mInNode) EndNode();
 	CHECK_STREAM();
-	mStream << "node " << "\"" << (type) << "\"" << " " << "\"" << (name) << "\"" << endl;
+	mStream << "node " << "\"" << (type) << "\"" << " " << "\"" << (name) << "\"" << '\n';
 	mInNode = true;
 }
 
 void EssWriter::BeginNameSpace(const char *name)
 {
-	mStream << "namespace " << "\"" << name << "\"" << endl;
+	mStream << "namespace " << "\"" << name << "\"" << '\n';
 }
 
 void EssWriter::AddParseEss(const char *ess_name)
 {
-	mStream << "\tparse2 " << "\"" << ess_name << "\"" << " on" << endl;
+	mStream << "\tparse2 " << "\"" << ess_name << "\"" << " on" << '\n';
 }
 
 void EssWriter::EndNameSpace()
 {
-	mStream << "end namespace" << endl;
+	mStream << "end namespace" << '\n';
 }
 
 void EssWriter::LinkParam(const char* input, const string& shader, const char* output)
 {
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\tparam_link " << "\"" << (input) << "\"" << " " << "\"" << (shader) << "\"" << " " << "\"" << (output) << "\"" << endl;
+	mStream << "\tparam_link " << "\"" << (input) << "\"" << " " << "\"" << (shader) << "\"" << " " << "\"" << (output) << "\"" << '\n';
 }
 
 
@@ -191,56 +144,73 @@ void EssWriter::AddScalar(const char* name, const float value)
 {
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\tscalar " << "\"" << (name) << "\"" << " " << value << endl;
+	mStream << "\tscalar " << "\"" << (name) << "\"" << " ";
+	WriteFloats(&value, 1);
+	mStream << '\n';
 }
 
 void EssWriter::AddInt(const char * name, const int value)
 {
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\tint " << "\"" << (name) << "\"" << " " << value << endl;
+	mStream << "\tint " << "\"" << (name) << "\"" << " " << value << '\n';
 }
 
 void EssWriter::AddVector4(const char* name, const eiVector4& value)
 {
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\tvector4 " << "\"" << (name) << "\"" << " " << value.x << " " << value.y << " " << value.z << " " << value.w << endl;
+	const float values[4] = { value.x, value.y, value.z, value.w };
+	mStream << "\tvector4 " << "\"" << (name) << "\"" << " ";
+	WriteFloats(values, 4);
+	mStream << '\n';
 }
 
 void EssWriter::AddVector3(const char* name, const eiVector& value)
 {
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\tvector " << "\"" << (name) << "\"" << " " << value.x << " " << value.y << " " << value.z << endl;
+	const float values[3] = { value.x, value.y, value.z };
+	mStream << "\tvector " << "\"" << (name) << "\"" << " ";
+	WriteFloats(values, 3);
+	mStream << '\n';
 }
 
 void EssWriter::AddVector2(const char* name, const eiVector2& value)
 {
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\tvector2 " << "\"" << (name) << "\"" << " " << value.x << " " << value.y << endl;
+	const float values[2] = { value.x, value.y };
+	mStream << "\tvector2 " << "\"" << (name) << "\"" << " ";
+	WriteFloats(values, 2);
+	mStream << '\n';
 }
 
 void EssWriter::AddToken(const char* name, const string& value)
 {
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\ttoken " << "\"" << (name) << "\"" << " " << "\"" << (value) << "\"" << endl;
+	mStream << "\ttoken " << "\"" << (name) << "\"" << " " << "\"" << (value) << "\"" << '\n';
 }
 
 void EssWriter::AddColor(const char * name, const eiVector4& value)
 {
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\tcolor " << "\"" << (name) << "\"" << " " << value.x * value.w << " " << value.y * value.w << " " << value.z * value.w << endl;
+	const float values[3] = { value.x * value.w, value.y * value.w, value.z * value.w };
+	mStream << "\tcolor " << "\"" << (name) << "\"" << " ";
+	WriteFloats(values, 3);
+	mStream << '\n';
 }
 
 void EssWriter::AddColor(const char * name, const eiVector& value)
 {
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\tcolor " << "\"" << (name) << "\"" << " " << value.x << " " << value.y<< " " << value.z<< endl;
+	const float values[3] = { value.x, value.y, value.z };
+	mStream << "\tcolor " << "\"" << (name) << "\"" << " ";
+	WriteFloats(values, 3);
+	mStream << '\n';
 }
 
 
@@ -248,26 +218,26 @@ void EssWriter::AddBool(const char* name, const bool value)
 {
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\tbool " << "\"" << (name) << "\"" << " " << (value ? "on" : "off") << endl;
+	mStream << "\tbool " << "\"" << (name) << "\"" << " " << (value ? "on" : "off") << '\n';
 }
 
 void EssWriter::AddRef(const string& name, const string& ref)
 {
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\tref " <<  "\"" << (name) << "\"" <<" " << "\"" << (ref) << "\"" << endl;
+	mStream << "\tref " <<  "\"" << (name) << "\"" <<" " << "\"" << (ref) << "\"" << '\n';
 }
 
 void EssWriter::AddRefGroup(const char* grouptype, const std::vector<std::string>& refelements)
 {
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\tref[] " << "\"" << (grouptype) << "\"" << " 1" << endl;
+	mStream << "\tref[] " << "\"" << (grouptype) << "\"" << " 1" << '\n';
 	for (std::vector<std::string>::const_iterator it = refelements.begin();
 	it != refelements.end();
 	++it)
 	{
-		mStream << "\t\t" << "\"" << (*it) << "\"" << endl;
+		mStream << "\t\t" << "\"" << (*it) << "\"" << '\n';
 	}
 }
 
@@ -276,26 +246,20 @@ void EssWriter::AddMatrix(const char* name, const eiMatrix& ei_matrixrix)
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
 	mStream << "\tmatrix " << "\"" << (name) << "\"" << " ";
-	for (int row = 0; row < 4; ++row)
-	{
-		for (int col = 0; col < 4; ++col)
-		{
-			mStream << ei_matrixrix.m[row][col] << " ";
-		}		
-	}
-	mStream << endl;
+	WriteFloats(&ei_matrixrix.m[0][0], 16);
+	mStream << " \n";
 }
 void EssWriter::AddEnum(const char* name, const char* value)
 {	
 	CHECK_STREAM();
 	CHECK_EDIT_MODE();
-	mStream << "\tenum " <<  "\"" << (name) << "\"" <<" " << "\"" << (value) << "\"" << endl;
+	mStream << "\tenum " <<  "\"" << (name) << "\"" <<" " << "\"" << (value) << "\"" << '\n';
 }
 
 void EssWriter::AddRenderCommand(const char* inst_group_name, const char* cam_name, const char* option_name)
 {
 	CHECK_STREAM();
-	mStream << "render " << "\"" << (inst_group_name) << "\"" << " " << "\"" << (cam_name) << "\"" << " " << "\"" << (option_name) << "\"" << endl;
+	mStream << "render " << "\"" << (inst_group_name) << "\"" << " " << "\"" << (cam_name) << "\"" << " " << "\"" << (option_name) << "\"" << '\n';
 }
 
 void EssWriter::AddDeclare()
@@ -308,13 +272,108 @@ void EssWriter::AddDeclare()
 void EssWriter::AddDeclare(const char* type, const char* name, const char *storage_class)
 {
 	CHECK_STREAM();
+	if (mInSidecarNode)
+	{
+		// the storage class goes with the array that follows
+		mDeclareName = name;
+		if (strcmp(storage_class, "uniform") == 0)
+		{
+			mDeclareStorage = ESSBIN_STORAGE_UNIFORM;
+		}
+		else if (strcmp(storage_class, "varying") == 0)
+		{
+			mDeclareStorage = ESSBIN_STORAGE_VARYING;
+		}
+		else if (strcmp(storage_class, "facevarying") == 0)
+		{
+			mDeclareStorage = ESSBIN_STORAGE_FACEVARYING;
+		}
+		else
+		{
+			mDeclareStorage = ESSBIN_STORAGE_CONSTANT;
+		}
+		return;
+	}
 	CHECK_EDIT_MODE();
-	mStream << "\tdeclare " << type << " " << "\"" << (name) << "\"" << " " << storage_class << endl;
+	mStream << "\tdeclare " << type << " " << "\"" << (name) << "\"" << " " << storage_class << '\n';
+}
+
+void EssWriter::WriteFloats(const float* pValues, size_t count)
+{
+	EssStatTimer timer(mStats, ESS_STAT_ENCODING, count * sizeof(float));
+	char buffer[ESS_FLOAT_MAX_CHARS + 1];
+	for (size_t i = 0; i < count; ++i)
+	{
+		char* p = buffer;
+		if (i > 0)
+		{
+			*p++ = ' ';
+		}
+		p += ess_format_float(pValues[i], p);
+		mStream.write(buffer, p - buffer);
+	}
+}
+
+void EssWriter::WriteFloatRows(const float* pValues, size_t numRows, size_t numCols)
+{
+	EssStatTimer timer(mStats, ESS_STAT_ENCODING, numRows * numCols * sizeof(float));
+	const size_t rowSize = 3 + numCols * (ESS_FLOAT_MAX_CHARS + 1);
+	if (mFormatBuffer.size() < ESS_FORMAT_BATCH_ROWS * rowSize)
+	{
+		mFormatBuffer.resize(ESS_FORMAT_BATCH_ROWS * rowSize);
+	}
+	while (numRows > 0)
+	{
+		const size_t batchRows = numRows < ESS_FORMAT_BATCH_ROWS ? numRows : ESS_FORMAT_BATCH_ROWS;
+		size_t size = ess_format_float_rows(pValues, batchRows, numCols, &mFormatBuffer[0]);
+		mStream.write(&mFormatBuffer[0], size);
+		pValues += batchRows * numCols;
+		numRows -= batchRows;
+	}
+}
+
+void EssWriter::WriteBase85(const void* pData, size_t dataSize)
+{
+	EssStatTimer timer(mStats, ESS_STAT_ENCODING, dataSize);
+	if (mEncodeBuffer.empty())
+	{
+		mEncodeBuffer.resize(base85_calc_encode_bound(ESS_B85_CHUNK_SIZE));
+	}
+	const BYTE* pSrc = (const BYTE*)pData;
+	BYTE* pDst = &mEncodeBuffer[0];
+
+	while (dataSize > ESS_B85_CHUNK_SIZE)
+	{
+		size_t encodedSize = base85_encode_groups(pSrc, ESS_B85_CHUNK_SIZE, pDst);
+		mStream.write((char*)pDst, encodedSize);
+		pSrc += ESS_B85_CHUNK_SIZE;
+		dataSize -= ESS_B85_CHUNK_SIZE;
+	}
+
+	// the last chunk carries the partial group and the terminating NUL
+	size_t encodedSize = base85_encode(pSrc, dataSize, pDst);
+	mStream.write((char*)pDst, encodedSize);
+}
+
+void EssWriter::AddSidecarArray(const char* name, unsigned int type, bool faceVarying, const void* pData, size_t arraySize)
+{
+	unsigned int storage = faceVarying ? ESSBIN_STORAGE_FACEVARYING : ESSBIN_STORAGE_PARAM;
+	if (mDeclareName == name)
+	{
+		storage = mDeclareStorage;
+	}
+	mDeclareName.clear();
+	mSidecar.AddArray(mSidecarNode.c_str(), name, type, storage, pData, arraySize);
 }
 
 void EssWriter::AddIndexArray(const char* name, const unsigned int* pIndexArray, size_t arraySize, bool faceVarying)
 {
 	CHECK_STREAM();
+	if (mInSidecarNode)
+	{
+		AddSidecarArray(name, ESSBIN_TYPE_INDEX, faceVarying, pIndexArray, arraySize);
+		return;
+	}
 	CHECK_EDIT_MODE();
 	if (mBinartyEncoding)
 	{
@@ -326,17 +385,8 @@ void EssWriter::AddIndexArray(const char* name, const unsigned int* pIndexArray,
 			mStream << "\tb85_index[] " << "\"" << (name) << "\"" << " 1 ";
 		}
 
-		size_t memSize = base85_calc_encode_bound(arraySize * sizeof(unsigned int));
-		BYTE* pOutBuffer = new BYTE[memSize];
-		size_t realSize = base85_encode((BYTE*)pIndexArray, arraySize * sizeof(unsigned int), pOutBuffer);
-		mStream.write((char*)pOutBuffer, realSize);
-		mStream << endl;
-		if (memSize != realSize)
-		{
-			printf("Error! MemSize != RealSize in AddIndexArray\n");
-		}
-		delete[] pOutBuffer;
-		pOutBuffer = NULL;
+		WriteBase85(pIndexArray, arraySize * sizeof(unsigned int));
+		mStream << '\n';
 	}
 	else
 	{
@@ -348,18 +398,23 @@ void EssWriter::AddIndexArray(const char* name, const unsigned int* pIndexArray,
 			mStream << "\tindex[] " << "\"" << (name) << "\"" << " 1 ";
 		}
 
-		for (UINT i=0;i<arraySize;i++)
+		// 16 indices per line
+		char line[3 + 16 * (ESS_UINT_MAX_CHARS + 1)];
+		for (size_t i = 0; i < arraySize; i += 16)
 		{
-			const unsigned int _index = pIndexArray[i];
-
-			if (i%16 == 0)
+			char* p = line;
+			*p++ = '\n';
+			*p++ = '\t';
+			*p++ = '\t';
+			const size_t lineEnd = (i + 16 < arraySize) ? (i + 16) : arraySize;
+			for (size_t j = i; j < lineEnd; ++j)
 			{
-				mStream << endl << "\t\t";
+				p += ess_format_uint(pIndexArray[j], p);
+				*p++ = ' ';
 			}
-			mStream << _index << " ";
-
+			mStream.write(line, p - line);
 		}
-		mStream << endl;
+		mStream << '\n';
 	}
 }
 
@@ -370,108 +425,78 @@ void EssWriter::AddVectorArray(const char* name, const eiVector* pVectorArray, s
 	if (faceVarying)
 	{
 	AddDeclare();
-	mStream << "vector[] " << "\"" << (name) << "\"" << " facevarying" << endl;
+	mStream << "vector[] " << "\"" << (name) << "\"" << " facevarying" << '\n';
 	}
 	mStream << "\tb85_vector[] " << "\"" << (name) << "\"" << " 1 ";*/
 	//Todo: add binary encoded data from pVectorArray
 
 	CHECK_STREAM();
+	if (mInSidecarNode)
+	{
+		AddSidecarArray(name, ESSBIN_TYPE_VECTOR, faceVarying, pVectorArray, arraySize);
+		return;
+	}
 	CHECK_EDIT_MODE();
 	if (mBinartyEncoding)
 	{
 		mStream << "\tb85_vector[] " << "\"" << (name) << "\"" << " 1 ";
 
-		size_t memSize = base85_calc_encode_bound(arraySize * sizeof(eiVector));
-		BYTE* pOutBuffer = new BYTE[memSize];
-
-		size_t realSize = base85_encode((BYTE*)pVectorArray, arraySize * sizeof(eiVector), pOutBuffer);
-
-		mStream.write((char*)pOutBuffer, realSize);
-		mStream << endl;
-		if (memSize != realSize)
-		{
-			printf("Error! MemSize != RealSize in AddVectorArray\n");
-		}
-		delete[] pOutBuffer;
-		pOutBuffer = NULL;
+		WriteBase85(pVectorArray, arraySize * sizeof(eiVector));
+		mStream << '\n';
 	}
 	else
 	{
-		mStream << "\tvector[] " << "\"" << (name) << "\"" << " 1 " << endl;
+		mStream << "\tvector[] " << "\"" << (name) << "\"" << " 1 " << '\n';
 
-		for (UINT i=0;i<arraySize;i++)
-		{
-			const eiVector& _vec = pVectorArray[i];
-			mStream << "\t\t" << _vec.x << " " << _vec.y << " " << _vec.z << endl;
-		}
+		WriteFloatRows((const float*)pVectorArray, arraySize, 3);
 	}
 }
 
 void EssWriter::AddVector2Array(const char* name, const eiVector2* pVectorArray, size_t arraySize)
 {
 	CHECK_STREAM();
+	if (mInSidecarNode)
+	{
+		AddSidecarArray(name, ESSBIN_TYPE_VECTOR2, false, pVectorArray, arraySize);
+		return;
+	}
 	CHECK_EDIT_MODE();
 	if (mBinartyEncoding)
 	{
 		mStream << "\tb85_vector2[] " << "\"" << (name) << "\"" << " 1 ";
 
-		size_t memSize = base85_calc_encode_bound(arraySize * sizeof(eiVector2));
-		BYTE* pOutBuffer = new BYTE[memSize];
-
-		size_t realSize = base85_encode((BYTE*)pVectorArray, arraySize * sizeof(eiVector2), pOutBuffer);
-
-		mStream.write((char*)pOutBuffer, realSize);
-		mStream << endl;
-		if (memSize != realSize)
-		{
-			printf("Error! MemSize != RealSize in AddVector2Array\n");
-		}
-		delete[] pOutBuffer;
-		pOutBuffer = NULL;
+		WriteBase85(pVectorArray, arraySize * sizeof(eiVector2));
+		mStream << '\n';
 	}
 	else
 	{
-		mStream << "\tvector2[] " << "\"" << (name) << "\"" << " 1 " << endl;
+		mStream << "\tvector2[] " << "\"" << (name) << "\"" << " 1 " << '\n';
 
-		for (UINT i=0; i<arraySize; i++)
-		{
-			const eiVector2& _vec = pVectorArray[i];
-			mStream << "\t\t" << _vec.x << " " << _vec.y << endl;
-		}
+		WriteFloatRows((const float*)pVectorArray, arraySize, 2);
 	}
 }
 
 void EssWriter::AddPointArray(const char* name, const eiVector* pPointArray, size_t arraySize)
 {
 	CHECK_STREAM();
+	if (mInSidecarNode)
+	{
+		AddSidecarArray(name, ESSBIN_TYPE_POINT, false, pPointArray, arraySize);
+		return;
+	}
 	CHECK_EDIT_MODE();
 	if (mBinartyEncoding)
 	{
 		mStream << "\tb85_point[] " << "\"" << (name) << "\"" << " 1 ";
 
-		size_t memSize = base85_calc_encode_bound(arraySize * sizeof(eiVector));
-		BYTE* pOutBuffer = new BYTE[memSize];
-
-		size_t realSize = base85_encode((BYTE*)pPointArray, arraySize * sizeof(eiVector), pOutBuffer);
-
-		mStream.write((char*)pOutBuffer, realSize);
-		mStream << endl;
-		if (memSize != realSize)
-		{
-			printf("Error! MemSize != RealSize in AddPointArray\n");
-		}
-		delete[] pOutBuffer;
-		pOutBuffer = NULL;
+		WriteBase85(pPointArray, arraySize * sizeof(eiVector));
+		mStream << '\n';
 	}
 	else
 	{
-		mStream << "\tpoint[] " << "\"" << (name) << "\"" << " 1 " << endl;
+		mStream << "\tpoint[] " << "\"" << (name) << "\"" << " 1 " << '\n';
 
-		for (UINT i=0;i<arraySize;i++)
-		{
-			const eiVector& _pos = pPointArray[i];
-			mStream << "\t\t" << _pos.x << " " << _pos.y << " " << _pos.z << endl;
-		}
+		WriteFloatRows((const float*)pPointArray, arraySize, 3);
 	}
 }
 
@@ -482,32 +507,164 @@ void EssWriter::AddCustomString(const char* string)
 	mStream << string;
 }
 
+void EssWriter::AddRawNodes(const char* data, size_t size)
+{
+	CHECK_STREAM();
+	if (mInNode) EndNode();
+	mStream.write(data, size);
+}
+
 void EssWriter::EndNode()
 {
 	CHECK_STREAM();
-	mStream << "end" << endl;
+	mStream << "end" << '\n';
 	mInNode = false;
 }
 
+bool EssWriter::OpenSidecar(const char* filename, const char* sidecarName)
+{
+	if (!mSidecar.Open(filename))
+	{
+		return false;
+	}
+	mSidecarName = sidecarName;
+	return true;
+}
+
+void EssWriter::BeginSidecarNode(const char* name)
+{
+	if (mInNode) EndNode();
+	if (!mSidecar.IsOpen())
+	{
+		return;
+	}
+	mSidecarNode = name;
+	mDeclareName.clear();
+	mInSidecarNode = true;
+}
+
+void EssWriter::EndSidecarNode()
+{
+	mInSidecarNode = false;
+	mDeclareName.clear();
+}
+
 bool EssWriter::Initialize(const char* filename, const bool encoding)
 {
+	return Initialize(filename, encoding, EssFileSinkOptions());
+}
+
+bool EssWriter::Initialize(const char* filename, const bool encoding, const EssFileSinkOptions& options)
+{
+	EssFileSink* pFileSink = new EssFileSink();
+	if (!pFileSink->Open(filename, options))
+	{
+		delete pFileSink;
+		return false;
+	}
+	if (!Initialize(pFileSink, encoding, options.buffer_size))
+	{
+		delete pFileSink;
+		return false;
+	}
+	mOwnsSink = true;
+	return true;
+}
+
+bool EssWriter::Initialize(EssOutputSink* sink, const bool encoding, size_t bufferSize)
+{
+	if (sink == NULL)
+	{
+		return false;
+	}
+	Close();
+
 	std::locale newLocale(std::locale(), "", std::locale::ctype);
 	mPreviousLocale = std::locale::global(newLocale);
-	try
+	mSwapLocale = true;
+
+	mSink = sink;
+	mOutput = sink;
+	if (mStats != NULL)
 	{
-		mStream.open(filename, ios::out);
-		if (!mStream.is_open())
-		{
-			return false;
-		}
+		mTimedSink.Attach(sink, mStats);
+		mOutput = &mTimedSink;
+	}
+	mOwnsSink = false;
+	if (!mBuffer.Attach(mOutput, bufferSize))
+	{
+		Close();
+		return false;
+	}
+	mStream.clear();
+
+	mStream << "# ESS generated by esswriter" << '\n' << '\n';
+	mStream << "link " << "\"" << "liber_shader" << "\"" << '\n';
+	mBinartyEncoding = encoding;
+	return true;
+}
+
+bool EssWriter::InitializeFragment(EssOutputSink* sink, const bool encoding, size_t bufferSize)
+{
+	if (sink == NULL)
+	{
+		return false;
 	}
-	catch (const std::exception&)
+	Close();
+
+	// no locale swap, fragments are written on worker threads
+	mSink = sink;
+	mOutput = sink;
+	mOwnsSink = false;
+	if (!mBuffer.Attach(mOutput, bufferSize))
 	{
+		Close();
 		return false;
 	}
-	
-	mStream << "# ESS generated by esswriter" << endl <<endl;
-	mStream << "link " << "\"" << "liber_shader" << "\"" << endl;
+	mStream.clear();
 	mBinartyEncoding = encoding;
 	return true;
 }
+
+bool EssWriter::StartPipeline(unsigned int numThreads)
+{
+	if (mSink == NULL)
+	{
+		return false;
+	}
+	if (mPipeline != NULL)
+	{
+		return true;
+	}
+	mPipeline = new EssPipeline();
+	mPipeline->Start(mOutput, mBinartyEncoding, numThreads, ESS_PIPELINE_MAX_PENDING, mStats);
+	mBuffer.Redirect(mPipeline);
+	return true;
+}
+
+void EssWriter::SubmitNodes(const EssPipeline::Job& job)
+{
+	CHECK_STREAM();
+	if (mInNode) EndNode();
+	if (mPipeline == NULL)
+	{
+		if (!job(*this))
+		{
+			mJobFailed = true;
+		}
+		return;
+	}
+	// place the job after everything written so far
+	mStream.flush();
+	mPipeline->Submit(job);
+}
+
+void EssWriter::WaitPipeline()
+{
+	if (mPipeline == NULL)
+	{
+		return;
+	}
+	mStream.flush();
+	mPipeline->Wait();
+}
@@ -0,0 +1,117 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "base85.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/** Encode/decode round trip of every length up to a few groups, and
+ * of a large buffer that goes through the SIMD kernels, compared
+ * against the scalar reference. Runs with every kernel the CPU
+ * supports, not only the one base85_encode picks.
+ */
+
+static int g_failures = 0;
+static base85_kernel g_kernel = BASE85_KERNEL_SCALAR;
+
+#define EXPECT(cond) \
+	if (!(cond)) \
+	{ \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		++ g_failures; \
+	}
+
+static void round_trip(const std::vector<unsigned char> &data)
+{
+	const size_t bound = base85_calc_encode_bound(data.size());
+	std::vector<unsigned char> encoded(bound + 1, 0xCD);
+	std::vector<unsigned char> reference(bound + 1, 0xCD);
+
+	const size_t size = base85_encode_kernel(g_kernel, data.empty() ? NULL : &data[0], data.size(), &encoded[0]);
+	const size_t ref_size = base85_encode_scalar(data.empty() ? NULL : &data[0], data.size(), &reference[0]);
+	EXPECT(size == bound);
+	EXPECT(ref_size == bound);
+	EXPECT(encoded[bound] == 0xCD);
+	EXPECT(encoded[size - 1] == '\0');
+	EXPECT(memcmp(&encoded[0], &reference[0], size) == 0);
+
+	const size_t encoded_length = size - 1;
+	std::vector<unsigned char> decoded(base85_calc_decode_size(encoded_length) + 1, 0xCD);
+	const size_t decoded_size = base85_decode(&encoded[0], encoded_length, &decoded[0]);
+	EXPECT(decoded_size == data.size());
+	EXPECT(data.empty() || memcmp(&decoded[0], &data[0], data.size()) == 0);
+}
+
+static void run_kernel(base85_kernel kernel, const char *name)
+{
+	if (!base85_kernel_supported(kernel))
+	{
+		printf("base85 (%s): not supported by this CPU, skipped\n", name);
+		return;
+	}
+	g_kernel = kernel;
+	const int failures = g_failures;
+	srand(85);
+
+	for (size_t length = 0; length <= 67; ++length)
+	{
+		std::vector<unsigned char> data(length);
+		for (size_t i = 0; i < length; ++i)
+		{
+			data[i] = (unsigned char)rand();
+		}
+		round_trip(data);
+	}
+
+	/* extreme group values */
+	round_trip(std::vector<unsigned char>(64, 0x00));
+	round_trip(std::vector<unsigned char>(64, 0xFF));
+
+	std::vector<unsigned char> large(1 << 20);
+	for (size_t i = 0; i < large.size(); ++i)
+	{
+		large[i] = (unsigned char)rand();
+	}
+	round_trip(large);
+
+	printf("base85 (%s): %s\n", name, g_failures == failures ? "passed" : "FAILED");
+}
+
+int main()
+{
+	run_kernel(BASE85_KERNEL_SCALAR, "scalar");
+	run_kernel(BASE85_KERNEL_SSE41, "sse4.1");
+	run_kernel(BASE85_KERNEL_AVX2, "avx2");
+
+	/* the dispatched encoder matches the kernels */
+	const unsigned char text[] = "dispatch";
+	unsigned char dispatched[16], scalar[16];
+	EXPECT(base85_encode(text, 8, dispatched) == 11);
+	EXPECT(base85_encode_kernel(BASE85_KERNEL_SCALAR, text, 8, scalar) == 11);
+	EXPECT(memcmp(dispatched, scalar, 11) == 0);
+
+	/* characters outside the alphabet and a lone trailing character */
+	const unsigned char invalid[] = "ab\"de";
+	unsigned char out[8];
+	EXPECT(base85_decode(invalid, 5, out) == 0);
+	EXPECT(base85_decode((const unsigned char *)"012345", 6, out) == 0);
+
+	printf("base85 (selected %s): %s\n", base85_kernel_name(), g_failures == 0 ? "passed" : "FAILED");
+	return g_failures == 0 ? 0 : 1;
+}
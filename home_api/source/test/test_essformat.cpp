@@ -0,0 +1,98 @@
+/**************************************************************************
+ * Copyright (C) 2017 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+
+#include "essformat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/** Integers and floats formatted by essformat read back to the same
+ * value and stay inside the documented buffer sizes.
+ */
+
+static int g_failures = 0;
+
+#define EXPECT(cond) \
+	if (!(cond)) \
+	{ \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		++ g_failures; \
+	}
+
+static void check_uint(unsigned int value)
+{
+	/* guard bytes on both sides catch writes outside the buffer */
+	char buffer[ESS_UINT_MAX_CHARS + 2];
+	memset(buffer, '#', sizeof(buffer));
+	const size_t length = ess_format_uint(value, buffer + 1);
+	EXPECT(length >= 1 && length <= ESS_UINT_MAX_CHARS);
+	EXPECT(buffer[0] == '#');
+	EXPECT(buffer[length + 1] == '#');
+
+	char expected[32];
+	const int expected_length = snprintf(expected, sizeof(expected), "%u", value);
+	EXPECT(length == (size_t)expected_length);
+	EXPECT(memcmp(buffer + 1, expected, length) == 0);
+}
+
+static void check_float(float value)
+{
+	char buffer[ESS_FLOAT_MAX_CHARS + 1];
+	const size_t length = ess_format_float(value, buffer);
+	EXPECT(length >= 1 && length <= ESS_FLOAT_MAX_CHARS);
+	buffer[length] = '\0';
+	EXPECT(strtof(buffer, NULL) == value);
+}
+
+int main()
+{
+	check_uint(0);
+	check_uint(9);
+	check_uint(10);
+	check_uint(999999999);
+	check_uint(1000000000);
+	check_uint(4000000000u);
+	check_uint(UINT_MAX);
+	for (unsigned int value = 1; value < UINT_MAX / 10; value *= 10)
+	{
+		check_uint(value - 1);
+		check_uint(value);
+	}
+
+	check_float(0.0f);
+	check_float(1.0f);
+	check_float(-0.5f);
+	check_float(0.1f);
+	check_float(3.14159265f);
+	check_float(1.17549435e-38f);
+	check_float(-3.40282347e+38f);
+	srand(10);
+	for (int i = 0; i < 100000; ++i)
+	{
+		unsigned int bits = ((unsigned int)rand() << 16) ^ (unsigned int)rand();
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		if (value == value && value - value == 0.0f)
+		{
+			check_float(value);
+		}
+	}
+
+	printf("essformat: %s\n", g_failures == 0 ? "passed" : "FAILED");
+	return g_failures == 0 ? 0 : 1;
+}
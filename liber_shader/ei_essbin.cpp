@@ -0,0 +1,485 @@
+/**************************************************************************
+ * Copyright (C) 2013 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#include "ei_essbin.h"
+#include <ei.h>
+#include <string.h>
+#include <zlib.h>
+#include <set>
+#ifdef ESS_USE_ZSTD
+#	include <zstd.h>
+#endif
+
+#ifdef _WIN32
+#	include <Windows.h>
+#else
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+static size_t essbin_item_size(unsigned int type)
+{
+	switch (type)
+	{
+	case ESSBIN_TYPE_INDEX:
+		return sizeof(eiIndex);
+	case ESSBIN_TYPE_POINT:
+	case ESSBIN_TYPE_VECTOR:
+		return 3 * sizeof(eiScalar);
+	case ESSBIN_TYPE_VECTOR2:
+		return 2 * sizeof(eiScalar);
+	}
+	return 0;
+}
+
+EssBinFile::EssBinFile() :
+#ifdef _WIN32
+	mFile(INVALID_HANDLE_VALUE),
+	mMapping(NULL),
+#endif
+	mData(NULL),
+	mSize(0),
+	mEntries(NULL),
+	mStrings(NULL)
+{
+}
+
+EssBinFile::~EssBinFile()
+{
+	Unmap();
+}
+
+void EssBinFile::Unmap()
+{
+#ifdef _WIN32
+	if (mData != NULL)
+	{
+		UnmapViewOfFile(mData);
+	}
+	if (mMapping != NULL)
+	{
+		CloseHandle(mMapping);
+		mMapping = NULL;
+	}
+	if (mFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(mFile);
+		mFile = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (mData != NULL)
+	{
+		munmap((void *)mData, mSize);
+	}
+#endif
+	mData = NULL;
+	mSize = 0;
+	mEntries = NULL;
+	mStrings = NULL;
+	mNodes.clear();
+}
+
+bool EssBinFile::Open(const char *filename)
+{
+	Unmap();
+
+#ifdef _WIN32
+	// let the exporter replace the file while it's mapped
+	mFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(mFile, &file_size) || file_size.QuadPart == 0)
+	{
+		Unmap();
+		return false;
+	}
+	mSize = (size_t)file_size.QuadPart;
+	mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mMapping == NULL)
+	{
+		Unmap();
+		return false;
+	}
+	mData = (const char *)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+	if (mData == NULL)
+	{
+		Unmap();
+		return false;
+	}
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+	mSize = (size_t)st.st_size;
+	void *data = mmap(NULL, mSize, PROT_READ, MAP_SHARED, fd, 0);
+	// the mapping keeps its own reference to the file
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		mSize = 0;
+		return false;
+	}
+	mData = (const char *)data;
+#endif
+
+	// validate the header and footer before trusting any offset
+	if (mSize < sizeof(EssBinHeader) + sizeof(EssBinFooter))
+	{
+		Unmap();
+		return false;
+	}
+	const EssBinHeader *header = (const EssBinHeader *)mData;
+	const EssBinFooter *footer = (const EssBinFooter *)(mData + mSize - sizeof(EssBinFooter));
+	if (memcmp(header->magic, ESSBIN_MAGIC, sizeof(header->magic)) != 0 ||
+		memcmp(footer->magic, ESSBIN_MAGIC, sizeof(footer->magic)) != 0)
+	{
+		ei_error("Invalid essbin file: %s\n", filename);
+		Unmap();
+		return false;
+	}
+	if (header->version != ESSBIN_VERSION || footer->version != ESSBIN_VERSION)
+	{
+		ei_error("Unsupported essbin version %d: %s\n", header->version, filename);
+		Unmap();
+		return false;
+	}
+	const unsigned long long table_size = (unsigned long long)footer->num_entries * sizeof(EssBinEntry);
+	if (footer->table_offset + table_size > mSize ||
+		footer->strings_offset + footer->strings_size > mSize ||
+		(footer->strings_size > 0 && mData[footer->strings_offset + footer->strings_size - 1] != '\0'))
+	{
+		ei_error("Corrupted essbin file: %s\n", filename);
+		Unmap();
+		return false;
+	}
+	mEntries = (const EssBinEntry *)(mData + footer->table_offset);
+	mStrings = mData + footer->strings_offset;
+
+	for (unsigned int i = 0; i < footer->num_entries; ++i)
+	{
+		const EssBinEntry & entry = mEntries[i];
+		if (entry.offset + entry.size > mSize ||
+			(entry.codec == ESSBIN_CODEC_RAW && entry.size < entry.count * essbin_item_size(entry.type)) ||
+			entry.node_name >= footer->strings_size ||
+			entry.param_name >= footer->strings_size)
+		{
+			ei_error("Corrupted essbin entry %d: %s\n", i, filename);
+			Unmap();
+			return false;
+		}
+		mNodes[mStrings + entry.node_name].push_back(i);
+	}
+
+	return true;
+}
+
+const std::vector<unsigned int> *EssBinFile::FindNode(const char *node_name) const
+{
+	std::map<std::string, std::vector<unsigned int> >::const_iterator iter = mNodes.find(node_name);
+	if (iter == mNodes.end())
+	{
+		return NULL;
+	}
+	return &iter->second;
+}
+
+struct EssBinDecodeJob
+{
+	const char *data;
+	const unsigned long long *offsets;
+	unsigned int codec;
+	unsigned int block_size;
+	unsigned int num_blocks;
+	unsigned int first_block;
+	unsigned int block_step;
+	char *output;
+	size_t output_size;
+	bool failed;
+};
+
+static bool essbin_decode_block(unsigned int codec, const char *src, size_t src_size, char *dst, size_t dst_size)
+{
+	switch (codec)
+	{
+	case ESSBIN_CODEC_ZLIB:
+		{
+			uLongf size = (uLongf)dst_size;
+			return uncompress((Bytef *)dst, &size, (const Bytef *)src, (uLong)src_size) == Z_OK && size == dst_size;
+		}
+#ifdef ESS_USE_ZSTD
+	case ESSBIN_CODEC_ZSTD:
+		{
+			size_t size = ZSTD_decompress(dst, dst_size, src, src_size);
+			return !ZSTD_isError(size) && size == dst_size;
+		}
+#endif
+	}
+	return false;
+}
+
+static EI_THREAD_FUNC essbin_decode_thread(void *param)
+{
+	EssBinDecodeJob *job = (EssBinDecodeJob *)param;
+
+	// job k decodes blocks k, k + step, ...
+	for (unsigned int i = job->first_block; i < job->num_blocks; i += job->block_step)
+	{
+		const size_t dst_offset = (size_t)i * job->block_size;
+		const size_t dst_size = (job->output_size - dst_offset) < job->block_size ? (job->output_size - dst_offset) : job->block_size;
+		if (!essbin_decode_block(job->codec, 
+			job->data + job->offsets[i], (size_t)(job->offsets[i + 1] - job->offsets[i]), 
+			job->output + dst_offset, dst_size))
+		{
+			job->failed = true;
+		}
+	}
+
+	return (EI_THREAD_FUNC_RESULT)EI_TRUE;
+}
+
+const void *EssBinFile::GetData(const EssBinEntry &entry, std::vector<char> &buffer) const
+{
+	if (entry.codec == ESSBIN_CODEC_RAW)
+	{
+		return mData + entry.offset;
+	}
+
+	const char *data = mData + entry.offset;
+	const EssBinBlockHeader *header = (const EssBinBlockHeader *)data;
+	const unsigned long long *offsets = (const unsigned long long *)(header + 1);
+	const size_t raw_size = (size_t)entry.count * essbin_item_size(entry.type);
+	if (entry.size < sizeof(EssBinBlockHeader) || 
+		header->block_size == 0 || 
+		header->num_blocks != (raw_size + header->block_size - 1) / header->block_size || 
+		sizeof(EssBinBlockHeader) + (header->num_blocks + 1) * sizeof(unsigned long long) > entry.size || 
+		offsets[header->num_blocks] > entry.size)
+	{
+		return NULL;
+	}
+	for (unsigned int i = 0; i < header->num_blocks; ++i)
+	{
+		if (offsets[i] > offsets[i + 1])
+		{
+			return NULL;
+		}
+	}
+
+	buffer.resize(raw_size);
+	if (raw_size == 0)
+	{
+		return NULL;
+	}
+
+	EssBinDecodeJob jobs[ESSBIN_DECODE_THREADS];
+	eiThreadHandle threads[ESSBIN_DECODE_THREADS];
+	const unsigned int num_jobs = header->num_blocks < ESSBIN_DECODE_THREADS ? header->num_blocks : ESSBIN_DECODE_THREADS;
+	for (unsigned int k = 0; k < num_jobs; ++k)
+	{
+		EssBinDecodeJob & job = jobs[k];
+		job.data = data;
+		job.offsets = offsets;
+		job.codec = entry.codec;
+		job.block_size = header->block_size;
+		job.num_blocks = header->num_blocks;
+		job.first_block = k;
+		job.block_step = num_jobs;
+		job.output = &buffer[0];
+		job.output_size = raw_size;
+		job.failed = false;
+	}
+	// the calling thread takes the first job itself
+	for (unsigned int k = 1; k < num_jobs; ++k)
+	{
+		threads[k] = ei_create_thread(essbin_decode_thread, &jobs[k], NULL);
+	}
+	essbin_decode_thread(&jobs[0]);
+	bool failed = jobs[0].failed;
+	for (unsigned int k = 1; k < num_jobs; ++k)
+	{
+		ei_wait_thread(threads[k]);
+		ei_delete_thread(threads[k]);
+		failed = failed || jobs[k].failed;
+	}
+
+	return failed ? NULL : &buffer[0];
+}
+
+/** Identifies one version of a file, the exporter replaces the
+ * sidecar by renaming, so a new export gets a new stamp.
+ */
+struct EssBinStamp
+{
+	unsigned long long size;
+	unsigned long long mtime;
+	unsigned long long id;
+
+	bool operator == (const EssBinStamp & other) const
+	{
+		return size == other.size && mtime == other.mtime && id == other.id;
+	}
+};
+
+static bool essbin_get_stamp(const char *filename, EssBinStamp & stamp)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &data))
+	{
+		return false;
+	}
+	stamp.size = ((unsigned long long)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	stamp.mtime = ((unsigned long long)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+	stamp.id = ((unsigned long long)data.ftCreationTime.dwHighDateTime << 32) | data.ftCreationTime.dwLowDateTime;
+#else
+	struct stat st;
+	if (stat(filename, &st) != 0)
+	{
+		return false;
+	}
+	stamp.size = (unsigned long long)st.st_size;
+	stamp.mtime = (unsigned long long)st.st_mtime;
+	stamp.id = (unsigned long long)st.st_ino;
+#endif
+	return true;
+}
+
+struct EssBinMapping
+{
+	EssBinFile *file;
+	EssBinStamp stamp;
+};
+
+static eiRWLock *g_essbin_lock = NULL;
+static std::map<std::string, EssBinMapping> g_essbin_files;
+/* procedurals reading each mapping, between ei_essbin_open and close */
+static std::map<EssBinFile *, unsigned int> g_essbin_refs;
+/* replaced mappings still being read, freed by the last close */
+static std::set<EssBinFile *> g_essbin_retired;
+
+void ei_essbin_init()
+{
+	g_essbin_lock = ei_create_rwlock();
+}
+
+void ei_essbin_exit()
+{
+	for (std::map<std::string, EssBinMapping>::iterator iter = g_essbin_files.begin();
+		iter != g_essbin_files.end(); ++iter)
+	{
+		delete iter->second.file;
+	}
+	g_essbin_files.clear();
+	for (std::set<EssBinFile *>::iterator iter = g_essbin_retired.begin(); iter != g_essbin_retired.end(); ++iter)
+	{
+		delete *iter;
+	}
+	g_essbin_retired.clear();
+	g_essbin_refs.clear();
+	if (g_essbin_lock != NULL)
+	{
+		ei_delete_rwlock(g_essbin_lock);
+		g_essbin_lock = NULL;
+	}
+}
+
+EssBinFile *ei_essbin_open(const char *filename)
+{
+	EssBinStamp stamp;
+	if (!essbin_get_stamp(filename, stamp))
+	{
+		return NULL;
+	}
+
+	EssBinFile *file = NULL;
+
+	// the reference count changes on every open, so this is always a writer
+	ei_write_lock(g_essbin_lock);
+	{
+		std::map<std::string, EssBinMapping>::iterator iter = g_essbin_files.find(filename);
+		if (iter != g_essbin_files.end() && iter->second.stamp == stamp)
+		{
+			file = iter->second.file;
+		}
+		else
+		{
+			file = new EssBinFile();
+			if (file->Open(filename))
+			{
+				if (iter != g_essbin_files.end())
+				{
+					// the file was exported again since it was mapped
+					EssBinFile *old = iter->second.file;
+					if (g_essbin_refs[old] == 0)
+					{
+						g_essbin_refs.erase(old);
+						delete old;
+					}
+					else
+					{
+						g_essbin_retired.insert(old);
+					}
+				}
+				EssBinMapping & mapping = g_essbin_files[filename];
+				mapping.file = file;
+				mapping.stamp = stamp;
+			}
+			else
+			{
+				delete file;
+				file = NULL;
+			}
+		}
+		if (file != NULL)
+		{
+			++ g_essbin_refs[file];
+		}
+	}
+	ei_write_unlock(g_essbin_lock);
+
+	return file;
+}
+
+void ei_essbin_close(EssBinFile *file)
+{
+	if (file == NULL)
+	{
+		return;
+	}
+	ei_write_lock(g_essbin_lock);
+	{
+		std::map<EssBinFile *, unsigned int>::iterator iter = g_essbin_refs.find(file);
+		if (iter != g_essbin_refs.end() && iter->second > 0 && -- iter->second == 0 &&
+			g_essbin_retired.erase(file) > 0)
+		{
+			g_essbin_refs.erase(iter);
+			delete file;
+		}
+	}
+	ei_write_unlock(g_essbin_lock);
+}
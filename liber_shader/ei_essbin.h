@@ -0,0 +1,144 @@
+/**************************************************************************
+ * Copyright (C) 2013 Rendease Co., Ltd.
+ * All rights reserved.
+ *
+ * This program is commercial software: you must not redistribute it
+ * and/or modify it without written permission from Rendease Co., Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * End User License Agreement for more details.
+ *
+ * You should have received a copy of the End User License Agreement along
+ * with this program.  If not, see <http://www.rendease.com/licensing/>
+ *************************************************************************/
+
+#ifndef EI_ESSBIN_H
+#define EI_ESSBIN_H
+
+/** Reader of the .essbin array sidecar written by the home API exporter.
+ * The structures mirror home_api/source/include/essbin.h, keep both in sync.
+ * \file ei_essbin.h
+ */
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#define ESSBIN_MAGIC		"ESSBIN\0\0"
+#define ESSBIN_VERSION		2
+
+/** Max number of threads decoding the blocks of one array */
+#define ESSBIN_DECODE_THREADS	8
+
+enum EssBinType
+{
+	ESSBIN_TYPE_INDEX = 0,
+	ESSBIN_TYPE_POINT,
+	ESSBIN_TYPE_VECTOR,
+	ESSBIN_TYPE_VECTOR2,
+};
+
+enum EssBinStorage
+{
+	ESSBIN_STORAGE_PARAM = 0,
+	ESSBIN_STORAGE_CONSTANT,
+	ESSBIN_STORAGE_UNIFORM,
+	ESSBIN_STORAGE_VARYING,
+	ESSBIN_STORAGE_FACEVARYING,
+};
+
+enum EssBinCodec
+{
+	ESSBIN_CODEC_RAW = 0,
+	ESSBIN_CODEC_ZLIB,
+	ESSBIN_CODEC_ZSTD,
+};
+
+struct EssBinHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int flags;
+};
+
+struct EssBinEntry
+{
+	unsigned long long offset;
+	unsigned long long size;
+	unsigned long long count;
+	unsigned int node_name;
+	unsigned int param_name;
+	unsigned int type;
+	unsigned int storage;
+	unsigned int codec;
+	unsigned int reserved;
+};
+
+struct EssBinBlockHeader
+{
+	unsigned int block_size;
+	unsigned int num_blocks;
+};
+
+struct EssBinFooter
+{
+	unsigned long long table_offset;
+	unsigned long long strings_offset;
+	unsigned long long strings_size;
+	unsigned int num_entries;
+	unsigned int version;
+	char magic[8];
+};
+
+/** A read-only mapping of an .essbin file.
+ */
+class EssBinFile
+{
+private:
+#ifdef _WIN32
+	void *mFile;
+	void *mMapping;
+#endif
+	const char *mData;
+	size_t mSize;
+	const EssBinEntry *mEntries;
+	const char *mStrings;
+	/* node name -> indices of its entries */
+	std::map<std::string, std::vector<unsigned int> > mNodes;
+
+	void Unmap();
+
+public:
+	EssBinFile();
+	~EssBinFile();
+	bool Open(const char *filename);
+	/** Get the entries stored for a node, NULL if there are none. */
+	const std::vector<unsigned int> *FindNode(const char *node_name) const;
+	const EssBinEntry &GetEntry(unsigned int index) const { return mEntries[index]; }
+	const char *GetParamName(const EssBinEntry &entry) const { return mStrings + entry.param_name; }
+	/** Get the item data of an entry. Raw arrays point into the mapping,
+	 * compressed arrays are decoded into the buffer. NULL on error.
+	 */
+	const void *GetData(const EssBinEntry &entry, std::vector<char> &buffer) const;
+};
+
+/** Get the shared mapping of a resolved file name, mapping it
+ * on first use and again when the file was replaced since.
+ * Thread-safe, returns NULL on error. Release it with ei_essbin_close.
+ */
+EssBinFile *ei_essbin_open(const char *filename);
+
+/** Release a mapping from ei_essbin_open. A replaced mapping is
+ * unmapped once nothing reads it any more.
+ */
+void ei_essbin_close(EssBinFile *file);
+
+/** Called on module loading. */
+void ei_essbin_init();
+/** Unmap all files, called on module unloading. */
+void ei_essbin_exit();
+
+#endif
@@ -20,6 +20,10 @@
 #include <string>
 
 #include "ei_parse_abc.h"
+#include "ei_essbin.h"
+
+/* Number of items per slot of the data tables built from .essbin arrays */
+#define ESSBIN_TAB_ITEMS	1024
 
 geometry (ess_loader)
 
@@ -68,6 +72,157 @@ geometry (ess_loader)
 
 end_shader (ess_loader)
 
+static eiInt essbin_storage_class(unsigned int storage)
+{
+	switch (storage)
+	{
+	case ESSBIN_STORAGE_UNIFORM:
+		return EI_UNIFORM;
+	case ESSBIN_STORAGE_VARYING:
+		return EI_VARYING;
+	case ESSBIN_STORAGE_FACEVARYING:
+		return EI_FACEVARYING;
+	}
+	return EI_CONSTANT;
+}
+
+static void add_essbin_array(const EssBinFile *file, const EssBinEntry &entry)
+{
+	const char *name = file->GetParamName(entry);
+	std::vector<char> buffer;
+	const void *data = file->GetData(entry, buffer);
+	if (data == NULL)
+	{
+		ei_error("Cannot read essbin array %s\n", name);
+		return;
+	}
+
+	const eiInt type = (entry.type == ESSBIN_TYPE_INDEX) ? EI_TYPE_INDEX : 
+		((entry.type == ESSBIN_TYPE_VECTOR2) ? EI_TYPE_VECTOR2 : EI_TYPE_VECTOR);
+	if (entry.storage == ESSBIN_STORAGE_PARAM)
+	{
+		ei_param_array(name, ei_tab(type, ESSBIN_TAB_ITEMS));
+	}
+	else
+	{
+		ei_declare(name, essbin_storage_class(entry.storage), EI_TYPE_ARRAY, NULL);
+		ei_variable_array(name, ei_tab(type, ESSBIN_TAB_ITEMS));
+	}
+
+	const size_t count = (size_t)entry.count;
+	switch (entry.type)
+	{
+	case ESSBIN_TYPE_INDEX:
+		{
+			const eiIndex *indices = (const eiIndex *)data;
+			for (size_t i = 0; i < count; ++i)
+			{
+				ei_tab_add_index(indices[i]);
+			}
+		}
+		break;
+	case ESSBIN_TYPE_POINT:
+	case ESSBIN_TYPE_VECTOR:
+		{
+			const eiScalar *values = (const eiScalar *)data;
+			for (size_t i = 0; i < count; ++i, values += 3)
+			{
+				ei_tab_add_vector(values[0], values[1], values[2]);
+			}
+		}
+		break;
+	case ESSBIN_TYPE_VECTOR2:
+		{
+			const eiScalar *values = (const eiScalar *)data;
+			for (size_t i = 0; i < count; ++i, values += 2)
+			{
+				ei_tab_add_vector2(values[0], values[1]);
+			}
+		}
+		break;
+	}
+	ei_end_tab();
+}
+
+geometry (essbin_loader)
+
+	enum
+	{
+		e_filename = 0, 
+		e_mesh_name, 
+	};
+
+	static void parameters()
+	{
+		declare_token(filename, NULL);
+		declare_token(mesh_name, NULL);
+	}
+
+	static void init()
+	{
+	}
+
+	static void exit()
+	{
+	}
+
+	void init_node()
+	{
+	}
+
+	void exit_node()
+	{
+	}
+
+	void main(void *arg)
+	{
+		ei_sub_context();
+
+		eiToken filename = eval_token(filename);
+		eiToken mesh_name = eval_token(mesh_name);
+
+		char resolved_filename[ EI_MAX_FILE_NAME_LEN ];
+		ei_resolve_scene_name(resolved_filename, filename.str);
+
+		// the file is mapped once and shared by all meshes stored in it
+		EssBinFile *file = ei_essbin_open(resolved_filename);
+		const std::vector<unsigned int> *entries = (file != NULL) ? file->FindNode(mesh_name.str) : NULL;
+		if (entries == NULL)
+		{
+			ei_error("Cannot load mesh %s from %s\n", mesh_name.str, resolved_filename);
+			ei_essbin_close(file);
+			ei_end_sub_context();
+			return;
+		}
+
+		// the arrays are copied into the node, the mapping isn't needed after
+		ei_node("poly", mesh_name.str);
+		for (size_t i = 0; i < entries->size(); ++i)
+		{
+			add_essbin_array(file, file->GetEntry((*entries)[i]));
+		}
+		ei_end_node();
+		ei_essbin_close(file);
+
+		std::string inst_name = std::string(mesh_name.str) + "_inst";
+		ei_node("instance", inst_name.c_str());
+			ei_param_node("element", mesh_name.str);
+		ei_end_node();
+
+		ei_node("instgroup", "instance_group");
+			ei_param_array("instance_list", ei_tab(EI_TYPE_TAG_NODE, 1));
+				ei_tab_add_node(inst_name.c_str());
+			ei_end_tab();
+		ei_end_node();
+
+		// set the root node for current procedural object
+		geometry_root("instance_group");
+
+		ei_end_sub_context();
+	}
+
+end_shader (essbin_loader)
+
 geometry (vrmesh_loader)
 
 	enum
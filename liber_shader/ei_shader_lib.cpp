@@ -15,12 +15,15 @@
  *************************************************************************/
 
 #include "ei_shader_lib.h"
+#include "ei_essbin.h"
 #include <ei_assert.h>
 
 void module_init()
 {
+	ei_essbin_init();
 }
 
 void module_exit()
 {
+	ei_essbin_exit();
 }